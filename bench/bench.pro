@@ -0,0 +1,12 @@
+# Benchmarks. They don't need Qt or a Redis server.
+#
+#     qmake bench.pro && make
+#     ./protocol_bench [filter] [--min-time=seconds]
+#     ./load_bench [options] [scenario...]
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+        protocol_bench.pro
+
+linux: SUBDIRS += load_bench.pro
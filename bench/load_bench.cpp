@@ -0,0 +1,479 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// End-to-end throughput and latency benchmarks against an in-process MockServer,
+// so that they can run in CI without a real Redis server. Each scenario drives
+// the client with N threads for a while, and reports ops/sec and latency
+// percentiles:
+//
+// - redis: one command per call with Redis.
+// - pipeline: a batch of commands per call with Pipeline. Latency is per batch.
+// - cluster: one command per call with RedisCluster. With --migrate, slots keep
+//   being migrated between nodes, so that it also exercises ASK and MOVED.
+// - subscriber: N threads PUBLISH, and one Subscriber consumes. Latency is from
+//   PUBLISH to the message callback.
+//
+//     qmake bench.pro && make && ./load_bench [options] [scenario...]
+//
+// See *usage* for options.
+
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+#include "mock_server.h"
+#include "redis.h"
+#include "redis_cluster.h"
+
+namespace {
+
+struct Options {
+    std::vector<std::string> scenarios;
+
+    std::size_t threads = 4;
+
+    std::chrono::milliseconds duration{2000};
+
+    std::chrono::microseconds latency{0};
+
+    // Connect to a Unix domain socket, except for the cluster scenario.
+    bool unix_socket = false;
+
+    // Commands per batch of the pipeline scenario.
+    std::size_t batch = 16;
+
+    std::size_t keys = 10000;
+
+    std::size_t value_size = 64;
+
+    // get, set, hgetall or zrange.
+    std::string command = "get";
+
+    std::size_t nodes = 3;
+
+    bool migrate = false;
+};
+
+// Number of fields of each hash, and members of each sorted set.
+const std::size_t FIELDS = 10;
+
+struct Result {
+    std::uint64_t ops = 0;
+
+    std::uint64_t errors = 0;
+
+    double seconds = 0;
+
+    HistogramSnapshot latency;
+};
+
+using Clock = std::chrono::steady_clock;
+
+std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch()).count();
+}
+
+void usage(const char *name) {
+    std::printf("Usage: %s [options] [redis|pipeline|cluster|subscriber ...]\n"
+                "  --threads=N       client threads (default 4)\n"
+                "  --duration=MS     duration of each scenario (default 2000)\n"
+                "  --latency=US      artificial latency of the server (default 0)\n"
+                "  --unix            connect with a Unix domain socket\n"
+                "  --batch=N         commands per pipeline (default 16)\n"
+                "  --keys=N          number of keys (default 10000)\n"
+                "  --value-size=N    size of values (default 64)\n"
+                "  --command=CMD     get, set, hgetall or zrange (default get)\n"
+                "  --nodes=N         nodes of the cluster (default 3)\n"
+                "  --migrate         migrate slots during the cluster scenario\n",
+                name);
+}
+
+Options parse_options(int argc, char **argv) {
+    Options opts;
+    for (int idx = 1; idx < argc; ++idx) {
+        std::string arg = argv[idx];
+        auto value = [&arg](const char *prefix) -> const char* {
+            auto len = std::strlen(prefix);
+            return arg.compare(0, len, prefix) == 0 ? arg.c_str() + len : nullptr;
+        };
+
+        const char *val = nullptr;
+        if ((val = value("--threads=")) != nullptr) {
+            opts.threads = std::max(std::strtoul(val, nullptr, 10), 1UL);
+        } else if ((val = value("--duration=")) != nullptr) {
+            opts.duration = std::chrono::milliseconds(std::strtoul(val, nullptr, 10));
+        } else if ((val = value("--latency=")) != nullptr) {
+            opts.latency = std::chrono::microseconds(std::strtoul(val, nullptr, 10));
+        } else if (arg == "--unix") {
+            opts.unix_socket = true;
+        } else if ((val = value("--batch=")) != nullptr) {
+            opts.batch = std::max(std::strtoul(val, nullptr, 10), 1UL);
+        } else if ((val = value("--keys=")) != nullptr) {
+            opts.keys = std::max(std::strtoul(val, nullptr, 10), 1UL);
+        } else if ((val = value("--value-size=")) != nullptr) {
+            opts.value_size = std::strtoul(val, nullptr, 10);
+        } else if ((val = value("--command=")) != nullptr) {
+            opts.command = val;
+        } else if ((val = value("--nodes=")) != nullptr) {
+            opts.nodes = std::max(std::strtoul(val, nullptr, 10), 1UL);
+        } else if (arg == "--migrate") {
+            opts.migrate = true;
+        } else if (arg == "redis" || arg == "pipeline"
+                || arg == "cluster" || arg == "subscriber") {
+            opts.scenarios.push_back(arg);
+        } else {
+            usage(argv[0]);
+            std::exit(arg == "--help" ? 0 : 1);
+        }
+    }
+
+    if (opts.command != "get" && opts.command != "set"
+            && opts.command != "hgetall" && opts.command != "zrange") {
+        usage(argv[0]);
+        std::exit(1);
+    }
+
+    if (opts.scenarios.empty()) {
+        opts.scenarios = {"redis", "pipeline", "cluster", "subscriber"};
+    }
+
+    return opts;
+}
+
+// Call *op* in a loop with each thread until the time is up. *op* returns the
+// number of commands that it sends.
+Result drive(const Options &opts,
+                const std::function<std::size_t (std::size_t, std::mt19937 &)> &op) {
+    std::atomic<bool> stop{false};
+    std::atomic<std::uint64_t> ops{0};
+    std::atomic<std::uint64_t> errors{0};
+
+    std::vector<std::unique_ptr<Histogram>> latencies;
+    for (std::size_t idx = 0; idx != opts.threads; ++idx) {
+        latencies.emplace_back(new Histogram);
+    }
+
+    auto begin = Clock::now();
+
+    std::vector<std::thread> threads;
+    for (std::size_t idx = 0; idx != opts.threads; ++idx) {
+        threads.emplace_back([&, idx]() {
+                std::mt19937 rng(static_cast<std::mt19937::result_type>(idx + 1));
+                std::uint64_t done = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    auto start = now_ns();
+                    try {
+                        done += op(idx, rng);
+                    } catch (const Error &) {
+                        ++errors;
+                        continue;
+                    }
+                    latencies[idx]->record(now_ns() - start);
+                }
+                ops += done;
+            });
+    }
+
+    std::this_thread::sleep_for(opts.duration);
+    stop = true;
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    Result result;
+    result.ops = ops;
+    result.errors = errors;
+    result.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+    for (const auto &latency : latencies) {
+        result.latency.merge(*latency);
+    }
+
+    return result;
+}
+
+void report(const std::string &scenario, const Options &opts, const Result &result) {
+    auto us = [&result](double p) { return result.latency.percentile(p) / 1000.0; };
+
+    std::printf("%-12s %8zu %12.0f %10.1f %10.1f %10.1f %8llu\n",
+                scenario.c_str(),
+                opts.threads,
+                result.seconds > 0 ? result.ops / result.seconds : 0.0,
+                us(50),
+                us(99),
+                us(99.9),
+                static_cast<unsigned long long>(result.errors));
+}
+
+std::string key_name(const Options &opts, std::mt19937 &rng) {
+    const char *prefix = "key:";
+    if (opts.command == "hgetall") {
+        prefix = "hash:";
+    } else if (opts.command == "zrange") {
+        prefix = "zset:";
+    }
+
+    return prefix + std::to_string(rng() % opts.keys);
+}
+
+// Send *opts.command* with Redis or RedisCluster.
+template <typename Client>
+void call(Client &client, const Options &opts, const std::string &value, std::mt19937 &rng) {
+    auto key = key_name(opts, rng);
+    if (opts.command == "get") {
+        client.get(key);
+    } else if (opts.command == "set") {
+        client.set(key, value);
+    } else if (opts.command == "hgetall") {
+        std::vector<std::pair<std::string, std::string>> fields;
+        client.hgetall(key, std::back_inserter(fields));
+    } else {
+        std::vector<std::string> members;
+        client.zrange(key, 0, -1, std::back_inserter(members));
+    }
+}
+
+// Queue *opts.command* with Pipeline or ClusterPipeline.
+template <typename Pipe>
+void queue(Pipe &pipe, const Options &opts, const std::string &value, std::mt19937 &rng) {
+    auto key = key_name(opts, rng);
+    if (opts.command == "get") {
+        pipe.command("GET", key);
+    } else if (opts.command == "set") {
+        pipe.command("SET", key, value);
+    } else if (opts.command == "hgetall") {
+        pipe.command("HGETALL", key);
+    } else {
+        pipe.command("ZRANGE", key, 0, -1);
+    }
+}
+
+// Create all keys that the scenarios read, with pipelines of about 1000 commands.
+template <typename Pipe>
+void load(Pipe &pipe, const Options &opts, const std::string &value) {
+    std::size_t queued = 0;
+    for (std::size_t idx = 0; idx != opts.keys; ++idx) {
+        auto suffix = std::to_string(idx);
+        pipe.command("SET", "key:" + suffix, value);
+        for (std::size_t field = 0; field != FIELDS; ++field) {
+            pipe.command("HSET", "hash:" + suffix, "field:" + std::to_string(field), value);
+            pipe.command("ZADD", "zset:" + suffix, field, "member:" + std::to_string(field));
+        }
+
+        queued += 1 + FIELDS * 2;
+        if (queued >= 1000 || idx + 1 == opts.keys) {
+            pipe.exec();
+            queued = 0;
+        }
+    }
+}
+
+MockServerOptions server_options(const Options &opts) {
+    MockServerOptions server_opts;
+    server_opts.latency = opts.latency;
+    if (opts.unix_socket) {
+        server_opts.path = "/tmp/redis-plus-plus-load-bench-"
+                            + std::to_string(::getpid()) + ".sock";
+    }
+
+    return server_opts;
+}
+
+ConnectionPoolOptions pool_options(const Options &opts) {
+    ConnectionPoolOptions pool_opts;
+    pool_opts.size = opts.threads;
+
+    return pool_opts;
+}
+
+Result run_redis(const Options &opts, const std::string &value) {
+    MockServer server(server_options(opts));
+    Redis redis(server.connection_options(), pool_options(opts));
+
+    auto pipe = redis.pipeline();
+    load(pipe, opts, value);
+
+    return drive(opts, [&](std::size_t, std::mt19937 &rng) {
+                            call(redis, opts, value, rng);
+                            return 1;
+                        });
+}
+
+Result run_pipeline(const Options &opts, const std::string &value) {
+    MockServer server(server_options(opts));
+    Redis redis(server.connection_options(), pool_options(opts));
+
+    {
+        auto pipe = redis.pipeline();
+        load(pipe, opts, value);
+    }
+
+    // Each thread has a pipeline with a connection of its own.
+    std::vector<std::unique_ptr<Pipeline>> pipes;
+    for (std::size_t idx = 0; idx != opts.threads; ++idx) {
+        pipes.emplace_back(new Pipeline(redis.pipeline()));
+    }
+
+    return drive(opts, [&](std::size_t thread, std::mt19937 &rng) {
+                            auto &pipe = *pipes[thread];
+                            for (std::size_t idx = 0; idx != opts.batch; ++idx) {
+                                queue(pipe, opts, value, rng);
+                            }
+                            pipe.exec();
+                            return opts.batch;
+                        });
+}
+
+Result run_cluster(const Options &opts, const std::string &value) {
+    auto server_opts = server_options(opts);
+    server_opts.path.clear();
+
+    MockCluster cluster(opts.nodes, server_opts);
+    RedisCluster redis(cluster.connection_options(), pool_options(opts));
+
+    {
+        auto pipe = redis.cluster_pipeline();
+        load(pipe, opts, value);
+    }
+
+    std::atomic<bool> stop{false};
+    std::thread migrator;
+    if (opts.migrate && opts.nodes > 1) {
+        migrator = std::thread([&]() {
+                std::mt19937 rng(0);
+                while (!stop) {
+                    auto slot = rng() % 16384;
+                    cluster.migrate(slot, (cluster.owner(slot) + 1) % cluster.size());
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    cluster.finish_migration(slot);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                }
+            });
+    }
+
+    auto result = drive(opts, [&](std::size_t, std::mt19937 &rng) {
+                                    call(redis, opts, value, rng);
+                                    return 1;
+                                });
+
+    stop = true;
+    if (migrator.joinable()) {
+        migrator.join();
+    }
+
+    return result;
+}
+
+Result run_subscriber(const Options &opts) {
+    MockServer server(server_options(opts));
+    Redis redis(server.connection_options(), pool_options(opts));
+
+    const std::string channel = "load-bench";
+    const std::string last_message = "stop";
+
+    Histogram latency;
+    std::atomic<std::uint64_t> received{0};
+    std::atomic<bool> done{false};
+
+    auto subscriber = redis.subscriber();
+    subscriber.on_message([&](std::string, std::string msg) {
+                                if (msg == last_message) {
+                                    done = true;
+                                } else {
+                                    latency.record(now_ns() - std::strtoull(msg.c_str(), nullptr, 10));
+                                    ++received;
+                                }
+                            });
+    subscriber.subscribe(channel);
+
+    // Wait for the SUBSCRIBE reply, so that no message is lost.
+    subscriber.consume();
+
+    std::thread consumer([&]() {
+            while (!done) {
+                try {
+                    subscriber.consume();
+                } catch (const Error &err) {
+                    std::fprintf(stderr, "subscriber: %s\n", err.what());
+                    break;
+                }
+            }
+        });
+
+    auto result = drive(opts, [&](std::size_t, std::mt19937 &) {
+                                    redis.publish(channel, std::to_string(now_ns()));
+                                    return 1;
+                                });
+
+    // Messages are delivered in order, so all of them have been received
+    // once the consumer gets the last one.
+    redis.publish(channel, last_message);
+    consumer.join();
+
+    result.ops = received;
+    result.latency = HistogramSnapshot();
+    result.latency.merge(latency);
+
+    return result;
+}
+
+}
+
+int main(int argc, char **argv) {
+    auto opts = parse_options(argc, argv);
+    std::string value(opts.value_size, 'v');
+
+    std::printf("command=%s latency=%lldus batch=%zu keys=%zu value_size=%zu%s\n",
+                opts.command.c_str(),
+                static_cast<long long>(opts.latency.count()),
+                opts.batch,
+                opts.keys,
+                opts.value_size,
+                opts.unix_socket ? " unix" : "");
+    std::printf("%-12s %8s %12s %10s %10s %10s %8s\n",
+                "scenario", "threads", "ops/sec", "p50(us)", "p99(us)", "p999(us)", "errors");
+
+    for (const auto &scenario : opts.scenarios) {
+        try {
+            Result result;
+            if (scenario == "redis") {
+                result = run_redis(opts, value);
+            } else if (scenario == "pipeline") {
+                result = run_pipeline(opts, value);
+            } else if (scenario == "cluster") {
+                result = run_cluster(opts, value);
+            } else {
+                result = run_subscriber(opts);
+            }
+
+            report(scenario, opts, result);
+        } catch (const Error &err) {
+            std::fprintf(stderr, "%s failed: %s\n", scenario.c_str(), err.what());
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,19 @@
+# End-to-end benchmarks against an in-process mock server, see load_bench.cpp.
+# The mock server uses epoll, so it only builds on Linux.
+
+TEMPLATE = app
+TARGET = load_bench
+
+CONFIG += console c++11 release
+CONFIG -= app_bundle qt
+
+include(../qredis/qredis.pri)
+
+LIBS += -lpthread
+
+HEADERS += \
+        mock_server.h
+
+SOURCES += \
+        load_bench.cpp \
+        mock_server.cpp
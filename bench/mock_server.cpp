@@ -0,0 +1,1086 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "mock_server.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include "errors.h"
+#include "utils.h"
+
+namespace {
+
+const std::size_t SLOTS = 16384;
+
+const std::size_t NO_NODE = static_cast<std::size_t>(-1);
+
+// Ids of epoll events, ids of clients start after them.
+const std::uint64_t LISTEN_ID = 0;
+const std::uint64_t EVENT_ID = 1;
+const std::uint64_t TIMER_ID = 2;
+
+const std::size_t READ_SIZE = 16 * 1024;
+
+void close_fd(int &fd) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void set_nonblocking(int fd) {
+    auto flags = ::fcntl(fd, F_GETFL, 0);
+    ::fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+std::string to_upper(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(),
+                    [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    return str;
+}
+
+std::string simple(const std::string &str) {
+    return "+" + str + "\r\n";
+}
+
+std::string error(const std::string &str) {
+    return "-" + str + "\r\n";
+}
+
+std::string integer(long long num) {
+    return ":" + std::to_string(num) + "\r\n";
+}
+
+std::string bulk(const std::string &str) {
+    return "$" + std::to_string(str.size()) + "\r\n" + str + "\r\n";
+}
+
+std::string null() {
+    return "$-1\r\n";
+}
+
+std::string array(std::size_t size) {
+    return "*" + std::to_string(size) + "\r\n";
+}
+
+std::string arity_error(const std::string &cmd) {
+    auto name = cmd;
+    std::transform(name.begin(), name.end(), name.begin(),
+                    [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return error("ERR wrong number of arguments for '" + name + "' command");
+}
+
+std::string format_double(double num) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.17g", num);
+    return buf;
+}
+
+// Same as the slot that ShardsPool computes, i.e. respect hash tags.
+std::size_t key_slot(const std::string &key) {
+    auto start = key.find('{');
+    if (start != std::string::npos) {
+        auto end = key.find('}', start + 1);
+        if (end != std::string::npos && end != start + 1) {
+            return crc16(key.data() + start + 1, static_cast<int>(end - start - 1)) % SLOTS;
+        }
+    }
+
+    return crc16(key.data(), static_cast<int>(key.size())) % SLOTS;
+}
+
+// Parse a multi bulk request at *pos*. Return 1 and move *pos* forward if it's
+// complete, 0 if more data is needed, and -1 if it's invalid.
+int parse_request(const std::string &buf, std::size_t &pos, std::vector<std::string> &args) {
+    auto parse_len = [&buf](std::size_t &cur, char type, long long &len) {
+        if (cur >= buf.size()) {
+            return 0;
+        }
+
+        if (buf[cur] != type) {
+            return -1;
+        }
+
+        auto end = buf.find("\r\n", cur);
+        if (end == std::string::npos) {
+            return 0;
+        }
+
+        char *stop = nullptr;
+        len = std::strtoll(buf.data() + cur + 1, &stop, 10);
+        if (stop != buf.data() + end || len < 0) {
+            return -1;
+        }
+
+        cur = end + 2;
+
+        return 1;
+    };
+
+    auto cur = pos;
+    long long num = 0;
+    auto res = parse_len(cur, '*', num);
+    if (res != 1) {
+        return res;
+    }
+
+    args.clear();
+    for (long long idx = 0; idx != num; ++idx) {
+        long long len = 0;
+        res = parse_len(cur, '$', len);
+        if (res != 1) {
+            return res;
+        }
+
+        if (buf.size() - cur < static_cast<std::size_t>(len) + 2) {
+            return 0;
+        }
+
+        args.emplace_back(buf, cur, static_cast<std::size_t>(len));
+        cur += len + 2;
+    }
+
+    pos = cur;
+
+    return 1;
+}
+
+}
+
+// Keyspace and slot map, shared by all nodes of a cluster.
+struct MockServer::State {
+    struct SortedSet {
+        std::unordered_map<std::string, double> scores;
+
+        std::set<std::pair<double, std::string>> ranks;
+    };
+
+    std::mutex mutex;
+
+    std::unordered_map<std::string, std::string> strings;
+
+    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> hashes;
+
+    std::unordered_map<std::string, SortedSet> zsets;
+
+    bool cluster = false;
+
+    // host:port of each node.
+    std::vector<std::pair<std::string, int>> nodes;
+
+    // Slot -> node that owns it.
+    std::vector<std::size_t> owners;
+
+    // Slot -> node that it's being migrated to, or NO_NODE.
+    std::vector<std::size_t> importing;
+
+    bool exists(const std::string &key) const {
+        return strings.count(key) != 0 || hashes.count(key) != 0 || zsets.count(key) != 0;
+    }
+
+    std::size_t erase(const std::string &key) {
+        return strings.erase(key) + hashes.erase(key) + zsets.erase(key);
+    }
+};
+
+struct MockServer::Client {
+    std::uint64_t id = 0;
+
+    int fd = -1;
+
+    std::string in;
+
+    std::string out;
+
+    // Whether we're waiting for the socket to be writable.
+    bool writing = false;
+
+    // Whether the last command is ASKING.
+    bool asking = false;
+
+    std::unordered_set<std::string> channels;
+};
+
+MockServer::MockServer(const MockServerOptions &opts) :
+                        MockServer(opts, std::make_shared<State>(), 0) {}
+
+MockServer::MockServer(const MockServerOptions &opts,
+                        std::shared_ptr<State> state,
+                        std::size_t node) :
+                        _opts(opts),
+                        _state(std::move(state)),
+                        _node(node),
+                        _client_id(TIMER_ID) {
+    try {
+        _listen();
+    } catch (const Error &) {
+        close_fd(_listen_fd);
+        close_fd(_epoll_fd);
+        close_fd(_event_fd);
+        close_fd(_timer_fd);
+        throw;
+    }
+
+    _thread = std::thread([this]() { _run(); });
+}
+
+MockServer::~MockServer() {
+    std::uint64_t one = 1;
+    while (::write(_event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    for (auto &client : _clients) {
+        ::close(client.second->fd);
+    }
+
+    close_fd(_listen_fd);
+    close_fd(_epoll_fd);
+    close_fd(_event_fd);
+    close_fd(_timer_fd);
+
+    if (!_opts.path.empty()) {
+        ::unlink(_opts.path.c_str());
+    }
+}
+
+ConnectionOptions MockServer::connection_options() const {
+    ConnectionOptions opts;
+    if (!_opts.path.empty()) {
+        opts.type = ConnectionType::UNIX;
+        opts.path = _opts.path;
+    } else {
+        opts.host = (_opts.host.empty() || _opts.host == "0.0.0.0") ? "127.0.0.1" : _opts.host;
+        opts.port = _port;
+    }
+
+    return opts;
+}
+
+void MockServer::_listen() {
+    std::string errmsg;
+    if (!_opts.path.empty()) {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        if (_opts.path.size() >= sizeof(addr.sun_path)) {
+            throw Error("Unix socket path is too long: " + _opts.path);
+        }
+
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, _opts.path.c_str());
+
+        ::unlink(_opts.path.c_str());
+
+        _listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listen_fd < 0
+                || ::bind(_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+                || ::listen(_listen_fd, 128) != 0) {
+            throw Error("Failed to listen on " + _opts.path + ": " + std::strerror(errno));
+        }
+    } else {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+
+        addrinfo *res = nullptr;
+        auto port = std::to_string(_opts.port);
+        auto err = ::getaddrinfo(_opts.host.empty() ? nullptr : _opts.host.c_str(),
+                                    port.c_str(),
+                                    &hints,
+                                    &res);
+        if (err != 0) {
+            throw Error("Failed to resolve " + _opts.host + ": " + ::gai_strerror(err));
+        }
+
+        errmsg = "no address";
+        for (auto *addr = res; addr != nullptr; addr = addr->ai_next) {
+            _listen_fd = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+            if (_listen_fd < 0) {
+                errmsg = std::strerror(errno);
+                continue;
+            }
+
+            int on = 1;
+            ::setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+            if (::bind(_listen_fd, addr->ai_addr, addr->ai_addrlen) == 0
+                    && ::listen(_listen_fd, 128) == 0) {
+                break;
+            }
+
+            errmsg = std::strerror(errno);
+            close_fd(_listen_fd);
+        }
+
+        ::freeaddrinfo(res);
+
+        if (_listen_fd < 0) {
+            throw Error("Failed to listen on " + _opts.host + ":" + port + ": " + errmsg);
+        }
+
+        sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        if (::getsockname(_listen_fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0) {
+            if (addr.ss_family == AF_INET) {
+                _port = ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+            } else if (addr.ss_family == AF_INET6) {
+                _port = ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+            }
+        }
+    }
+
+    set_nonblocking(_listen_fd);
+
+    _epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+    _event_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_epoll_fd < 0 || _event_fd < 0 || _timer_fd < 0) {
+        throw Error(std::string("Failed to create epoll: ") + std::strerror(errno));
+    }
+
+    std::pair<int, std::uint64_t> fds[] = {
+        {_listen_fd, LISTEN_ID},
+        {_event_fd, EVENT_ID},
+        {_timer_fd, TIMER_ID}
+    };
+    for (const auto &fd : fds) {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = fd.second;
+        if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd.first, &event) != 0) {
+            throw Error(std::string("Failed to add fd to epoll: ") + std::strerror(errno));
+        }
+    }
+}
+
+void MockServer::_run() {
+    epoll_event events[64];
+    while (true) {
+        auto num = ::epoll_wait(_epoll_fd, events, 64, -1);
+        if (num < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        for (int idx = 0; idx != num; ++idx) {
+            auto id = events[idx].data.u64;
+            if (id == EVENT_ID) {
+                // Stopped.
+                return;
+            }
+
+            if (id == LISTEN_ID) {
+                _accept();
+                continue;
+            }
+
+            if (id == TIMER_ID) {
+                std::uint64_t expirations = 0;
+                while (::read(_timer_fd, &expirations, sizeof(expirations)) < 0
+                        && errno == EINTR) {}
+                continue;
+            }
+
+            auto iter = _clients.find(id);
+            if (iter == _clients.end()) {
+                // Closed while handling other events.
+                continue;
+            }
+
+            auto &client = *(iter->second);
+            auto flags = events[idx].events;
+            if ((flags & EPOLLOUT) && !_write(client)) {
+                continue;
+            }
+
+            if (flags & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                _read(client);
+            }
+        }
+
+        _flush_delayed();
+        _flush_dirty();
+        _arm_timer();
+    }
+}
+
+void MockServer::_accept() {
+    while (true) {
+        auto fd = ::accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            // EAGAIN, or the client has gone.
+            return;
+        }
+
+        if (_opts.path.empty()) {
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+
+        std::unique_ptr<Client> client(new Client);
+        client->id = ++_client_id;
+        client->fd = fd;
+
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = client->id;
+        if (::epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            ::close(fd);
+            continue;
+        }
+
+        _clients.emplace(client->id, std::move(client));
+    }
+}
+
+bool MockServer::_read(Client &client) {
+    char buf[READ_SIZE];
+    while (true) {
+        auto len = ::read(client.fd, buf, sizeof(buf));
+        if (len > 0) {
+            client.in.append(buf, len);
+            continue;
+        }
+
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        // Closed by peer, or failed.
+        _close(client.id);
+        return false;
+    }
+
+    std::size_t pos = 0;
+    std::vector<std::string> args;
+    while (true) {
+        auto res = parse_request(client.in, pos, args);
+        if (res == 0) {
+            break;
+        }
+
+        if (res < 0) {
+            _close(client.id);
+            return false;
+        }
+
+        auto reply = _execute(client, args);
+        if (!reply.empty()) {
+            _send(client, std::move(reply));
+        }
+    }
+
+    client.in.erase(0, pos);
+
+    return true;
+}
+
+bool MockServer::_write(Client &client) {
+    std::size_t pos = 0;
+    while (pos < client.out.size()) {
+        auto len = ::write(client.fd, client.out.data() + pos, client.out.size() - pos);
+        if (len >= 0) {
+            pos += len;
+            continue;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            _close(client.id);
+            return false;
+        }
+
+        break;
+    }
+
+    client.out.erase(0, pos);
+
+    auto writing = !client.out.empty();
+    if (writing != client.writing) {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = writing ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        event.data.u64 = client.id;
+        ::epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, client.fd, &event);
+        client.writing = writing;
+    }
+
+    return true;
+}
+
+void MockServer::_close(std::uint64_t id) {
+    auto iter = _clients.find(id);
+    if (iter == _clients.end()) {
+        return;
+    }
+
+    auto &client = *(iter->second);
+    for (const auto &channel : client.channels) {
+        auto subscribers = _channels.find(channel);
+        if (subscribers != _channels.end()) {
+            subscribers->second.erase(id);
+            if (subscribers->second.empty()) {
+                _channels.erase(subscribers);
+            }
+        }
+    }
+
+    ::epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, client.fd, nullptr);
+    ::close(client.fd);
+
+    _clients.erase(iter);
+}
+
+void MockServer::_send(Client &client, std::string data) {
+    if (_opts.latency.count() > 0) {
+        _delayed.push_back(Delayed{std::chrono::steady_clock::now() + _opts.latency,
+                                    client.id,
+                                    std::move(data)});
+        return;
+    }
+
+    if (client.out.empty()) {
+        _dirty.push_back(client.id);
+    }
+
+    client.out += data;
+}
+
+void MockServer::_flush_dirty() {
+    for (auto id : _dirty) {
+        auto iter = _clients.find(id);
+        if (iter != _clients.end() && !iter->second->writing) {
+            _write(*(iter->second));
+        }
+    }
+
+    _dirty.clear();
+}
+
+void MockServer::_flush_delayed() {
+    auto now = std::chrono::steady_clock::now();
+    while (!_delayed.empty() && _delayed.front().due <= now) {
+        auto &delayed = _delayed.front();
+        auto iter = _clients.find(delayed.client);
+        if (iter != _clients.end()) {
+            auto &client = *(iter->second);
+            if (client.out.empty()) {
+                _dirty.push_back(client.id);
+            }
+
+            client.out += delayed.data;
+        }
+
+        _delayed.pop_front();
+    }
+}
+
+void MockServer::_arm_timer() {
+    if (_delayed.empty()) {
+        return;
+    }
+
+    // steady_clock is CLOCK_MONOTONIC on Linux.
+    auto due = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    _delayed.front().due.time_since_epoch()).count();
+
+    itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = due / 1000000000;
+    spec.it_value.tv_nsec = due % 1000000000;
+    ::timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+std::string MockServer::_execute(Client &client, const std::vector<std::string> &args) {
+    if (args.empty()) {
+        return error("ERR empty command");
+    }
+
+    auto cmd = to_upper(args[0]);
+
+    auto asking = client.asking;
+    client.asking = false;
+
+    if (cmd == "PING") {
+        if (args.size() > 2) {
+            return arity_error(cmd);
+        }
+
+        if (!client.channels.empty()) {
+            return array(2) + bulk("pong") + bulk(args.size() == 2 ? args[1] : "");
+        }
+
+        return args.size() == 2 ? bulk(args[1]) : simple("PONG");
+    } else if (cmd == "ECHO") {
+        return args.size() == 2 ? bulk(args[1]) : arity_error(cmd);
+    } else if (cmd == "AUTH" || cmd == "SELECT" || cmd == "CLIENT"
+            || cmd == "READONLY" || cmd == "READWRITE") {
+        return simple("OK");
+    } else if (cmd == "ASKING") {
+        client.asking = true;
+        return simple("OK");
+    } else if (cmd == "FLUSHALL" || cmd == "FLUSHDB") {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        _state->strings.clear();
+        _state->hashes.clear();
+        _state->zsets.clear();
+        return simple("OK");
+    } else if (cmd == "CLUSTER") {
+        if (args.size() != 2 || to_upper(args[1]) != "SLOTS") {
+            return error("ERR unknown subcommand, only CLUSTER SLOTS is supported");
+        }
+
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        if (!_state->cluster) {
+            return error("ERR This instance has cluster support disabled");
+        }
+
+        std::string ranges;
+        std::size_t num = 0;
+        for (std::size_t start = 0; start < SLOTS; ++num) {
+            auto owner = _state->owners[start];
+            auto end = start;
+            while (end + 1 < SLOTS && _state->owners[end + 1] == owner) {
+                ++end;
+            }
+
+            const auto &node = _state->nodes[owner];
+            ranges += array(3) + integer(start) + integer(end)
+                        + array(3) + bulk(node.first) + integer(node.second)
+                        + bulk("mock-node-" + std::to_string(owner));
+
+            start = end + 1;
+        }
+
+        return array(num) + ranges;
+    } else if (cmd == "SUBSCRIBE") {
+        return _subscribe(client, args);
+    } else if (cmd == "UNSUBSCRIBE") {
+        return _unsubscribe(client, args);
+    } else if (cmd == "PUBLISH") {
+        return _publish(args);
+    }
+
+    return _execute_keyed(cmd, args, asking);
+}
+
+std::string MockServer::_execute_keyed(const std::string &cmd,
+                                        const std::vector<std::string> &args,
+                                        bool asking) {
+    // Check arity before redirecting, as Redis does.
+    auto argc = args.size();
+    if (cmd == "GET" || cmd == "HGETALL") {
+        if (argc != 2) {
+            return arity_error(cmd);
+        }
+    } else if (cmd == "DEL" || cmd == "MGET") {
+        if (argc < 2) {
+            return arity_error(cmd);
+        }
+    } else if (cmd == "SET") {
+        if (argc < 3) {
+            return arity_error(cmd);
+        }
+    } else if (cmd == "HGET") {
+        if (argc != 3) {
+            return arity_error(cmd);
+        }
+    } else if (cmd == "MSET") {
+        if (argc < 3 || argc % 2 != 1) {
+            return arity_error(cmd);
+        }
+    } else if (cmd == "HSET" || cmd == "ZADD") {
+        if (argc < 4 || argc % 2 != 0) {
+            return arity_error(cmd);
+        }
+    } else if (cmd == "ZRANGE") {
+        if (argc != 4 && argc != 5) {
+            return arity_error(cmd);
+        }
+    } else {
+        return error("ERR unknown command '" + args[0] + "'");
+    }
+
+    std::lock_guard<std::mutex> lock(_state->mutex);
+
+    if (_state->cluster) {
+        auto redirection = _redirect(cmd, args, asking);
+        if (!redirection.empty()) {
+            return redirection;
+        }
+    }
+
+    auto &state = *_state;
+    const auto &key = args[1];
+    const auto wrong_type = error("WRONGTYPE Operation against a key holding the wrong kind of value");
+
+    if (cmd == "GET") {
+        auto iter = state.strings.find(key);
+        if (iter != state.strings.end()) {
+            return bulk(iter->second);
+        }
+
+        return state.exists(key) ? wrong_type : null();
+    } else if (cmd == "SET") {
+        state.erase(key);
+        state.strings[key] = args[2];
+        return simple("OK");
+    } else if (cmd == "DEL") {
+        long long num = 0;
+        for (std::size_t idx = 1; idx != argc; ++idx) {
+            num += state.erase(args[idx]);
+        }
+
+        return integer(num);
+    } else if (cmd == "MGET") {
+        auto reply = array(argc - 1);
+        for (std::size_t idx = 1; idx != argc; ++idx) {
+            auto iter = state.strings.find(args[idx]);
+            reply += (iter == state.strings.end() ? null() : bulk(iter->second));
+        }
+
+        return reply;
+    } else if (cmd == "MSET") {
+        for (std::size_t idx = 1; idx != argc; idx += 2) {
+            state.erase(args[idx]);
+            state.strings[args[idx]] = args[idx + 1];
+        }
+
+        return simple("OK");
+    } else if (cmd == "HSET") {
+        if (state.strings.count(key) != 0 || state.zsets.count(key) != 0) {
+            return wrong_type;
+        }
+
+        auto &hash = state.hashes[key];
+        long long num = 0;
+        for (std::size_t idx = 2; idx != argc; idx += 2) {
+            auto res = hash.emplace(args[idx], args[idx + 1]);
+            if (res.second) {
+                ++num;
+            } else {
+                res.first->second = args[idx + 1];
+            }
+        }
+
+        return integer(num);
+    } else if (cmd == "HGET" || cmd == "HGETALL") {
+        auto iter = state.hashes.find(key);
+        if (iter == state.hashes.end()) {
+            if (state.exists(key)) {
+                return wrong_type;
+            }
+
+            return cmd == "HGET" ? null() : array(0);
+        }
+
+        const auto &hash = iter->second;
+        if (cmd == "HGET") {
+            auto field = hash.find(args[2]);
+            return field == hash.end() ? null() : bulk(field->second);
+        }
+
+        auto reply = array(hash.size() * 2);
+        for (const auto &field : hash) {
+            reply += bulk(field.first) + bulk(field.second);
+        }
+
+        return reply;
+    } else if (cmd == "ZADD") {
+        if (state.strings.count(key) != 0 || state.hashes.count(key) != 0) {
+            return wrong_type;
+        }
+
+        std::vector<double> scores;
+        for (std::size_t idx = 2; idx != argc; idx += 2) {
+            char *end = nullptr;
+            auto score = std::strtod(args[idx].c_str(), &end);
+            if (args[idx].empty() || end != args[idx].c_str() + args[idx].size()) {
+                return error("ERR value is not a valid float");
+            }
+
+            scores.push_back(score);
+        }
+
+        auto &zset = state.zsets[key];
+        long long num = 0;
+        for (std::size_t idx = 3; idx < argc; idx += 2) {
+            const auto &member = args[idx];
+            auto score = scores[(idx - 3) / 2];
+            auto iter = zset.scores.find(member);
+            if (iter == zset.scores.end()) {
+                zset.scores.emplace(member, score);
+                ++num;
+            } else {
+                zset.ranks.erase(std::make_pair(iter->second, member));
+                iter->second = score;
+            }
+
+            zset.ranks.emplace(score, member);
+        }
+
+        return integer(num);
+    } else {
+        // ZRANGE
+        auto with_scores = false;
+        if (argc == 5) {
+            if (to_upper(args[4]) != "WITHSCORES") {
+                return error("ERR syntax error");
+            }
+
+            with_scores = true;
+        }
+
+        char *end = nullptr;
+        auto start = std::strtoll(args[2].c_str(), &end, 10);
+        auto stop = std::strtoll(args[3].c_str(), &end, 10);
+
+        auto iter = state.zsets.find(key);
+        if (iter == state.zsets.end()) {
+            return state.exists(key) ? wrong_type : array(0);
+        }
+
+        const auto &ranks = iter->second.ranks;
+        auto size = static_cast<long long>(ranks.size());
+        if (start < 0) {
+            start = std::max(start + size, 0LL);
+        }
+        if (stop < 0) {
+            stop += size;
+        }
+        stop = std::min(stop, size - 1);
+
+        if (start > stop) {
+            return array(0);
+        }
+
+        auto num = static_cast<std::size_t>(stop - start + 1);
+        auto reply = array(with_scores ? num * 2 : num);
+        auto rank = ranks.begin();
+        std::advance(rank, start);
+        for (std::size_t idx = 0; idx != num; ++idx, ++rank) {
+            reply += bulk(rank->second);
+            if (with_scores) {
+                reply += bulk(format_double(rank->first));
+            }
+        }
+
+        return reply;
+    }
+}
+
+std::string MockServer::_redirect(const std::string &cmd,
+                                    const std::vector<std::string> &args,
+                                    bool asking) const {
+    std::size_t step = 0;
+    std::size_t last = 2;
+    if (cmd == "DEL" || cmd == "MGET") {
+        step = 1;
+        last = args.size();
+    } else if (cmd == "MSET") {
+        step = 2;
+        last = args.size();
+    }
+
+    auto slot = key_slot(args[1]);
+    for (std::size_t idx = 1 + step; step != 0 && idx < last; idx += step) {
+        if (key_slot(args[idx]) != slot) {
+            return error("CROSSSLOT Keys in request don't hash to the same slot");
+        }
+    }
+
+    auto owner = _state->owners[slot];
+    auto target = _state->importing[slot];
+    if (owner == _node) {
+        if (target == NO_NODE) {
+            return "";
+        }
+
+        // Keys are shared by all nodes, so we cannot tell if a key has been
+        // migrated. Always ask the client to try the target.
+        const auto &node = _state->nodes[target];
+        return error("ASK " + std::to_string(slot) + " "
+                        + node.first + ":" + std::to_string(node.second));
+    }
+
+    if (target == _node && asking) {
+        return "";
+    }
+
+    const auto &node = _state->nodes[owner];
+    return error("MOVED " + std::to_string(slot) + " "
+                    + node.first + ":" + std::to_string(node.second));
+}
+
+std::string MockServer::_subscribe(Client &client, const std::vector<std::string> &args) {
+    if (args.size() < 2) {
+        return arity_error("SUBSCRIBE");
+    }
+
+    std::string reply;
+    for (std::size_t idx = 1; idx != args.size(); ++idx) {
+        client.channels.insert(args[idx]);
+        _channels[args[idx]].insert(client.id);
+
+        reply += array(3) + bulk("subscribe") + bulk(args[idx]) + integer(client.channels.size());
+    }
+
+    return reply;
+}
+
+std::string MockServer::_unsubscribe(Client &client, const std::vector<std::string> &args) {
+    std::vector<std::string> channels(args.begin() + 1, args.end());
+    if (channels.empty()) {
+        channels.assign(client.channels.begin(), client.channels.end());
+        if (channels.empty()) {
+            return array(3) + bulk("unsubscribe") + null() + integer(0);
+        }
+    }
+
+    std::string reply;
+    for (const auto &channel : channels) {
+        client.channels.erase(channel);
+
+        auto iter = _channels.find(channel);
+        if (iter != _channels.end()) {
+            iter->second.erase(client.id);
+            if (iter->second.empty()) {
+                _channels.erase(iter);
+            }
+        }
+
+        reply += array(3) + bulk("unsubscribe") + bulk(channel) + integer(client.channels.size());
+    }
+
+    return reply;
+}
+
+std::string MockServer::_publish(const std::vector<std::string> &args) {
+    if (args.size() != 3) {
+        return arity_error("PUBLISH");
+    }
+
+    auto iter = _channels.find(args[1]);
+    if (iter == _channels.end()) {
+        return integer(0);
+    }
+
+    auto message = array(3) + bulk("message") + bulk(args[1]) + bulk(args[2]);
+    for (auto id : iter->second) {
+        auto subscriber = _clients.find(id);
+        if (subscriber != _clients.end()) {
+            _send(*(subscriber->second), message);
+        }
+    }
+
+    return integer(iter->second.size());
+}
+
+MockCluster::MockCluster(std::size_t nodes, const MockServerOptions &opts) :
+                            _state(std::make_shared<MockServer::State>()) {
+    if (nodes == 0) {
+        throw Error("MockCluster needs at least one node");
+    }
+
+    if (!opts.path.empty()) {
+        throw Error("MockCluster doesn't support Unix domain sockets");
+    }
+
+    _state->cluster = true;
+    _state->owners.resize(SLOTS);
+    _state->importing.assign(SLOTS, NO_NODE);
+    for (std::size_t slot = 0; slot != SLOTS; ++slot) {
+        _state->owners[slot] = slot * nodes / SLOTS;
+    }
+
+    for (std::size_t idx = 0; idx != nodes; ++idx) {
+        auto node_opts = opts;
+        if (opts.port != 0) {
+            node_opts.port = opts.port + static_cast<int>(idx);
+        }
+
+        _nodes.emplace_back(new MockServer(node_opts, _state, idx));
+    }
+
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    for (const auto &node : _nodes) {
+        auto conn_opts = node->connection_options();
+        _state->nodes.emplace_back(conn_opts.host, conn_opts.port);
+    }
+}
+
+std::size_t MockCluster::owner(std::size_t slot) const {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+
+    return _state->owners.at(slot);
+}
+
+void MockCluster::migrate(std::size_t slot, std::size_t to) {
+    if (slot >= SLOTS || to >= _nodes.size()) {
+        throw Error("Invalid slot or node to migrate");
+    }
+
+    std::lock_guard<std::mutex> lock(_state->mutex);
+
+    if (_state->owners[slot] != to) {
+        _state->importing[slot] = to;
+    }
+}
+
+void MockCluster::finish_migration(std::size_t slot) {
+    if (slot >= SLOTS) {
+        throw Error("Invalid slot to migrate");
+    }
+
+    std::lock_guard<std::mutex> lock(_state->mutex);
+
+    auto &target = _state->importing[slot];
+    if (target != NO_NODE) {
+        _state->owners[slot] = target;
+        target = NO_NODE;
+    }
+}
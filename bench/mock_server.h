@@ -0,0 +1,215 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPLUSPLUS_MOCK_SERVER_H
+#define SEWENEW_REDISPLUSPLUS_MOCK_SERVER_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "connection.h"
+
+// An in-process RESP server for end-to-end benchmarks, so that they don't depend
+// on a real Redis server. It runs an epoll loop with a background thread, and
+// supports a small subset of commands:
+//
+// PING, ECHO, AUTH, SELECT, CLIENT, READONLY, ASKING, FLUSHALL, CLUSTER SLOTS,
+// GET, SET, DEL, MGET, MSET, HSET, HGET, HGETALL, ZADD, ZRANGE [WITHSCORES],
+// PUBLISH, SUBSCRIBE and UNSUBSCRIBE.
+//
+// Like Redis, a server serves all its clients with a single thread. Only Linux
+// is supported.
+
+struct MockServerOptions {
+    std::string host = "127.0.0.1";
+
+    // 0 means a random port, see *MockServer::connection_options*.
+    int port = 0;
+
+    // Listen on a Unix domain socket instead, if it's NOT empty.
+    std::string path;
+
+    // Artificial latency added to each reply and published message.
+    std::chrono::microseconds latency{0};
+};
+
+class MockCluster;
+
+class MockServer {
+public:
+    // Throw Error if it fails to listen on the address.
+    explicit MockServer(const MockServerOptions &opts = {});
+
+    MockServer(const MockServer &) = delete;
+    MockServer& operator=(const MockServer &) = delete;
+
+    MockServer(MockServer &&) = delete;
+    MockServer& operator=(MockServer &&) = delete;
+
+    // Stop the server, and close all connections.
+    ~MockServer();
+
+    // Options to connect to the server.
+    ConnectionOptions connection_options() const;
+
+    int port() const {
+        return _port;
+    }
+
+private:
+    friend class MockCluster;
+
+    struct State;
+
+    struct Client;
+
+    MockServer(const MockServerOptions &opts,
+                std::shared_ptr<State> state,
+                std::size_t node);
+
+    void _listen();
+
+    void _run();
+
+    void _accept();
+
+    // Return false if the client has been closed.
+    bool _read(Client &client);
+
+    bool _write(Client &client);
+
+    void _close(std::uint64_t id);
+
+    void _send(Client &client, std::string data);
+
+    void _flush_dirty();
+
+    void _flush_delayed();
+
+    void _arm_timer();
+
+    std::string _execute(Client &client, const std::vector<std::string> &args);
+
+    std::string _execute_keyed(const std::string &cmd,
+                                const std::vector<std::string> &args,
+                                bool asking);
+
+    std::string _redirect(const std::string &cmd,
+                            const std::vector<std::string> &args,
+                            bool asking) const;
+
+    std::string _subscribe(Client &client, const std::vector<std::string> &args);
+
+    std::string _unsubscribe(Client &client, const std::vector<std::string> &args);
+
+    std::string _publish(const std::vector<std::string> &args);
+
+    MockServerOptions _opts;
+
+    std::shared_ptr<State> _state;
+
+    // Index of the node in a MockCluster.
+    std::size_t _node = 0;
+
+    int _port = 0;
+
+    int _listen_fd = -1;
+
+    int _epoll_fd = -1;
+
+    // Wake up the thread when it's stopped.
+    int _event_fd = -1;
+
+    // Fire when the earliest delayed reply is due.
+    int _timer_fd = -1;
+
+    std::uint64_t _client_id = 0;
+
+    std::unordered_map<std::uint64_t, std::unique_ptr<Client>> _clients;
+
+    struct Delayed {
+        std::chrono::steady_clock::time_point due;
+        std::uint64_t client;
+        std::string data;
+    };
+
+    // Replies waiting for the artificial latency. Since the latency is constant,
+    // they're sorted by due time.
+    std::deque<Delayed> _delayed;
+
+    // Clients with pending output.
+    std::vector<std::uint64_t> _dirty;
+
+    // Channel name -> ids of subscribed clients.
+    std::unordered_map<std::string, std::unordered_set<std::uint64_t>> _channels;
+
+    std::thread _thread;
+};
+
+// A cluster of MockServers, each of which owns a contiguous range of slots. Nodes
+// reply MOVED for keys that they don't own, and CLUSTER SLOTS with the current
+// slot map. Slots can be migrated while clients are running, so that both MOVED
+// and ASK redirections can be benchmarked. The nodes share one keyspace, i.e.
+// keys never get lost when a slot is migrated.
+class MockCluster {
+public:
+    // If *opts.port* is NOT 0, nodes listen on *opts.port*, *opts.port + 1*, ...
+    // Unix domain sockets are NOT supported.
+    explicit MockCluster(std::size_t nodes, const MockServerOptions &opts = {});
+
+    MockCluster(const MockCluster &) = delete;
+    MockCluster& operator=(const MockCluster &) = delete;
+
+    MockCluster(MockCluster &&) = delete;
+    MockCluster& operator=(MockCluster &&) = delete;
+
+    ~MockCluster() = default;
+
+    std::size_t size() const {
+        return _nodes.size();
+    }
+
+    MockServer& node(std::size_t idx) {
+        return *_nodes.at(idx);
+    }
+
+    // Options to connect to the first node.
+    ConnectionOptions connection_options() const {
+        return _nodes.front()->connection_options();
+    }
+
+    std::size_t owner(std::size_t slot) const;
+
+    // Start migrating *slot* to node *to*. Until it's finished, the owner replies
+    // ASK for all keys in the slot, and *to* serves them after ASKING.
+    void migrate(std::size_t slot, std::size_t to);
+
+    // Finish migrating *slot*, i.e. the new owner serves it, and others reply MOVED.
+    void finish_migration(std::size_t slot);
+
+private:
+    std::shared_ptr<MockServer::State> _state;
+
+    std::vector<std::unique_ptr<MockServer>> _nodes;
+};
+
+#endif // end SEWENEW_REDISPLUSPLUS_MOCK_SERVER_H
@@ -0,0 +1,424 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+// Microbenchmarks of the protocol hot paths, i.e. formatting commands, parsing and
+// freeing replies, converting replies and hashing keys to slots. Each case reports
+// nanoseconds and heap allocations per operation. No Redis server is needed.
+//
+//     qmake bench.pro && make && ./protocol_bench [filter] [--min-time=seconds]
+//
+// Only cases whose names contain *filter* are run.
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <new>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "command_args.h"
+#include "hiredis.h"
+#include "reply.h"
+#include "shards_pool.h"
+#include "utils.h"
+
+namespace {
+
+// Number of heap allocations, i.e. calls to malloc, calloc, realloc and operator new.
+std::uint64_t allocations = 0;
+
+}
+
+#if defined(__GLIBC__)
+
+// hiredis allocates with malloc, so count allocations at the libc level, which
+// also covers operator new of libstdc++.
+extern "C" {
+
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t num, std::size_t size);
+void* __libc_realloc(void *ptr, std::size_t size);
+void __libc_free(void *ptr);
+
+void* malloc(std::size_t size) {
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t num, std::size_t size) {
+    ++allocations;
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void *ptr, std::size_t size) {
+    ++allocations;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+}
+
+#else
+
+// Only allocations of C++ code are counted.
+void* operator new(std::size_t size) {
+    ++allocations;
+    if (auto *ptr = std::malloc(size)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+#endif
+
+namespace {
+
+double min_time = 0.2;
+
+std::string filter;
+
+// Keep results alive, so that the compiler doesn't optimize the work away.
+volatile std::size_t sink = 0;
+
+// Run *op* repeatedly for at least *min_time* seconds. Each call of *op* does
+// *ops* operations, e.g. parses *ops* replies.
+void run(const std::string &name, std::size_t ops, const std::function<void ()> &op) {
+    if (name.find(filter) == std::string::npos) {
+        return;
+    }
+
+    // Warm up.
+    op();
+
+    using Clock = std::chrono::steady_clock;
+
+    std::uint64_t iterations = 0;
+    std::uint64_t allocs = 0;
+    Clock::duration elapsed{};
+    for (std::uint64_t batch = 1; elapsed < std::chrono::duration<double>(min_time); batch *= 2) {
+        auto begin_allocs = allocations;
+        auto begin = Clock::now();
+        for (std::uint64_t idx = 0; idx != batch; ++idx) {
+            op();
+        }
+        elapsed += Clock::now() - begin;
+        allocs += allocations - begin_allocs;
+        iterations += batch;
+    }
+
+    auto total_ops = static_cast<double>(iterations * ops);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+    std::printf("%-36s %12.1f ns/op %10.2f allocs/op\n",
+                name.c_str(),
+                ns / total_ops,
+                allocs / total_ops);
+}
+
+// A corpus of RESP replies, e.g. recorded from a connection.
+struct Corpus {
+    std::string name;
+    std::string data;
+    std::size_t replies;
+};
+
+std::string bulk(const std::string &str) {
+    return "$" + std::to_string(str.size()) + "\r\n" + str + "\r\n";
+}
+
+Corpus small_ints() {
+    Corpus corpus{"small_ints", "", 1000};
+    for (std::size_t idx = 0; idx != corpus.replies; ++idx) {
+        corpus.data += ":" + std::to_string(idx * 37) + "\r\n";
+    }
+
+    return corpus;
+}
+
+Corpus strings_1k() {
+    Corpus corpus{"strings_1k", "", 100};
+    for (std::size_t idx = 0; idx != corpus.replies; ++idx) {
+        corpus.data += bulk(std::string(1024, 'a' + idx % 26));
+    }
+
+    return corpus;
+}
+
+Corpus array_10k() {
+    Corpus corpus{"array_10k", "*10000\r\n", 1};
+    for (std::size_t idx = 0; idx != 10000; ++idx) {
+        corpus.data += bulk("member:" + std::to_string(idx));
+    }
+
+    return corpus;
+}
+
+// EVAL replies with nested arrays of mixed types.
+Corpus nested_eval() {
+    std::string reply = "*3\r\n:1\r\n";
+    reply += "*2\r\n" + bulk("status") + "*3\r\n:10\r\n$-1\r\n" + bulk("nested");
+    reply += "*2\r\n*2\r\n*2\r\n" + bulk("deep") + ":42\r\n+OK\r\n-ERR inner\r\n";
+
+    Corpus corpus{"nested_eval", "", 100};
+    for (std::size_t idx = 0; idx != corpus.replies; ++idx) {
+        corpus.data += reply;
+    }
+
+    return corpus;
+}
+
+// Parse all replies of the corpus, and call *fn* with each of them.
+void parse_corpus(const Corpus &corpus, const std::function<void (redisReply *)> &fn) {
+    auto *reader = redisReaderCreate();
+    if (reader == nullptr || redisReaderFeed(reader, corpus.data.data(), corpus.data.size()) != REDIS_OK) {
+        std::fprintf(stderr, "failed to feed %s\n", corpus.name.c_str());
+        std::exit(1);
+    }
+
+    for (std::size_t idx = 0; idx != corpus.replies; ++idx) {
+        void *reply = nullptr;
+        if (redisReaderGetReply(reader, &reply) != REDIS_OK || reply == nullptr) {
+            std::fprintf(stderr, "failed to parse %s: %s\n", corpus.name.c_str(), reader->errstr);
+            std::exit(1);
+        }
+
+        fn(static_cast<redisReply*>(reply));
+    }
+
+    redisReaderFree(reader);
+}
+
+std::vector<ReplyUPtr> load(const std::string &data, std::size_t replies) {
+    std::vector<ReplyUPtr> result;
+    parse_corpus(Corpus{"reply", data, replies}, [&result](redisReply *reply) {
+                                                        result.emplace_back(reply);
+                                                    });
+    return result;
+}
+
+ReplyUPtr load(const std::string &data) {
+    return std::move(load(data, 1).front());
+}
+
+void bench_format() {
+    std::string key = "user:1000:profile";
+    std::string small(16, 'v');
+    std::string large(1024, 'v');
+
+    for (const auto *value : {&small, &large}) {
+        const char *argv[] = {"SET", key.data(), value->data()};
+        std::size_t argv_len[] = {3, key.size(), value->size()};
+
+        run("format/set_" + std::to_string(value->size()) + "b", 1, [&]() {
+                sds cmd = nullptr;
+                sink += redisFormatSdsCommandArgv(&cmd, 3, argv, argv_len);
+                redisFreeSdsCommand(cmd);
+            });
+    }
+
+    std::vector<std::string> fields;
+    std::vector<const char*> argv = {"HMGET", key.data()};
+    std::vector<std::size_t> argv_len = {5, key.size()};
+    for (std::size_t idx = 0; idx != 100; ++idx) {
+        fields.push_back("field:" + std::to_string(idx));
+    }
+    for (const auto &field : fields) {
+        argv.push_back(field.data());
+        argv_len.push_back(field.size());
+    }
+
+    run("format/hmget_100", 1, [&]() {
+            sds cmd = nullptr;
+            sink += redisFormatSdsCommandArgv(&cmd,
+                                                static_cast<int>(argv.size()),
+                                                argv.data(),
+                                                argv_len.data());
+            redisFreeSdsCommand(cmd);
+        });
+}
+
+void bench_cmd_args() {
+    StringView key = "user:1000:profile";
+    StringView value = "some value";
+
+    run("cmd_args/set_px", 1, [&]() {
+            CmdArgs args;
+            args << "SET" << key << value << "PX" << 60000LL;
+            sink += args.size();
+        });
+
+    run("cmd_args/zadd_score", 1, [&]() {
+            CmdArgs args;
+            args << "ZADD" << key << 3.25 << value;
+            sink += args.size();
+        });
+
+    std::vector<std::string> fields;
+    for (std::size_t idx = 0; idx != 100; ++idx) {
+        fields.push_back("field:" + std::to_string(idx));
+    }
+
+    run("cmd_args/hmget_100", 1, [&]() {
+            CmdArgs args;
+            args << "HMGET" << key << std::make_pair(fields.begin(), fields.end());
+            sink += args.size();
+        });
+}
+
+void bench_reader() {
+    for (const auto &corpus : {small_ints(), strings_1k(), array_10k(), nested_eval()}) {
+        run("reader/" + corpus.name, corpus.replies, [&corpus]() {
+                parse_corpus(corpus, [](redisReply *reply) {
+                        sink += reply->type;
+                        freeReplyObject(reply);
+                    });
+            });
+    }
+}
+
+void bench_free() {
+    for (const auto &corpus : {small_ints(), strings_1k(), array_10k(), nested_eval()}) {
+        // Replies are parsed before the clock starts, so that only freeing is timed.
+        std::vector<redisReply*> replies;
+        replies.reserve(corpus.replies);
+
+        auto name = "free/" + corpus.name;
+        if (name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        std::uint64_t allocs = 0;
+        std::uint64_t ops = 0;
+        std::chrono::steady_clock::duration elapsed{};
+        while (elapsed < std::chrono::duration<double>(min_time)) {
+            parse_corpus(corpus, [&replies](redisReply *reply) { replies.push_back(reply); });
+
+            auto begin_allocs = allocations;
+            auto begin = std::chrono::steady_clock::now();
+            for (auto *reply : replies) {
+                freeReplyObject(reply);
+            }
+            elapsed += std::chrono::steady_clock::now() - begin;
+            allocs += allocations - begin_allocs;
+
+            ops += replies.size();
+            replies.clear();
+        }
+
+        std::printf("%-36s %12.1f ns/op %10.2f allocs/op\n",
+                    name.c_str(),
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+                        / static_cast<double>(ops),
+                    allocs / static_cast<double>(ops));
+    }
+}
+
+template <typename T>
+void bench_parse(const std::string &name, redisReply &reply) {
+    run("parse/" + name, 1, [&reply]() {
+            auto result = reply::parse<T>(reply);
+            sink += sizeof(result);
+        });
+}
+
+void bench_parse() {
+    auto status = load("+OK\r\n");
+    auto str = load(bulk("hello world"));
+    auto nil = load("$-1\r\n");
+    auto integer = load(":1234567\r\n");
+    auto dbl = load(bulk("3.14159"));
+    auto boolean = load(":1\r\n");
+    auto pair = load("*2\r\n" + bulk("key") + bulk("value"));
+    auto tuple = load("*3\r\n" + bulk("a") + ":2\r\n" + bulk("c"));
+
+    std::string array = "*100\r\n";
+    std::string hash = "*200\r\n";
+    for (std::size_t idx = 0; idx != 100; ++idx) {
+        array += bulk("member:" + std::to_string(idx));
+        hash += bulk("field:" + std::to_string(idx)) + bulk(std::to_string(idx));
+    }
+    auto arr = load(array);
+    auto map = load(hash);
+
+    run("parse/void", 1, [&status]() { reply::parse<void>(*status); });
+    bench_parse<std::string>("string", *str);
+    bench_parse<OptionalString>("optional_string", *str);
+    bench_parse<OptionalString>("optional_string_nil", *nil);
+    bench_parse<long long>("long_long", *integer);
+    bench_parse<OptionalLongLong>("optional_long_long", *integer);
+    bench_parse<double>("double", *dbl);
+    bench_parse<OptionalDouble>("optional_double", *dbl);
+    bench_parse<bool>("bool", *boolean);
+    bench_parse<std::pair<std::string, std::string>>("pair", *pair);
+    bench_parse<std::tuple<std::string, long long, std::string>>("tuple", *tuple);
+    bench_parse<std::vector<std::string>>("vector_100", *arr);
+    bench_parse<std::list<std::string>>("list_100", *arr);
+    bench_parse<std::vector<OptionalString>>("vector_optional_100", *arr);
+    bench_parse<std::unordered_set<std::string>>("unordered_set_100", *arr);
+    bench_parse<std::unordered_map<std::string, std::string>>("unordered_map_100", *map);
+    bench_parse<std::map<std::string, std::string>>("map_100", *map);
+    bench_parse<std::vector<std::pair<std::string, std::string>>>("vector_pair_100", *map);
+}
+
+void bench_slot() {
+    std::string key = "user:1000:profile";
+    std::string tagged = "{user:1000}:profile";
+
+    run("crc16/17b", 1, [&key]() {
+            sink += crc16(key.data(), static_cast<int>(key.size()));
+        });
+
+    ShardsPool pool;
+    run("slot/plain_key", 1, [&]() { sink += pool.slot(key); });
+    run("slot/hash_tag", 1, [&]() { sink += pool.slot(tagged); });
+}
+
+}
+
+int main(int argc, char **argv) {
+    for (int idx = 1; idx < argc; ++idx) {
+        std::string arg = argv[idx];
+        if (arg.compare(0, 11, "--min-time=") == 0) {
+            min_time = std::atof(arg.c_str() + 11);
+        } else {
+            filter = arg;
+        }
+    }
+
+    bench_format();
+    bench_cmd_args();
+    bench_reader();
+    bench_free();
+    bench_parse();
+    bench_slot();
+
+    return 0;
+}
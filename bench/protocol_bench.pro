@@ -0,0 +1,14 @@
+# Microbenchmarks of the protocol hot paths, see protocol_bench.cpp.
+
+TEMPLATE = app
+TARGET = protocol_bench
+
+CONFIG += console c++11 release
+CONFIG -= app_bundle qt
+
+include(../qredis/qredis.pri)
+
+LIBS += -lpthread
+
+SOURCES += \
+        protocol_bench.cpp
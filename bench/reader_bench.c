@@ -0,0 +1,304 @@
+/*
+ * Microbenchmark of the RESP reader.
+ *
+ * It compares the previous byte-by-byte seekNewline with the current one on
+ * the exact sequence of calls the reader makes for a corpus, checks that both
+ * return the same results, and then measures the throughput of the whole reader.
+ *
+ * A corpus is a file of raw RESP replies, e.g. recorded from a connection with
+ * `socat -r corpus.resp ...`. Without arguments, built-in corpora shaped like
+ * ZRANGE WITHSCORES, HGETALL, LRANGE and MGET replies are used.
+ *
+ *     cc -O2 -I../qredis reader_bench.c ../qredis/sds.c -o reader_bench
+ *     ./reader_bench [corpus.resp ...]
+ *
+ * Build with -mavx2 to measure the AVX2 code path.
+ */
+
+/* Pull in the static helpers under test. */
+#include "read.c"
+
+#include <stdio.h>
+#include <time.h>
+
+/* Implementation before vectorization, kept for comparison. */
+static char *legacySeekNewline(char *s, size_t len) {
+    int pos = 0;
+    int _len = len-1;
+
+    while (pos < _len) {
+        while(pos < _len && s[pos] != '\r') pos++;
+        if (pos==_len) {
+            return NULL;
+        } else {
+            if (s[pos+1] == '\n') {
+                return s+pos;
+            } else {
+                pos++;
+            }
+        }
+    }
+    return NULL;
+}
+
+typedef struct corpus {
+    const char *name;
+    sds data;
+    /* Offsets where the reader looks for \r\n, i.e. the start of each line. */
+    size_t *lines;
+    size_t nlines;
+    size_t nreplies;
+} corpus;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static void fail(const char *msg) {
+    fprintf(stderr,"%s\n",msg);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p,size);
+    if (p == NULL) fail("Out of memory");
+    return p;
+}
+
+/* Walk the corpus the same way the reader does, and record its lines. */
+static size_t indexItem(corpus *c, size_t pos, int root) {
+    size_t len = sdslen(c->data);
+    size_t cap;
+    char *line, *crlf;
+    char type;
+    long long n = 0;
+    long long i;
+
+    if (pos >= len) fail("Truncated corpus");
+
+    type = c->data[pos];
+    line = c->data+pos+1;
+    crlf = legacySeekNewline(line,len-pos-1);
+    if (crlf == NULL) fail("Truncated corpus");
+
+    cap = c->nlines;
+    if ((cap & (cap-1)) == 0)
+        c->lines = xrealloc(c->lines,(cap ? cap*2 : 1024)*sizeof(size_t));
+    c->lines[c->nlines++] = pos+1;
+
+    if (strchr("$=:*%~>|",type) != NULL &&
+            string2ll(line,crlf-line,&n) == REDIS_ERR) fail("Bad length");
+
+    pos = crlf-c->data+2;
+    switch (type) {
+    case '$': case '=':
+        if (n >= 0) pos += n+2;
+        break;
+    case '*': case '~': case '>':
+        for (i = 0; i < n; i++) pos = indexItem(c,pos,0);
+        break;
+    case '%': case '|':
+        for (i = 0; i < n*2; i++) pos = indexItem(c,pos,0);
+        /* An attribute is followed by the reply it describes. */
+        if (type == '|') pos = indexItem(c,pos,root);
+        break;
+    }
+    if (root) c->nreplies++;
+    return pos;
+}
+
+static void loadCorpus(corpus *c, const char *name, sds data) {
+    size_t pos = 0;
+
+    memset(c,0,sizeof(*c));
+    c->name = name;
+    c->data = data;
+    while (pos < sdslen(data)) pos = indexItem(c,pos,1);
+}
+
+static sds readFile(const char *path) {
+    FILE *fp = fopen(path,"rb");
+    char buf[1024*16];
+    size_t n;
+    sds data = sdsempty();
+
+    if (fp == NULL) fail("Failed to open corpus");
+    while ((n = fread(buf,1,sizeof(buf),fp)) > 0) data = sdscatlen(data,buf,n);
+    fclose(fp);
+    return data;
+}
+
+static sds bulk(sds s, const char *str) {
+    return sdscatprintf(s,"$%zu\r\n%s\r\n",strlen(str),str);
+}
+
+/* ZRANGE key 0 -1 WITHSCORES on a sorted set of 1000 members. */
+static sds zrangeCorpus(void) {
+    sds s = sdsempty();
+    char buf[64];
+    int r, i;
+
+    for (r = 0; r < 20; r++) {
+        s = sdscatprintf(s,"*%d\r\n",2000);
+        for (i = 0; i < 1000; i++) {
+            snprintf(buf,sizeof(buf),"member:%d",i);
+            s = bulk(s,buf);
+            snprintf(buf,sizeof(buf),"%.17g",i*1.25+0.1);
+            s = bulk(s,buf);
+        }
+    }
+    return s;
+}
+
+/* HGETALL on a hash of 500 small fields, as RESP2 array and RESP3 map. */
+static sds hgetallCorpus(void) {
+    sds s = sdsempty();
+    char buf[64];
+    int r, i;
+
+    for (r = 0; r < 40; r++) {
+        s = (r % 2) ? sdscatprintf(s,"%%%d\r\n",500) : sdscatprintf(s,"*%d\r\n",1000);
+        for (i = 0; i < 500; i++) {
+            snprintf(buf,sizeof(buf),"field%d",i);
+            s = bulk(s,buf);
+            snprintf(buf,sizeof(buf),"%d",i*7919);
+            s = bulk(s,buf);
+        }
+    }
+    return s;
+}
+
+/* LRANGE on a list of 200 byte values. */
+static sds lrangeCorpus(void) {
+    sds s = sdsempty();
+    char buf[256];
+    int r, i;
+
+    memset(buf,'v',200);
+    buf[200] = '\0';
+    for (r = 0; r < 20; r++) {
+        s = sdscatprintf(s,"*%d\r\n",1000);
+        for (i = 0; i < 1000; i++) s = bulk(s,buf);
+    }
+    return s;
+}
+
+/* Many small replies, e.g. pipelined INCR and MGET with missing keys. */
+static sds smallCorpus(void) {
+    sds s = sdsempty();
+    int i;
+
+    for (i = 0; i < 20000; i++) {
+        s = sdscatprintf(s,":%d\r\n",i*31);
+        s = sdscat(s,"*3\r\n$5\r\nhello\r\n$-1\r\n$2\r\nok\r\n");
+        s = sdscat(s,"+OK\r\n");
+    }
+    return s;
+}
+
+static int iterations(const corpus *c) {
+    size_t len = sdslen(c->data);
+    int n = (int)((size_t)256*1024*1024/(len ? len : 1));
+    return n < 3 ? 3 : n;
+}
+
+/* Both implementations are timed alternately for a few rounds, and the best
+ * round of each is reported, so that noise on a busy machine hurts less. */
+#define ROUNDS 7
+
+static void benchSeek(const corpus *c) {
+    size_t len = sdslen(c->data);
+    volatile size_t sink = 0;
+    double t0, t1, t2, legacy = 0, current = 0;
+    size_t i;
+    int it, round, n = iterations(c)/ROUNDS+1;
+
+    for (i = 0; i < c->nlines; i++) {
+        size_t off = c->lines[i];
+        if (seekNewline(c->data+off,len-off) != legacySeekNewline(c->data+off,len-off))
+            fail("seekNewline mismatch");
+    }
+
+    for (round = 0; round < ROUNDS; round++) {
+        t0 = now();
+        for (it = 0; it < n; it++)
+            for (i = 0; i < c->nlines; i++)
+                sink += (size_t)legacySeekNewline(c->data+c->lines[i],len-c->lines[i]);
+        t1 = now();
+        for (it = 0; it < n; it++)
+            for (i = 0; i < c->nlines; i++)
+                sink += (size_t)seekNewline(c->data+c->lines[i],len-c->lines[i]);
+        t2 = now();
+
+        if (round == 0 || t1-t0 < legacy) legacy = t1-t0;
+        if (round == 0 || t2-t1 < current) current = t2-t1;
+    }
+
+    printf("  seekNewline  %8.2f ns/call -> %8.2f ns/call  (x%.2f)\n",
+        legacy*1e9/((double)n*c->nlines),current*1e9/((double)n*c->nlines),
+        legacy/current);
+    (void)sink;
+}
+
+/* Parse the whole corpus without building reply objects. */
+static void benchReader(const corpus *c) {
+    redisReader *r = redisReaderCreateWithFunctions(NULL);
+    size_t len = sdslen(c->data);
+    size_t replies = 0;
+    double t0, t1;
+    void *reply;
+    int it, n = iterations(c);
+
+    if (r == NULL) fail("Out of memory");
+    r->maxbuf = 0;
+
+    t0 = now();
+    for (it = 0; it < n; it++) {
+        memcpy(redisReaderReserve(r,len),c->data,len);
+        redisReaderCommit(r,len);
+        for (;;) {
+            if (redisReaderGetReply(r,&reply) != REDIS_OK) fail(r->errstr);
+            if (reply == NULL) break;
+            replies++;
+        }
+    }
+    t1 = now();
+
+    if (replies != c->nreplies*n) fail("Reply count mismatch");
+    printf("  reader       %8.1f MB/s, %.2f M replies/s\n",
+        (double)len*n/(t1-t0)/(1024*1024),replies/(t1-t0)/1e6);
+    redisReaderFree(r);
+}
+
+static void bench(corpus *c) {
+    printf("%s: %zu bytes, %zu replies, %zu lines\n",
+        c->name,sdslen(c->data),c->nreplies,c->nlines);
+    benchSeek(c);
+    benchReader(c);
+    sdsfree(c->data);
+    free(c->lines);
+}
+
+int main(int argc, char **argv) {
+    corpus c;
+    int i;
+
+    if (argc > 1) {
+        for (i = 1; i < argc; i++) {
+            loadCorpus(&c,argv[i],readFile(argv[i]));
+            bench(&c);
+        }
+    } else {
+        loadCorpus(&c,"zrange-withscores",zrangeCorpus());
+        bench(&c);
+        loadCorpus(&c,"hgetall",hgetallCorpus());
+        bench(&c);
+        loadCorpus(&c,"lrange",lrangeCorpus());
+        bench(&c);
+        loadCorpus(&c,"small-replies",smallCorpus());
+        bench(&c);
+    }
+    return 0;
+}
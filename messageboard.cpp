@@ -1,27 +1,38 @@
 #include "messageboard.h"
+#include "redisworker.h"
 
 messageBoard::messageBoard(QObject *parent) : QObject(parent)
 {
+    auto worker = new redisWorker("tcp://redis-19837.c228.us-central1-1.gce.cloud.redislabs.com:19837",
+                                  "123456", "test", 1000);
+    worker->moveToThread(&workerThread);
 
-    try {
-        RedisClient = new Redis ("tcp://redis-19837.c228.us-central1-1.gce.cloud.redislabs.com:19837");
-        RedisClient->auth("123456");
-    } catch (Error e)
+    // Signals across threads are queued, so the GUI thread never waits for Redis.
+    connect(&workerThread, &QThread::started, worker, &redisWorker::start);
+    connect(&workerThread, &QThread::finished, worker, &QObject::deleteLater);
+    connect(this, &messageBoard::writeRequested, worker, &redisWorker::write);
+    connect(worker, &redisWorker::valueReady, this, &messageBoard::updateValue);
+    connect(worker, &redisWorker::failed, this, &messageBoard::reportError);
 
+    workerThread.start();
+}
+
+messageBoard::~messageBoard()
+{
+    workerThread.quit();
+
+    // A pending command is bounded by the worker's socket timeout.
+    if (!workerThread.wait(3000))
     {
-        qDebug()<<Q_FUNC_INFO<<"init redis failed";
-        qDebug()<<Q_FUNC_INFO<<e.what();
+        qDebug()<<Q_FUNC_INFO<<"redis worker doesn't stop, terminate it";
+        workerThread.terminate();
+        workerThread.wait();
     }
-    timer = new QTimer (this);
-    connect(timer,SIGNAL(timeout()),this,SLOT(Myslot()));
-    timer->start(1000);
-
 }
 
-void messageBoard::Myslot()
+void messageBoard::updateValue(const QString &value)
 {
-    Value = QString::fromStdString(RedisClient->get(QString("test").toUtf8().constData()).value());
-   // qDebug()<<Data;
+    Value = value;
 
     if (Value == "On")
     {
@@ -32,14 +43,17 @@ void messageBoard::Myslot()
       qDebug()<<"off";
     }
 }
+void messageBoard::reportError(const QString &error)
+{
+    qDebug()<<Q_FUNC_INFO<<error;
+}
 void messageBoard::on()
 {
-    RedisClient->set("test", "On");
+    emit writeRequested("On");
     qDebug()<<"active";
 }
 void messageBoard::off()
 {
-    RedisClient->set("test", "Off");
+    emit writeRequested("Off");
     qDebug()<<"diactive";
 }
-
@@ -2,7 +2,7 @@
 #define MESSAGEBOARD_H
 
 #include <QObject>
-#include "redis++.h"
+#include <QThread>
 #include <QtCore>
 #include <QDebug>
 class messageBoard : public QObject
@@ -10,7 +10,7 @@ class messageBoard : public QObject
     Q_OBJECT
 public:
     explicit messageBoard(QObject *parent = nullptr);
-       QTimer * timer;
+    ~messageBoard();
        QString Value;
        QString ValueColor;
 Q_INVOKABLE QString invalue()
@@ -34,11 +34,14 @@ return Value;
 
 
 private :
-    Redis * RedisClient;
+    // Redis I/O runs in this thread, see redisWorker.
+    QThread workerThread;
 signals:
+    void writeRequested(const QString &value);
 
 public slots :
-  void Myslot();
+  void updateValue(const QString &value);
+  void reportError(const QString &error);
   void on();
   void off();
 
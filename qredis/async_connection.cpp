@@ -0,0 +1,537 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "async_connection.h"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "command.h"
+
+extern "C" {
+#include "net.h"
+}
+
+namespace {
+
+std::exception_ptr make_error(redisContext &ctx, const std::string &err_info) {
+    try {
+        throw_error(ctx, err_info);
+    } catch (...) {
+        return std::current_exception();
+    }
+
+    // Never goes here.
+    return nullptr;
+}
+
+std::exception_ptr make_error(const redisReply &reply) {
+    try {
+        throw_error(reply);
+    } catch (...) {
+        return std::current_exception();
+    }
+
+    // Never goes here.
+    return nullptr;
+}
+
+}
+
+AsyncConnection::AsyncConnection(const ConnectionOptions &opts, EventLoop &loop) :
+                                    _opts(opts),
+                                    _loop(loop) {
+    auto zero = std::chrono::milliseconds(0);
+    auto timeout = _opts.connect_timeout;
+    if (timeout == zero
+            || (_opts.socket_timeout > zero && _opts.socket_timeout < timeout)) {
+        timeout = _opts.socket_timeout;
+    }
+
+    _loop.track(*this, timeout);
+
+    // Lazily create connection.
+}
+
+AsyncConnection::~AsyncConnection() {
+    auto err = std::make_exception_ptr(Error("Connection has been destroyed"));
+
+    auto events = _close();
+
+    _fail(events, err);
+}
+
+void AsyncConnection::on_readable() {
+    std::vector<std::pair<AsyncEventUPtr, ReplyUPtr>> replies;
+    std::vector<ReplyUPtr> pushes;
+    std::vector<AsyncEventUPtr> failed_events;
+    std::exception_ptr err;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_state != State::READY) {
+            // Connect failure is handled by *on_writable*.
+            return;
+        }
+
+        assert(_connection);
+
+        auto *ctx = _connection->_context();
+
+        if (redisBufferRead(ctx) != REDIS_OK) {
+            failed_events = _close(*ctx, "Failed to get reply", err);
+        } else {
+            _last_progress = std::chrono::steady_clock::now();
+
+            while (true) {
+                void *r = nullptr;
+                if (redisGetReplyFromReader(ctx, &r) != REDIS_OK) {
+                    failed_events = _close(*ctx, "Failed to get reply", err);
+                    break;
+                }
+
+                if (r == nullptr) {
+                    // No more complete reply.
+                    break;
+                }
+
+                auto reply = ReplyUPtr(static_cast<redisReply*>(r));
+
+                if (reply::is_push(*reply) || reply::is_attribute(*reply)) {
+                    // Out-of-band data, which is NOT a reply of any pending command.
+                    if (reply::is_push(*reply) && _opts.push_handler) {
+                        pushes.push_back(std::move(reply));
+                    }
+
+                    continue;
+                }
+
+                if (_events.empty()) {
+                    err = std::make_exception_ptr(
+                            ProtoError("Got a reply without pending command"));
+                    failed_events = _close();
+                    break;
+                }
+
+                auto event = std::move(_events.front());
+                _events.pop_front();
+
+                if (!event) {
+                    // Reply of AUTH, HELLO, SELECT or READONLY command.
+                    if (reply::is_error(*reply)) {
+                        err = make_error(*reply);
+                        failed_events = _close();
+                        break;
+                    }
+
+                    continue;
+                }
+
+                replies.emplace_back(std::move(event), std::move(reply));
+            }
+        }
+    }
+
+    for (auto &push : pushes) {
+        try {
+            _opts.push_handler(*push);
+        } catch (...) {
+            // Ignore exceptions thrown by user callbacks.
+        }
+    }
+
+    for (auto &ele : replies) {
+        auto &event = ele.first;
+        auto &reply = ele.second;
+
+        try {
+            if (reply::is_error(*reply)) {
+                event->set_exception(make_error(*reply));
+            } else {
+                event->set_value(std::move(reply));
+            }
+        } catch (...) {
+            // Ignore exceptions thrown by user callbacks,
+            // so that they won't break the event loop.
+        }
+    }
+
+    _fail(failed_events, err);
+}
+
+void AsyncConnection::on_writable() {
+    std::vector<AsyncEventUPtr> failed_events;
+    std::exception_ptr err;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_state == State::BROKEN) {
+            // Stale event of a closed connection.
+            return;
+        }
+
+        assert(_connection);
+
+        auto *ctx = _connection->_context();
+
+        if (_state == State::CONNECTING) {
+            int completed = 0;
+            if (redisCheckConnectDone(ctx, &completed) != REDIS_OK) {
+                redisCheckSocketError(ctx);
+                failed_events = _close(*ctx, "Failed to connect to Redis", err);
+            } else if (completed) {
+                _state = State::READY;
+                _last_progress = std::chrono::steady_clock::now();
+            }
+        }
+
+        if (_state == State::READY) {
+            int done = 0;
+            if (redisBufferWrite(ctx, &done) != REDIS_OK) {
+                failed_events = _close(*ctx, "Failed to send command", err);
+            } else if (done) {
+                try {
+                    _loop.modify(ctx->fd, *this, false);
+                    _watching_write = false;
+                } catch (const Error &e) {
+                    err = std::current_exception();
+                    failed_events = _close();
+                }
+            }
+        }
+    }
+
+    _fail(failed_events, err);
+}
+
+void AsyncConnection::on_timeout(std::chrono::steady_clock::time_point now) {
+    std::vector<AsyncEventUPtr> failed_events;
+    std::exception_ptr err;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto timeout = std::chrono::milliseconds(0);
+        std::string err_info;
+        if (_state == State::CONNECTING) {
+            timeout = _opts.connect_timeout;
+            err_info = "Failed to connect to Redis in ";
+        } else if (_state == State::READY && !_events.empty()) {
+            timeout = _opts.socket_timeout;
+            err_info = "Failed to get reply in ";
+        }
+
+        if (timeout <= std::chrono::milliseconds(0) || now - _last_progress < timeout) {
+            return;
+        }
+
+        // Late replies CANNOT be matched with pending events, so close the connection.
+        err = std::make_exception_ptr(TimeoutError(err_info
+                    + std::to_string(timeout.count()) + " milliseconds"));
+        failed_events = _close();
+    }
+
+    _fail(failed_events, err);
+}
+
+void AsyncConnection::disconnect(std::exception_ptr err) {
+    std::vector<AsyncEventUPtr> events;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        events = _close();
+    }
+
+    _fail(events, err);
+}
+
+void AsyncConnection::_connect() {
+    assert(_state == State::BROKEN && _events.empty());
+
+    _connection.reset(new Connection(_opts, Connection::NonBlocking{}));
+
+    try {
+        _handshake();
+
+        _loop.watch(_connection->_context()->fd, *this, true);
+    } catch (const Error &e) {
+        _events.clear();
+        _connection.reset();
+        throw;
+    }
+
+    _watching_write = true;
+    _state = State::CONNECTING;
+    _last_progress = std::chrono::steady_clock::now();
+}
+
+void AsyncConnection::_handshake() {
+    assert(_connection);
+
+    if (!_opts.password.empty()) {
+        cmd::auth(*_connection, _opts.password);
+        _events.push_back(nullptr);
+    }
+
+    if (_opts.resp == 3) {
+        _connection->send("HELLO 3");
+        _events.push_back(nullptr);
+    } else if (_opts.resp != 2) {
+        throw Error("Unsupported protocol version: " + std::to_string(_opts.resp));
+    }
+
+    if (_opts.db != 0) {
+        cmd::select(*_connection, _opts.db);
+        _events.push_back(nullptr);
+    }
+
+    if (_opts.readonly) {
+        _connection->send("READONLY");
+        _events.push_back(nullptr);
+    }
+}
+
+void AsyncConnection::_watch_write() {
+    if (_watching_write) {
+        return;
+    }
+
+    assert(_connection);
+
+    _loop.modify(_connection->_context()->fd, *this, true);
+
+    _watching_write = true;
+}
+
+std::vector<AsyncEventUPtr> AsyncConnection::_close(redisContext &ctx,
+                                                    const std::string &err_info,
+                                                    std::exception_ptr &err) {
+    err = make_error(ctx, err_info);
+
+    return _close();
+}
+
+std::vector<AsyncEventUPtr> AsyncConnection::_close() {
+    std::vector<AsyncEventUPtr> events;
+    events.reserve(_events.size());
+    for (auto &event : _events) {
+        if (event) {
+            events.push_back(std::move(event));
+        }
+    }
+    _events.clear();
+
+    // Closing the socket also removes it from epoll.
+    _connection.reset();
+
+    _state = State::BROKEN;
+    _watching_write = false;
+
+    return events;
+}
+
+void AsyncConnection::_fail(std::vector<AsyncEventUPtr> &events, std::exception_ptr err) {
+    for (auto &event : events) {
+        assert(event);
+
+        try {
+            event->set_exception(err);
+        } catch (...) {
+            // Ignore exceptions thrown by user callbacks.
+        }
+    }
+}
+
+EventLoop::EventLoop() {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epoll_fd < 0) {
+        throw Error(std::string("Failed to create epoll: ") + std::strerror(errno));
+    }
+
+    _stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_stop_fd < 0) {
+        close(_epoll_fd);
+        throw Error(std::string("Failed to create eventfd: ") + std::strerror(errno));
+    }
+
+    // A null pointer marks the stop event.
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _stop_fd, &ev) != 0) {
+        close(_stop_fd);
+        close(_epoll_fd);
+        throw Error(std::string("Failed to watch eventfd: ") + std::strerror(errno));
+    }
+
+    _loop_thread = std::thread([this]() { this->_run(); });
+}
+
+EventLoop::~EventLoop() {
+    stop();
+
+    close(_stop_fd);
+    close(_epoll_fd);
+}
+
+void EventLoop::watch(int fd, AsyncConnection &connection, bool writable) {
+    _ctl(EPOLL_CTL_ADD, fd, connection, writable);
+}
+
+void EventLoop::modify(int fd, AsyncConnection &connection, bool writable) {
+    _ctl(EPOLL_CTL_MOD, fd, connection, writable);
+}
+
+void EventLoop::track(AsyncConnection &connection, std::chrono::milliseconds timeout) {
+    // Check a few times per timeout, but at least every 100 milliseconds.
+    auto interval = std::max(std::chrono::milliseconds(1),
+                        std::min(timeout / 4, std::chrono::milliseconds(100)));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _tracked_connections.push_back(&connection);
+
+    if (timeout <= std::chrono::milliseconds(0)) {
+        return;
+    }
+
+    if (_interval == std::chrono::milliseconds(0) || interval < _interval) {
+        _interval = interval;
+    }
+}
+
+void EventLoop::stop() {
+    if (_stopped.exchange(true)) {
+        return;
+    }
+
+    uint64_t one = 1;
+    auto n = write(_stop_fd, &one, sizeof(one));
+    (void)n;
+
+    // DO NOT destroy the loop in its own thread, e.g. in a callback.
+    assert(std::this_thread::get_id() != _loop_thread.get_id());
+
+    if (_loop_thread.joinable()) {
+        _loop_thread.join();
+    }
+}
+
+void EventLoop::_run() {
+    const int MAX_EVENTS = 128;
+    epoll_event events[MAX_EVENTS];
+
+    auto last_check = std::chrono::steady_clock::now();
+
+    while (true) {
+        auto interval = _check_interval();
+        auto num = epoll_wait(_epoll_fd, events, MAX_EVENTS, interval);
+        if (num < 0) {
+            if (errno != EINTR) {
+                // Unrecoverable error.
+                _fail(errno);
+                return;
+            }
+
+            num = 0;
+        }
+
+        for (auto idx = 0; idx < num; ++idx) {
+            const auto &ev = events[idx];
+            auto *connection = static_cast<AsyncConnection*>(ev.data.ptr);
+            if (connection == nullptr) {
+                // Stop event.
+                return;
+            }
+
+            if (ev.events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                connection->on_writable();
+            }
+
+            if (ev.events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                connection->on_readable();
+            }
+        }
+
+        if (interval >= 0) {
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_check >= std::chrono::milliseconds(interval)) {
+                last_check = now;
+                _check_timeouts();
+            }
+        }
+    }
+}
+
+int EventLoop::_check_interval() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_interval == std::chrono::milliseconds(0)) {
+        // No connection has a timeout.
+        return -1;
+    }
+
+    return static_cast<int>(_interval.count());
+}
+
+void EventLoop::_check_timeouts() {
+    std::vector<AsyncConnection*> connections;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        connections = _tracked_connections;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (auto *connection : connections) {
+        connection->on_timeout(now);
+    }
+}
+
+void EventLoop::_fail(int err) {
+    auto err_info = std::string("Event loop failed: ") + std::strerror(err);
+
+    // Set it before disconnecting, so that a command sent to a connection either
+    // fails immediately, or is queued before *disconnect* and failed here.
+    _failed = true;
+
+    std::vector<AsyncConnection*> connections;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        connections = _tracked_connections;
+    }
+
+    auto error = std::make_exception_ptr(Error(err_info));
+    for (auto *connection : connections) {
+        connection->disconnect(error);
+    }
+}
+
+void EventLoop::_ctl(int op, int fd, AsyncConnection &connection, bool writable) {
+    epoll_event ev{};
+    ev.events = writable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.ptr = &connection;
+
+    if (epoll_ctl(_epoll_fd, op, fd, &ev) != 0) {
+        throw Error(std::string("Failed to watch connection: ") + std::strerror(errno));
+    }
+}
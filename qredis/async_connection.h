@@ -0,0 +1,338 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPLUSPLUS_ASYNC_CONNECTION_H
+#define SEWENEW_REDISPLUSPLUS_ASYNC_CONNECTION_H
+
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "connection.h"
+#include "reply.h"
+#include "errors.h"
+
+// An *AsyncEvent* is the pending state of a command that has been sent,
+// but whose reply has NOT been received yet. Both *set_value* and
+// *set_exception* are called in the event loop thread.
+class AsyncEvent {
+public:
+    virtual ~AsyncEvent() = default;
+
+    virtual void set_value(ReplyUPtr reply) = 0;
+
+    virtual void set_exception(std::exception_ptr err) = 0;
+};
+
+using AsyncEventUPtr = std::unique_ptr<AsyncEvent>;
+
+template <typename Result>
+struct DefaultReplyParser {
+    Result operator()(redisReply &reply) const {
+        return reply::parse<Result>(reply);
+    }
+};
+
+template <>
+struct DefaultReplyParser<ReplyUPtr> {
+};
+
+template <typename Result, typename Parser = DefaultReplyParser<Result>>
+class FutureEvent : public AsyncEvent {
+public:
+    std::future<Result> get_future() {
+        return _pro.get_future();
+    }
+
+    virtual void set_value(ReplyUPtr reply) override {
+        assert(reply);
+
+        try {
+            _set_value(std::is_void<Result>(), *reply);
+        } catch (...) {
+            _pro.set_exception(std::current_exception());
+        }
+    }
+
+    virtual void set_exception(std::exception_ptr err) override {
+        _pro.set_exception(err);
+    }
+
+private:
+    void _set_value(std::true_type, redisReply &reply) {
+        Parser()(reply);
+        _pro.set_value();
+    }
+
+    void _set_value(std::false_type, redisReply &reply) {
+        _pro.set_value(Parser()(reply));
+    }
+
+    std::promise<Result> _pro;
+};
+
+template <>
+class FutureEvent<ReplyUPtr, DefaultReplyParser<ReplyUPtr>> : public AsyncEvent {
+public:
+    std::future<ReplyUPtr> get_future() {
+        return _pro.get_future();
+    }
+
+    virtual void set_value(ReplyUPtr reply) override {
+        _pro.set_value(std::move(reply));
+    }
+
+    virtual void set_exception(std::exception_ptr err) override {
+        _pro.set_exception(err);
+    }
+
+private:
+    std::promise<ReplyUPtr> _pro;
+};
+
+// Invoke the callback with a ready future, so that the callback can get the
+// result, or the exception, with *std::future<Result>::get*.
+template <typename Result, typename Callback, typename Parser = DefaultReplyParser<Result>>
+class CallbackEvent : public AsyncEvent {
+public:
+    explicit CallbackEvent(Callback callback) : _callback(std::move(callback)) {}
+
+    virtual void set_value(ReplyUPtr reply) override {
+        auto fut = _event.get_future();
+
+        _event.set_value(std::move(reply));
+
+        _callback(std::move(fut));
+    }
+
+    virtual void set_exception(std::exception_ptr err) override {
+        auto fut = _event.get_future();
+
+        _event.set_exception(err);
+
+        _callback(std::move(fut));
+    }
+
+private:
+    FutureEvent<Result, Parser> _event;
+
+    Callback _callback;
+};
+
+class EventLoop;
+
+// A non-blocking connection driven by an *EventLoop*. Commands are encoded
+// with the *cmd::* functions into the underlying connection's output buffer,
+// and replies are dispatched to pending events in FIFO order.
+//
+// *send* is thread-safe, and can be called by any thread, while *on_readable*
+// and *on_writable* are only called by the event loop thread.
+class AsyncConnection {
+public:
+    AsyncConnection(const ConnectionOptions &opts, EventLoop &loop);
+
+    AsyncConnection(const AsyncConnection &) = delete;
+    AsyncConnection& operator=(const AsyncConnection &) = delete;
+
+    AsyncConnection(AsyncConnection &&) = delete;
+    AsyncConnection& operator=(AsyncConnection &&) = delete;
+
+    ~AsyncConnection();
+
+    template <typename Cmd, typename ...Args>
+    void send(AsyncEventUPtr event, Cmd cmd, Args &&...args);
+
+    void on_readable();
+
+    void on_writable();
+
+    // Close the connection, and fail pending events with *TimeoutError*, if it has
+    // been connecting for more than *connect_timeout*, or it has received nothing
+    // for more than *socket_timeout* while waiting for replies.
+    void on_timeout(std::chrono::steady_clock::time_point now);
+
+    // Fail all pending events with the given error, and close the connection.
+    // It will be reconnected, when we send command to it next time.
+    void disconnect(std::exception_ptr err);
+
+private:
+    enum class State {
+        BROKEN = 0,
+        CONNECTING,
+        READY
+    };
+
+    // NOT thread-safe.
+    void _connect();
+
+    // NOT thread-safe.
+    void _handshake();
+
+    // NOT thread-safe.
+    void _watch_write();
+
+    // NOT thread-safe.
+    std::vector<AsyncEventUPtr> _close(redisContext &ctx, const std::string &err_info,
+                                        std::exception_ptr &err);
+
+    // NOT thread-safe.
+    std::vector<AsyncEventUPtr> _close();
+
+    static void _fail(std::vector<AsyncEventUPtr> &events, std::exception_ptr err);
+
+    ConnectionOptions _opts;
+
+    EventLoop &_loop;
+
+    std::unique_ptr<Connection> _connection;
+
+    State _state = State::BROKEN;
+
+    bool _watching_write = false;
+
+    // The time that we started connecting, received data, or started waiting for
+    // replies with an empty queue. Timeouts are measured from it.
+    std::chrono::steady_clock::time_point _last_progress{};
+
+    // Pending events. A null event is a placeholder for the reply of a
+    // command sent by the library itself, e.g. AUTH and SELECT.
+    std::deque<AsyncEventUPtr> _events;
+
+    std::mutex _mutex;
+};
+
+// An epoll based event loop, which runs in a dedicated thread.
+class EventLoop {
+public:
+    EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop& operator=(const EventLoop &) = delete;
+
+    EventLoop(EventLoop &&) = delete;
+    EventLoop& operator=(EventLoop &&) = delete;
+
+    // Stop the loop, and join the loop thread.
+    ~EventLoop();
+
+    void watch(int fd, AsyncConnection &connection, bool writable);
+
+    void modify(int fd, AsyncConnection &connection, bool writable);
+
+    // Register the connection, so that its pending events are failed if the loop
+    // fails. If *timeout* is positive, also check its timeouts periodically, until
+    // the loop stops. The connection MUST outlive the loop thread.
+    void track(AsyncConnection &connection, std::chrono::milliseconds timeout);
+
+    void stop();
+
+    // Whether the loop has exited on an unrecoverable error. Then no event
+    // will ever be resolved, and new commands should fail immediately.
+    bool failed() const {
+        return _failed.load();
+    }
+
+private:
+    void _run();
+
+    // Return the interval of checking timeouts in milliseconds, or -1 if no
+    // connection has a timeout.
+    int _check_interval();
+
+    void _check_timeouts();
+
+    // Fail pending events of all registered connections, on an unrecoverable error.
+    void _fail(int err);
+
+    void _ctl(int op, int fd, AsyncConnection &connection, bool writable);
+
+    int _epoll_fd = -1;
+
+    int _stop_fd = -1;
+
+    std::atomic<bool> _stopped{false};
+
+    // NOT the same as *_stopped*, since we still need to join the loop thread.
+    std::atomic<bool> _failed{false};
+
+    std::vector<AsyncConnection*> _tracked_connections;
+
+    std::chrono::milliseconds _interval{0};
+
+    std::mutex _mutex;
+
+    std::thread _loop_thread;
+};
+
+// Inline implementations.
+
+template <typename Cmd, typename ...Args>
+void AsyncConnection::send(AsyncEventUPtr event, Cmd cmd, Args &&...args) {
+    assert(event);
+
+    std::vector<AsyncEventUPtr> failed_events;
+    std::exception_ptr err;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        try {
+            if (_loop.failed()) {
+                throw Error("Event loop has failed");
+            }
+
+            if (_state == State::BROKEN) {
+                _connect();
+            }
+
+            assert(_connection);
+
+            cmd(*_connection, std::forward<Args>(args)...);
+
+            if (_state == State::READY && _events.empty()) {
+                _last_progress = std::chrono::steady_clock::now();
+            }
+
+            _events.push_back(std::move(event));
+
+            _watch_write();
+        } catch (const Error &e) {
+            err = std::current_exception();
+
+            if (event) {
+                // Failed to create connection or encode command.
+                failed_events.push_back(std::move(event));
+            }
+
+            if (_connection && _connection->broken()) {
+                auto events = _close();
+                std::move(events.begin(), events.end(), std::back_inserter(failed_events));
+            }
+        }
+    }
+
+    // Always call user callbacks without holding the lock, since callbacks
+    // might send commands with this connection.
+    _fail(failed_events, err);
+}
+
+#endif // end SEWENEW_REDISPLUSPLUS_ASYNC_CONNECTION_H
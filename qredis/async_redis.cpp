@@ -0,0 +1,75 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "async_redis.h"
+
+AsyncRedis::AsyncRedis(const ConnectionOptions &connection_opts,
+                        const ConnectionPoolOptions &pool_opts) :
+                            _loop(new EventLoop),
+                            _next_connection(new std::atomic<std::size_t>(0)) {
+    auto size = pool_opts.size == 0 ? 1 : pool_opts.size;
+
+    _connections.reserve(size);
+    for (std::size_t idx = 0; idx != size; ++idx) {
+        _connections.emplace_back(new AsyncConnection(connection_opts, *_loop));
+    }
+}
+
+AsyncRedis::AsyncRedis(const std::string &uri) : AsyncRedis(ConnectionOptions(uri)) {}
+
+AsyncRedis& AsyncRedis::operator=(AsyncRedis &&that) {
+    if (this != &that) {
+        _close();
+
+        // Our loop has stopped, so it's safe to destroy it before our connections.
+        _loop = std::move(that._loop);
+        _connections = std::move(that._connections);
+        _next_connection = std::move(that._next_connection);
+    }
+
+    return *this;
+}
+
+AsyncRedis::~AsyncRedis() {
+    _close();
+}
+
+void AsyncRedis::_close() {
+    if (!_loop) {
+        // This object has been moved.
+        return;
+    }
+
+    // Stop the loop first, so that no one else accesses the connections.
+    _loop->stop();
+
+    auto err = std::make_exception_ptr(Error("AsyncRedis is closed"));
+    for (auto &connection : _connections) {
+        connection->disconnect(err);
+    }
+}
+
+AsyncConnection& AsyncRedis::_connection() {
+    if (!_loop) {
+        throw Error("AsyncRedis has been moved");
+    }
+
+    assert(!_connections.empty());
+
+    auto idx = _next_connection->fetch_add(1, std::memory_order_relaxed);
+
+    return *_connections[idx % _connections.size()];
+}
@@ -0,0 +1,287 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPLUSPLUS_ASYNC_REDIS_H
+#define SEWENEW_REDISPLUSPLUS_ASYNC_REDIS_H
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "async_connection.h"
+#include "connection_pool.h"
+#include "command.h"
+#include "command_options.h"
+#include "reply.h"
+#include "utils.h"
+
+// AsyncRedis sends commands with a few non-blocking connections, which are driven
+// by an epoll based event loop running in a dedicated thread. Commands are
+// encoded with the same *cmd::* functions used by *Redis*, and each command
+// returns a *std::future*, or invokes a callback, when its reply arrives.
+//
+// All methods are thread-safe. Commands sent by a single thread with a single
+// connection, i.e. *ConnectionPoolOptions::size* is 1, are executed in order.
+//
+// Callbacks are called in the event loop thread, so they should be light-weight,
+// and NEVER block on a future of the same AsyncRedis object. The callback interface
+// is: void (std::future<Result> fut). Call *fut.get()* to get the result, or to
+// rethrow the exception if the command failed.
+//
+// NOTE: *ConnectionPoolOptions::size* is the number of connections, and other
+// pool options are ignored. If a connection is NOT established in
+// *ConnectionOptions::connect_timeout*, or receives nothing in *socket_timeout*
+// while waiting for replies, it's closed, and pending commands fail with
+// *TimeoutError*. Connections are created lazily, and reconnected automatically
+// after a failure.
+class AsyncRedis {
+public:
+    AsyncRedis(const ConnectionOptions &connection_opts,
+                const ConnectionPoolOptions &pool_opts = {});
+
+    // Construct AsyncRedis instance with URI:
+    // "tcp://127.0.0.1", "tcp://127.0.0.1:6379", or "unix://path/to/socket"
+    explicit AsyncRedis(const std::string &uri);
+
+    AsyncRedis(const AsyncRedis &) = delete;
+    AsyncRedis& operator=(const AsyncRedis &) = delete;
+
+    AsyncRedis(AsyncRedis &&) = default;
+
+    // Pending commands of this object fail with *Error*, as if it's destroyed.
+    AsyncRedis& operator=(AsyncRedis &&that);
+
+    // Stop the event loop, and pending commands fail with *Error*.
+    ~AsyncRedis();
+
+    template <typename Cmd, typename ...Args>
+    auto command(Cmd cmd, Args &&...args)
+        -> typename std::enable_if<!std::is_convertible<Cmd, StringView>::value,
+                                    std::future<ReplyUPtr>>::type {
+        return _command<ReplyUPtr>(cmd, std::forward<Args>(args)...);
+    }
+
+    template <typename ...Args>
+    std::future<ReplyUPtr> command(const StringView &cmd_name, Args &&...args) {
+        return _generic_command<ReplyUPtr>(cmd_name, std::forward<Args>(args)...);
+    }
+
+    template <typename Result, typename ...Args>
+    std::future<Result> command(const StringView &cmd_name, Args &&...args) {
+        return _generic_command<Result>(cmd_name, std::forward<Args>(args)...);
+    }
+
+    // CONNECTION commands.
+
+    std::future<std::string> ping() {
+        return _command<std::string, StatusParser>(
+                static_cast<void (*)(Connection &)>(cmd::ping));
+    }
+
+    template <typename Callback>
+    void ping(Callback &&cb) {
+        _callback_command<std::string, StatusParser>(std::forward<Callback>(cb),
+                static_cast<void (*)(Connection &)>(cmd::ping));
+    }
+
+    // KEY commands.
+
+    std::future<long long> del(const StringView &key) {
+        return _command<long long>(cmd::del, key);
+    }
+
+    template <typename Callback>
+    void del(const StringView &key, Callback &&cb) {
+        _callback_command<long long>(std::forward<Callback>(cb), cmd::del, key);
+    }
+
+    std::future<long long> exists(const StringView &key) {
+        return _command<long long>(cmd::exists, key);
+    }
+
+    template <typename Callback>
+    void exists(const StringView &key, Callback &&cb) {
+        _callback_command<long long>(std::forward<Callback>(cb), cmd::exists, key);
+    }
+
+    std::future<bool> expire(const StringView &key, const std::chrono::seconds &timeout) {
+        return _command<bool>(cmd::expire, key, timeout.count());
+    }
+
+    template <typename Callback>
+    void expire(const StringView &key, const std::chrono::seconds &timeout, Callback &&cb) {
+        _callback_command<bool>(std::forward<Callback>(cb), cmd::expire, key, timeout.count());
+    }
+
+    // STRING commands.
+
+    std::future<OptionalString> get(const StringView &key) {
+        return _command<OptionalString>(cmd::get, key);
+    }
+
+    template <typename Callback>
+    void get(const StringView &key, Callback &&cb) {
+        _callback_command<OptionalString>(std::forward<Callback>(cb), cmd::get, key);
+    }
+
+    std::future<long long> incr(const StringView &key) {
+        return _command<long long>(cmd::incr, key);
+    }
+
+    template <typename Callback>
+    void incr(const StringView &key, Callback &&cb) {
+        _callback_command<long long>(std::forward<Callback>(cb), cmd::incr, key);
+    }
+
+    std::future<long long> incrby(const StringView &key, long long increment) {
+        return _command<long long>(cmd::incrby, key, increment);
+    }
+
+    template <typename Callback>
+    void incrby(const StringView &key, long long increment, Callback &&cb) {
+        _callback_command<long long>(std::forward<Callback>(cb), cmd::incrby, key, increment);
+    }
+
+    std::future<bool> set(const StringView &key,
+                            const StringView &val,
+                            const std::chrono::milliseconds &ttl = std::chrono::milliseconds(0),
+                            UpdateType type = UpdateType::ALWAYS) {
+        return _command<bool, SetParser>(cmd::set, key, val, ttl.count(), type);
+    }
+
+    template <typename Callback>
+    void set(const StringView &key,
+                const StringView &val,
+                const std::chrono::milliseconds &ttl,
+                UpdateType type,
+                Callback &&cb) {
+        _callback_command<bool, SetParser>(std::forward<Callback>(cb),
+                                            cmd::set, key, val, ttl.count(), type);
+    }
+
+    // HASH commands.
+
+    std::future<OptionalString> hget(const StringView &key, const StringView &field) {
+        return _command<OptionalString>(cmd::hget, key, field);
+    }
+
+    template <typename Callback>
+    void hget(const StringView &key, const StringView &field, Callback &&cb) {
+        _callback_command<OptionalString>(std::forward<Callback>(cb), cmd::hget, key, field);
+    }
+
+    std::future<bool> hset(const StringView &key,
+                            const StringView &field,
+                            const StringView &val) {
+        return _command<bool>(cmd::hset, key, field, val);
+    }
+
+    template <typename Callback>
+    void hset(const StringView &key,
+                const StringView &field,
+                const StringView &val,
+                Callback &&cb) {
+        _callback_command<bool>(std::forward<Callback>(cb), cmd::hset, key, field, val);
+    }
+
+    // PUBSUB commands.
+
+    std::future<long long> publish(const StringView &channel, const StringView &message) {
+        return _command<long long>(cmd::publish, channel, message);
+    }
+
+    template <typename Callback>
+    void publish(const StringView &channel, const StringView &message, Callback &&cb) {
+        _callback_command<long long>(std::forward<Callback>(cb),
+                                        cmd::publish, channel, message);
+    }
+
+private:
+    struct StatusParser {
+        std::string operator()(redisReply &reply) const {
+            return reply::to_status(reply);
+        }
+    };
+
+    struct SetParser {
+        bool operator()(redisReply &reply) const {
+            reply::rewrite_set_reply(reply);
+
+            return reply::parse<bool>(reply);
+        }
+    };
+
+    template <typename Result, typename Parser = DefaultReplyParser<Result>,
+                typename Cmd, typename ...Args>
+    std::future<Result> _command(Cmd cmd, Args &&...args);
+
+    template <typename Result, typename Parser = DefaultReplyParser<Result>,
+                typename Callback, typename Cmd, typename ...Args>
+    void _callback_command(Callback &&cb, Cmd cmd, Args &&...args);
+
+    template <typename Result, typename ...Args>
+    std::future<Result> _generic_command(const StringView &cmd_name, Args &&...args);
+
+    AsyncConnection& _connection();
+
+    // Stop the loop, and fail pending commands.
+    void _close();
+
+    // The loop MUST be destroyed before the connections,
+    // since the loop thread accesses them.
+    std::vector<std::unique_ptr<AsyncConnection>> _connections;
+
+    std::unique_ptr<EventLoop> _loop;
+
+    std::unique_ptr<std::atomic<std::size_t>> _next_connection;
+};
+
+// Inline implementations.
+
+template <typename Result, typename Parser, typename Cmd, typename ...Args>
+std::future<Result> AsyncRedis::_command(Cmd cmd, Args &&...args) {
+    std::unique_ptr<FutureEvent<Result, Parser>> event(new FutureEvent<Result, Parser>);
+
+    auto fut = event->get_future();
+
+    _connection().send(std::move(event), cmd, std::forward<Args>(args)...);
+
+    return fut;
+}
+
+template <typename Result, typename Parser, typename Callback, typename Cmd, typename ...Args>
+void AsyncRedis::_callback_command(Callback &&cb, Cmd cmd, Args &&...args) {
+    using Event = CallbackEvent<Result, typename std::decay<Callback>::type, Parser>;
+
+    AsyncEventUPtr event(new Event(std::forward<Callback>(cb)));
+
+    _connection().send(std::move(event), cmd, std::forward<Args>(args)...);
+}
+
+template <typename Result, typename ...Args>
+std::future<Result> AsyncRedis::_generic_command(const StringView &cmd_name, Args &&...args) {
+    auto cmd = [](Connection &connection, const StringView &cmd_name, Args &&...args) {
+                    CmdArgs cmd_args;
+                    cmd_args.append(cmd_name, std::forward<Args>(args)...);
+                    connection.send(cmd_args);
+    };
+
+    return _command<Result>(cmd, cmd_name, std::forward<Args>(args)...);
+}
+
+#endif // end SEWENEW_REDISPLUSPLUS_ASYNC_REDIS_H
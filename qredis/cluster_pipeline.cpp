@@ -0,0 +1,244 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "cluster_pipeline.h"
+#include <cstdlib>
+#include <numeric>
+#include "errors.h"
+#include "shards.h"
+
+namespace {
+
+// Name of a formatted command, i.e. its first bulk string.
+StringView formatted_command_name(const std::string &data) {
+    auto begin = data.find("\r\n$");
+    if (begin == std::string::npos) {
+        return {};
+    }
+
+    auto end = data.find("\r\n", begin + 3);
+    if (end == std::string::npos) {
+        return {};
+    }
+
+    auto len = std::strtoull(data.c_str() + begin + 3, nullptr, 10);
+    if (end + 2 + len > data.size()) {
+        return {};
+    }
+
+    return StringView(data.data() + end + 2, len);
+}
+
+}
+
+ClusterPipeline::~ClusterPipeline() {
+    try {
+        discard();
+    } catch (const Error &) {
+        // Avoid throwing in destructor.
+    }
+}
+
+QueuedReplies ClusterPipeline::exec() {
+    std::vector<ReplyUPtr> replies(_cmds.size());
+
+    std::vector<std::size_t> pending(_cmds.size());
+    std::iota(pending.begin(), pending.end(), 0);
+
+    std::vector<std::pair<std::size_t, Node>> asks;
+
+    // The first error we got.
+    std::exception_ptr err;
+
+    try {
+        _send(replies, pending, asks, err);
+    } catch (const Error &) {
+        _reset();
+        throw;
+    }
+
+    auto set_cmd_indexes = std::move(_set_cmd_indexes);
+
+    _reset();
+
+    if (err) {
+        std::rethrow_exception(err);
+    }
+
+    for (auto idx : set_cmd_indexes) {
+        reply::rewrite_set_reply(*replies[idx]);
+    }
+
+    return QueuedReplies(std::move(replies));
+}
+
+void ClusterPipeline::discard() {
+    _reset();
+}
+
+std::string ClusterPipeline::_take_formatted() {
+    auto *ctx = _formatter._context();
+
+    // The formatter is never written, and it always copies arguments.
+    assert(ctx->opos == 0 && ctx->orefslen == 0);
+
+    std::string data(ctx->obuf, sdslen(ctx->obuf));
+
+    _formatter.clear_output();
+
+    return data;
+}
+
+void ClusterPipeline::_send(std::vector<ReplyUPtr> &replies,
+                            std::vector<std::size_t> &failed,
+                            std::vector<std::pair<std::size_t, Node>> &asks,
+                            std::exception_ptr &err) {
+    // Send once, and then retry at most 2 times, same as *RedisCluster::_command*.
+    // Connections are fetched in a global order, and returned before the next round,
+    // so that we never wait for a connection while holding connections of other
+    // nodes in a different order.
+    for (auto round = 0; round < 3 && !failed.empty(); ++round) {
+        std::vector<std::size_t> retries;
+        retries.swap(failed);
+
+        std::vector<Slot> slots;
+        slots.reserve(retries.size());
+        for (auto idx : retries) {
+            slots.push_back(_cmds[idx].slot);
+        }
+
+        std::vector<std::size_t> owners;
+        auto connections = _pool.fetch(slots, owners);
+
+        std::vector<bool> broken(connections.size(), false);
+        for (std::size_t idx = 0; idx != retries.size(); ++idx) {
+            auto owner = owners[idx];
+            if (broken[owner]) {
+                continue;
+            }
+
+            auto &connection = connections[owner].connection();
+            if (!_append(connection, retries[idx])) {
+                // Commands of this node are all retried, so drop those appended before.
+                connection.clear_output();
+                connection.invalidate();
+                broken[owner] = true;
+            }
+        }
+
+        for (std::size_t idx = 0; idx != connections.size(); ++idx) {
+            try {
+                if (!broken[idx]) {
+                    connections[idx].connection().flush();
+                }
+            } catch (const Error &) {
+                broken[idx] = true;
+            }
+        }
+
+        bool need_update = false;
+        for (std::size_t idx = 0; idx != retries.size(); ++idx) {
+            auto cmd_idx = retries[idx];
+            auto owner = owners[idx];
+            if (broken[owner]) {
+                failed.push_back(cmd_idx);
+                continue;
+            }
+
+            try {
+                replies[cmd_idx] = connections[owner].connection().recv();
+            } catch (const MovedError &e) {
+                _pool.update(e.slot(), e.node());
+                failed.push_back(cmd_idx);
+            } catch (const AskError &e) {
+                asks.emplace_back(cmd_idx, e.node());
+            } catch (const IoError &) {
+                broken[owner] = true;
+                need_update = true;
+                failed.push_back(cmd_idx);
+            } catch (const ClosedError &) {
+                broken[owner] = true;
+                need_update = true;
+                failed.push_back(cmd_idx);
+            } catch (const Error &) {
+                if (!err) {
+                    err = std::current_exception();
+                }
+            }
+        }
+
+        connections.clear();
+
+        if (need_update) {
+            _pool.update();
+        }
+    }
+
+    // ASK errors are rare, so re-send them one by one.
+    for (const auto &ask : asks) {
+        try {
+            replies[ask.first] = _ask(ask.first, ask.second);
+        } catch (const Error &) {
+            if (!err) {
+                err = std::current_exception();
+            }
+        }
+    }
+
+    if (!failed.empty() && !err) {
+        err = std::make_exception_ptr(Error("Failed to send "
+                    + std::to_string(failed.size()) + " commands in cluster pipeline"));
+    }
+}
+
+ReplyUPtr ClusterPipeline::_ask(std::size_t idx, const Node &node) {
+    auto guarded_connection = _pool.fetch(node);
+    auto &connection = guarded_connection.connection();
+
+    connection.send("ASKING");
+
+    if (!_append(connection, idx)) {
+        throw_error(*connection._context(), "Failed to send command");
+    }
+
+    reply::parse<void>(*connection.recv());
+
+    try {
+        return connection.recv();
+    } catch (const MovedError &) {
+        throw Error("Slot migrating... ASKING node hasn't been set to IMPORTING state");
+    }
+}
+
+bool ClusterPipeline::_append(Connection &connection, std::size_t idx) {
+    const auto &data = _cmds[idx].data;
+    if (redisAppendFormattedCommand(connection._context(),
+                                    data.data(),
+                                    data.size()) != REDIS_OK) {
+        return false;
+    }
+
+    if (connection._metrics) {
+        connection._metrics->sent(formatted_command_name(data));
+    }
+
+    return true;
+}
+
+void ClusterPipeline::_reset() {
+    _cmds.clear();
+    _set_cmd_indexes.clear();
+}
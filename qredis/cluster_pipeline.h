@@ -0,0 +1,255 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPLUSPLUS_CLUSTER_PIPELINE_H
+#define SEWENEW_REDISPLUSPLUS_CLUSTER_PIPELINE_H
+
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "connection.h"
+#include "command.h"
+#include "command_options.h"
+#include "queued_redis.h"
+#include "shards_pool.h"
+#include "utils.h"
+
+// A pipeline for Redis Cluster, which accepts commands with arbitrary keys.
+// Commands are formatted and queued in the pipeline itself, so that it holds no
+// connection until *exec*. *exec* buckets commands by node, fetches one connection
+// per node in a global order, i.e. the same as *RedisCluster::mget*, and flushes
+// all buckets before reading any reply. Replies are returned in the order that
+// commands were added. Commands redirected with MOVED or ASK error are re-sent to
+// the right node.
+//
+// Unlike *Pipeline*, an error reply DOES NOT invalidate the ClusterPipeline.
+// *exec* reads all replies, and then throws the first error.
+//
+// NOTE: The RedisCluster object MUST outlive the ClusterPipeline, and NOT be moved.
+// ClusterPipeline is NOT thread-safe.
+class ClusterPipeline {
+public:
+    ClusterPipeline(const ClusterPipeline &) = delete;
+    ClusterPipeline& operator=(const ClusterPipeline &) = delete;
+
+    ClusterPipeline(ClusterPipeline &&) = default;
+    ClusterPipeline& operator=(ClusterPipeline &&) = delete;
+
+    // Commands that have NOT been executed are discarded.
+    ~ClusterPipeline();
+
+    // Send command with key. *cmd* is called as: cmd(connection, key, args...).
+    template <typename Cmd, typename ...Args>
+    auto command(Cmd cmd, const StringView &key, Args &&...args)
+        -> typename std::enable_if<!std::is_convertible<Cmd, StringView>::value,
+                                    ClusterPipeline&>::type;
+
+    // Send command with name, the first argument is the key.
+    template <typename ...Args>
+    ClusterPipeline& command(const StringView &cmd_name, const StringView &key, Args &&...args);
+
+    QueuedReplies exec();
+
+    void discard();
+
+    std::size_t size() const {
+        return _cmds.size();
+    }
+
+    // KEY commands.
+
+    ClusterPipeline& del(const StringView &key) {
+        return command(cmd::del, key);
+    }
+
+    ClusterPipeline& exists(const StringView &key) {
+        return command(cmd::exists, key);
+    }
+
+    ClusterPipeline& expire(const StringView &key, long long timeout) {
+        return command(cmd::expire, key, timeout);
+    }
+
+    ClusterPipeline& expire(const StringView &key, const std::chrono::seconds &timeout) {
+        return expire(key, timeout.count());
+    }
+
+    ClusterPipeline& ttl(const StringView &key) {
+        return command(cmd::ttl, key);
+    }
+
+    // STRING commands.
+
+    ClusterPipeline& decr(const StringView &key) {
+        return command(cmd::decr, key);
+    }
+
+    ClusterPipeline& get(const StringView &key) {
+        return command(cmd::get, key);
+    }
+
+    ClusterPipeline& incr(const StringView &key) {
+        return command(cmd::incr, key);
+    }
+
+    ClusterPipeline& incrby(const StringView &key, long long increment) {
+        return command(cmd::incrby, key, increment);
+    }
+
+    ClusterPipeline& set(const StringView &key,
+                            const StringView &val,
+                            const std::chrono::milliseconds &ttl = std::chrono::milliseconds(0),
+                            UpdateType type = UpdateType::ALWAYS) {
+        command(cmd::set, key, val, ttl.count(), type);
+
+        _set_cmd_indexes.push_back(_cmds.size() - 1);
+
+        return *this;
+    }
+
+    // HASH commands.
+
+    ClusterPipeline& hdel(const StringView &key, const StringView &field) {
+        return command(cmd::hdel, key, field);
+    }
+
+    ClusterPipeline& hget(const StringView &key, const StringView &field) {
+        return command(cmd::hget, key, field);
+    }
+
+    ClusterPipeline& hgetall(const StringView &key) {
+        return command(cmd::hgetall, key);
+    }
+
+    ClusterPipeline& hincrby(const StringView &key, const StringView &field, long long increment) {
+        return command(cmd::hincrby, key, field, increment);
+    }
+
+    ClusterPipeline& hset(const StringView &key, const StringView &field, const StringView &val) {
+        return command(cmd::hset, key, field, val);
+    }
+
+    // LIST commands.
+
+    ClusterPipeline& llen(const StringView &key) {
+        return command(cmd::llen, key);
+    }
+
+    ClusterPipeline& lpush(const StringView &key, const StringView &val) {
+        return command(cmd::lpush, key, val);
+    }
+
+    ClusterPipeline& lrange(const StringView &key, long long start, long long stop) {
+        return command(cmd::lrange, key, start, stop);
+    }
+
+    ClusterPipeline& rpush(const StringView &key, const StringView &val) {
+        return command(cmd::rpush, key, val);
+    }
+
+    // SET commands.
+
+    ClusterPipeline& sadd(const StringView &key, const StringView &member) {
+        return command(cmd::sadd, key, member);
+    }
+
+    ClusterPipeline& smembers(const StringView &key) {
+        return command(cmd::smembers, key);
+    }
+
+    ClusterPipeline& srem(const StringView &key, const StringView &member) {
+        return command(cmd::srem, key, member);
+    }
+
+private:
+    friend class RedisCluster;
+
+    explicit ClusterPipeline(ShardsPool &pool) :
+                                _pool(pool),
+                                _formatter(ConnectionOptions{}, Connection::Detached{}) {}
+
+    // A queued command, and its formatted bytes, which are used to re-send it.
+    struct QueuedCommand {
+        Slot slot;
+        std::string data;
+    };
+
+    // Take the command formatted by *_formatter*.
+    std::string _take_formatted();
+
+    // Send commands in *failed*, i.e. those without a reply, and re-send those
+    // redirected by MOVED error, or failed with IO error.
+    void _send(std::vector<ReplyUPtr> &replies,
+                std::vector<std::size_t> &failed,
+                std::vector<std::pair<std::size_t, Node>> &asks,
+                std::exception_ptr &err);
+
+    // Re-send a command redirected by ASK error.
+    ReplyUPtr _ask(std::size_t idx, const Node &node);
+
+    // Append a queued command to the output buffer, and return false on failure.
+    bool _append(Connection &connection, std::size_t idx);
+
+    void _reset();
+
+    ShardsPool &_pool;
+
+    // Never connected, and only used to format commands.
+    Connection _formatter;
+
+    std::vector<QueuedCommand> _cmds;
+
+    std::vector<std::size_t> _set_cmd_indexes;
+};
+
+// Inline implementations.
+
+template <typename Cmd, typename ...Args>
+auto ClusterPipeline::command(Cmd cmd, const StringView &key, Args &&...args)
+    -> typename std::enable_if<!std::is_convertible<Cmd, StringView>::value,
+                                ClusterPipeline&>::type {
+    auto slot = _pool.slot(key);
+
+    try {
+        cmd(_formatter, key, std::forward<Args>(args)...);
+    } catch (const Error &e) {
+        _formatter.clear_output();
+        throw;
+    }
+
+    _cmds.push_back(QueuedCommand{slot, _take_formatted()});
+
+    return *this;
+}
+
+template <typename ...Args>
+ClusterPipeline& ClusterPipeline::command(const StringView &cmd_name,
+                                            const StringView &key,
+                                            Args &&...args) {
+    auto cmd = [](Connection &connection,
+                    const StringView &key,
+                    const StringView &cmd_name,
+                    Args &&...args) {
+                    CmdArgs cmd_args;
+                    cmd_args.append(cmd_name, key, std::forward<Args>(args)...);
+                    connection.send(cmd_args);
+    };
+
+    return command(cmd, key, cmd_name, std::forward<Args>(args)...);
+}
+
+#endif // end SEWENEW_REDISPLUSPLUS_CLUSTER_PIPELINE_H
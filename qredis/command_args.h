@@ -17,14 +17,36 @@
 #ifndef SEWENEW_REDISPLUSPLUS_COMMAND_ARGS_H
 #define SEWENEW_REDISPLUSPLUS_COMMAND_ARGS_H
 
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <memory>
 #include <vector>
-#include <list>
 #include <string>
 #include <tuple>
+#include <type_traits>
+#include "errors.h"
 #include "utils.h"
 
+// Arguments of a command. Arguments that need to be copied, e.g. numbers and
+// std::string, are stored in an inline buffer, and overflow to heap allocated
+// chunks, which are never reallocated. So a typical command, e.g.
+// SET key val PX ttl, is built without heap allocation.
+//
+// CmdArgs CANNOT be copied or moved, since *argv* points into itself.
 class CmdArgs {
 public:
+    CmdArgs() = default;
+
+    CmdArgs(const CmdArgs &) = delete;
+    CmdArgs& operator=(const CmdArgs &) = delete;
+
+    CmdArgs(CmdArgs &&) = delete;
+    CmdArgs& operator=(CmdArgs &&) = delete;
+
+    ~CmdArgs() = default;
+
     template <typename Arg>
     CmdArgs& append(Arg &&arg);
 
@@ -53,20 +75,23 @@ public:
         typename std::enable_if<N < sizeof...(Args), CmdArgs&>::type;
 
     const char** argv() {
-        return _argv.data();
+        return _argv.empty() ? _inline_argv : _argv.data();
     }
 
     const std::size_t* argv_len() {
-        return _argv_len.data();
+        return _argv_len.empty() ? _inline_argv_len : _argv_len.data();
     }
 
     std::size_t size() const {
-        return _argv.size();
+        return _size;
     }
 
+    // Whether *arg* points into memory owned by CmdArgs, i.e. a copied argument.
+    bool owns(const char *arg) const;
+
 private:
     // Deep copy.
-    CmdArgs& _append(std::string arg);
+    CmdArgs& _append(const std::string &arg);
 
     // Shallow copy.
     CmdArgs& _append(const StringView &arg);
@@ -87,10 +112,53 @@ private:
     template <typename Iter>
     CmdArgs& _append(std::false_type, const std::pair<Iter, Iter> &range);
 
+    // Same output as std::to_string.
+    CmdArgs& _format(long long arg);
+
+    CmdArgs& _format(unsigned long long arg);
+
+    CmdArgs& _format(double arg);
+
+    CmdArgs& _format(long double arg);
+
+    // Write digits of *arg* backwards, and return the beginning.
+    static char* _format_digits(unsigned long long arg, char *end);
+
+    // Copy *size* bytes into the arena, and append them as an argument.
+    CmdArgs& _copy(const char *data, std::size_t size);
+
+    // Allocate *size* bytes in the arena.
+    char* _alloc(std::size_t size);
+
+    static const std::size_t INLINE_ARGS = 8;
+
+    static const std::size_t INLINE_BYTES = 128;
+
+    static const std::size_t MIN_CHUNK_SIZE = 1024;
+
+    std::size_t _size = 0;
+
+    const char *_inline_argv[INLINE_ARGS];
+    std::size_t _inline_argv_len[INLINE_ARGS];
+
+    // Only used when there're more than *INLINE_ARGS* arguments.
     std::vector<const char *> _argv;
     std::vector<std::size_t> _argv_len;
 
-    std::list<std::string> _args;
+    char _inline_buf[INLINE_BYTES];
+
+    // Free space of the current buffer, i.e. either *_inline_buf* or the last chunk.
+    char *_buf = _inline_buf;
+    std::size_t _buf_left = INLINE_BYTES;
+
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Chunk> _chunks;
+
+    std::size_t _chunk_size = MIN_CHUNK_SIZE;
 };
 
 template <typename Arg>
@@ -106,8 +174,23 @@ inline CmdArgs& CmdArgs::append(Arg &&arg, Args &&...args) {
 }
 
 inline CmdArgs& CmdArgs::operator<<(const StringView &arg) {
-    _argv.push_back(arg.data());
-    _argv_len.push_back(arg.size());
+    if (_size < INLINE_ARGS) {
+        _inline_argv[_size] = arg.data();
+        _inline_argv_len[_size] = arg.size();
+    } else {
+        if (_argv.empty()) {
+            _argv.reserve(INLINE_ARGS * 2);
+            _argv.assign(_inline_argv, _inline_argv + INLINE_ARGS);
+
+            _argv_len.reserve(INLINE_ARGS * 2);
+            _argv_len.assign(_inline_argv_len, _inline_argv_len + INLINE_ARGS);
+        }
+
+        _argv.push_back(arg.data());
+        _argv_len.push_back(arg.size());
+    }
+
+    ++_size;
 
     return *this;
 }
@@ -121,7 +204,18 @@ template <typename T,
              typename std::enable_if<std::is_arithmetic<typename std::decay<T>::type>::value,
                                     int>::type>
 inline CmdArgs& CmdArgs::operator<<(T &&arg) {
-    return _append(std::to_string(std::forward<T>(arg)));
+    using Type = typename std::decay<T>::type;
+
+    // Format it with the widest type of the same kind, e.g. int -> long long.
+    using FormatType = typename std::conditional<std::is_floating_point<Type>::value,
+                            typename std::conditional<std::is_same<Type, long double>::value,
+                                                        long double,
+                                                        double>::type,
+                            typename std::conditional<std::is_signed<Type>::value,
+                                                        long long,
+                                                        unsigned long long>::type>::type;
+
+    return _format(static_cast<FormatType>(arg));
 }
 
 template <std::size_t N, typename ...Args>
@@ -132,9 +226,8 @@ auto CmdArgs::operator<<(const std::tuple<Args...> &arg) ->
     return operator<<<N + 1, Args...>(arg);
 }
 
-inline CmdArgs& CmdArgs::_append(std::string arg) {
-    _args.push_back(std::move(arg));
-    return operator<<(_args.back());
+inline CmdArgs& CmdArgs::_append(const std::string &arg) {
+    return _copy(arg.data(), arg.size());
 }
 
 inline CmdArgs& CmdArgs::_append(const StringView &arg) {
@@ -169,4 +262,139 @@ CmdArgs& CmdArgs::_append(std::true_type, const std::pair<Iter, Iter> &range) {
     return *this;
 }
 
+inline bool CmdArgs::owns(const char *arg) const {
+    // std::less gives a total order of pointers, even if they point into different objects.
+    std::less<const char *> less;
+    auto within = [&less, arg](const char *begin, std::size_t size) {
+        return !less(arg, begin) && less(arg, begin + size);
+    };
+
+    if (within(_inline_buf, INLINE_BYTES)) {
+        return true;
+    }
+
+    for (const auto &chunk : _chunks) {
+        if (within(chunk.data.get(), chunk.size)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+inline CmdArgs& CmdArgs::_format(long long arg) {
+    // Enough for -9223372036854775808.
+    char buf[24];
+    auto *end = buf + sizeof(buf);
+
+    // Negate in unsigned arithmetic, so that LLONG_MIN doesn't overflow.
+    auto val = static_cast<unsigned long long>(arg);
+    auto *begin = _format_digits(arg < 0 ? 0 - val : val, end);
+    if (arg < 0) {
+        *--begin = '-';
+    }
+
+    return _copy(begin, end - begin);
+}
+
+inline CmdArgs& CmdArgs::_format(unsigned long long arg) {
+    char buf[24];
+    auto *end = buf + sizeof(buf);
+    auto *begin = _format_digits(arg, end);
+
+    return _copy(begin, end - begin);
+}
+
+inline CmdArgs& CmdArgs::_format(double arg) {
+    char buf[64];
+    auto len = std::snprintf(buf, sizeof(buf), "%f", arg);
+    if (len < 0) {
+        throw Error("Failed to format double");
+    }
+
+    if (static_cast<std::size_t>(len) < sizeof(buf)) {
+        return _copy(buf, len);
+    }
+
+    // Very large number.
+    auto *data = _alloc(len + 1);
+    std::snprintf(data, len + 1, "%f", arg);
+
+    return *this << StringView(data, len);
+}
+
+inline CmdArgs& CmdArgs::_format(long double arg) {
+    char buf[64];
+    auto len = std::snprintf(buf, sizeof(buf), "%Lf", arg);
+    if (len < 0) {
+        throw Error("Failed to format long double");
+    }
+
+    if (static_cast<std::size_t>(len) < sizeof(buf)) {
+        return _copy(buf, len);
+    }
+
+    auto *data = _alloc(len + 1);
+    std::snprintf(data, len + 1, "%Lf", arg);
+
+    return *this << StringView(data, len);
+}
+
+inline char* CmdArgs::_format_digits(unsigned long long arg, char *end) {
+    static const char DIGITS[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    // Two digits at a time.
+    auto *p = end;
+    while (arg >= 100) {
+        auto idx = (arg % 100) * 2;
+        arg /= 100;
+        *--p = DIGITS[idx + 1];
+        *--p = DIGITS[idx];
+    }
+
+    if (arg >= 10) {
+        auto idx = arg * 2;
+        *--p = DIGITS[idx + 1];
+        *--p = DIGITS[idx];
+    } else {
+        *--p = static_cast<char>('0' + arg);
+    }
+
+    return p;
+}
+
+inline CmdArgs& CmdArgs::_copy(const char *data, std::size_t size) {
+    auto *buf = _alloc(size);
+    if (size > 0) {
+        std::memcpy(buf, data, size);
+    }
+
+    return *this << StringView(buf, size);
+}
+
+inline char* CmdArgs::_alloc(std::size_t size) {
+    if (size > _buf_left) {
+        // Leave the free space of the current buffer unused, and never reallocate
+        // a chunk, so that arguments appended before are still valid.
+        auto chunk_size = std::max(size, _chunk_size);
+        _chunks.push_back(Chunk{std::unique_ptr<char[]>(new char[chunk_size]), chunk_size});
+
+        _buf = _chunks.back().data.get();
+        _buf_left = chunk_size;
+
+        _chunk_size *= 2;
+    }
+
+    auto *buf = _buf;
+    _buf += size;
+    _buf_left -= size;
+
+    return buf;
+}
+
 #endif // end SEWENEW_REDISPLUSPLUS_COMMAND_ARGS_H
@@ -16,6 +16,8 @@
 
 #include "connection.h"
 #include <cassert>
+#include <cstring>
+#include <vector>
 #include "reply.h"
 #include "command.h"
 #include "command_args.h"
@@ -87,13 +89,21 @@ public:
 
     ContextUPtr connect() const;
 
+    ContextUPtr connect_nonblock() const;
+
+    ContextUPtr connect_detached() const;
+
 private:
-    ContextUPtr _connect() const;
+    ContextUPtr _connect(bool blocking) const;
 
     redisContext* _connect_tcp() const;
 
     redisContext* _connect_unix() const;
 
+    redisContext* _connect_tcp_nonblock() const;
+
+    redisContext* _connect_unix_nonblock() const;
+
     void _set_socket_timeout(redisContext &ctx) const;
 
     void _enable_keep_alive(redisContext &ctx) const;
@@ -106,7 +116,7 @@ private:
 Connection::Connector::Connector(const ConnectionOptions &opts) : _opts(opts) {}
 
 Connection::ContextUPtr Connection::Connector::connect() const {
-    auto ctx = _connect();
+    auto ctx = _connect(true);
 
     assert(ctx);
 
@@ -121,15 +131,45 @@ Connection::ContextUPtr Connection::Connector::connect() const {
     return ctx;
 }
 
-Connection::ContextUPtr Connection::Connector::_connect() const {
+Connection::ContextUPtr Connection::Connector::connect_nonblock() const {
+    auto ctx = _connect(false);
+
+    assert(ctx);
+
+    if (ctx->err != REDIS_OK) {
+        throw_error(*ctx, "Failed to connect to Redis");
+    }
+
+    // Socket timeout only makes sense for blocking socket.
+
+    _enable_keep_alive(*ctx);
+
+    return ctx;
+}
+
+Connection::ContextUPtr Connection::Connector::connect_detached() const {
+    redisOptions options;
+    std::memset(&options, 0, sizeof(options));
+    options.type = REDIS_CONN_USERFD;
+    options.endpoint.fd = -1;
+
+    ContextUPtr ctx(redisConnectWithOptions(&options));
+    if (!ctx) {
+        throw Error("Failed to allocate memory for connection.");
+    }
+
+    return ctx;
+}
+
+Connection::ContextUPtr Connection::Connector::_connect(bool blocking) const {
     redisContext *context = nullptr;
     switch (_opts.type) {
     case ConnectionType::TCP:
-        context = _connect_tcp();
+        context = blocking ? _connect_tcp() : _connect_tcp_nonblock();
         break;
 
     case ConnectionType::UNIX:
-        context = _connect_unix();
+        context = blocking ? _connect_unix() : _connect_unix_nonblock();
         break;
 
     default:
@@ -141,6 +181,14 @@ Connection::ContextUPtr Connection::Connector::_connect() const {
         throw Error("Failed to allocate memory for connection.");
     }
 
+    if (context->reader != nullptr) {
+        if (_opts.reply_arena) {
+            redisReaderUseArena(context->reader);
+        }
+
+        context->reader->maxbuf = _opts.reader_max_buf;
+    }
+
     return ContextUPtr(context);
 }
 
@@ -164,6 +212,14 @@ redisContext* Connection::Connector::_connect_unix() const {
     }
 }
 
+redisContext* Connection::Connector::_connect_tcp_nonblock() const {
+    return redisConnectNonBlock(_opts.host.c_str(), _opts.port);
+}
+
+redisContext* Connection::Connector::_connect_unix_nonblock() const {
+    return redisConnectUnixNonBlock(_opts.path.c_str());
+}
+
 void Connection::Connector::_set_socket_timeout(redisContext &ctx) const {
     if (_opts.socket_timeout <= std::chrono::milliseconds(0)) {
         return;
@@ -198,6 +254,9 @@ void swap(Connection &lhs, Connection &rhs) noexcept {
     std::swap(lhs._ctx, rhs._ctx);
     std::swap(lhs._last_active, rhs._last_active);
     std::swap(lhs._opts, rhs._opts);
+    std::swap(lhs._invalid, rhs._invalid);
+    std::swap(lhs._zero_copy, rhs._zero_copy);
+    std::swap(lhs._metrics, rhs._metrics);
 }
 
 Connection::Connection(const ConnectionOptions &opts) :
@@ -206,13 +265,37 @@ Connection::Connection(const ConnectionOptions &opts) :
             _opts(opts) {
     assert(_ctx && !broken());
 
+    if (_opts.metrics) {
+        auto node = _opts.type == ConnectionType::TCP ?
+                        _opts.host + ":" + std::to_string(_opts.port) : _opts.path;
+        _metrics.reset(new ConnectionMetrics(*_opts.metrics, std::move(node)));
+    }
+
     _set_options();
 }
 
+Connection::Connection(const ConnectionOptions &opts, NonBlocking) :
+            _ctx(Connector(opts).connect_nonblock()),
+            _last_active(std::chrono::steady_clock::now()),
+            _opts(opts) {
+    assert(_ctx && !broken());
+}
+
+Connection::Connection(const ConnectionOptions &opts, Detached) :
+            _ctx(Connector(opts).connect_detached()),
+            _last_active(std::chrono::steady_clock::now()),
+            _opts(opts) {
+    assert(_ctx && !broken());
+}
+
 void Connection::reconnect() {
     Connection connection(_opts);
 
     swap(*this, connection);
+
+    if (_metrics) {
+        _metrics->reconnected();
+    }
 }
 
 void Connection::send(int argc, const char **argv, const std::size_t *argv_len) {
@@ -227,6 +310,10 @@ void Connection::send(int argc, const char **argv, const std::size_t *argv_len)
         throw_error(*ctx, "Failed to send command");
     }
 
+    if (_metrics && argc > 0) {
+        _metrics->sent(StringView(argv[0], argv_len[0]));
+    }
+
     assert(!broken());
 }
 
@@ -235,13 +322,58 @@ void Connection::send(CmdArgs &args) {
 
     assert(ctx != nullptr);
 
-    if (redisAppendCommandArgv(ctx,
-                                args.size(),
-                                args.argv(),
-                                args.argv_len()) != REDIS_OK) {
+    // Arguments copied into *args* are destroyed with it, so they're always copied.
+    std::vector<char> refs;
+    if (_zero_copy && _opts.zero_copy_threshold > 0) {
+        auto *argv = args.argv();
+        auto *argv_len = args.argv_len();
+        for (std::size_t idx = 0; idx != args.size(); ++idx) {
+            if (argv_len[idx] >= _opts.zero_copy_threshold && !args.owns(argv[idx])) {
+                refs.resize(args.size(), 0);
+                refs[idx] = 1;
+            }
+        }
+    }
+
+    if (redisAppendCommandArgvRef(ctx,
+                                    args.size(),
+                                    args.argv(),
+                                    args.argv_len(),
+                                    refs.empty() ? nullptr : refs.data()) != REDIS_OK) {
         throw_error(*ctx, "Failed to send command");
     }
 
+    if (_metrics && args.size() > 0) {
+        _metrics->sent(StringView(args.argv()[0], args.argv_len()[0]));
+    }
+
+    assert(!broken());
+}
+
+void Connection::clear_output() {
+    auto *ctx = _context();
+
+    assert(ctx != nullptr);
+
+    redisClearOutput(ctx);
+
+    if (_metrics) {
+        _metrics->reset();
+    }
+}
+
+void Connection::flush() {
+    auto *ctx = _context();
+
+    assert(ctx != nullptr);
+
+    int done = 0;
+    while (!done) {
+        if (redisBufferWrite(ctx, &done) != REDIS_OK) {
+            throw_error(*ctx, "Failed to send command");
+        }
+    }
+
     assert(!broken());
 }
 
@@ -250,26 +382,112 @@ ReplyUPtr Connection::recv() {
 
     assert(ctx != nullptr);
 
-    void *r = nullptr;
-    if (redisGetReply(ctx, &r) != REDIS_OK) {
-        throw_error(*ctx, "Failed to get reply");
+    ReplyUPtr reply;
+    while (true) {
+        void *r = nullptr;
+        if (redisGetReply(ctx, &r) != REDIS_OK) {
+            throw_error(*ctx, "Failed to get reply");
+        }
+
+        assert(!broken() && r != nullptr);
+
+        reply = ReplyUPtr(static_cast<redisReply*>(r));
+
+        if (reply::is_push(*reply) && _opts.push_handler) {
+            try {
+                _opts.push_handler(*reply);
+            } catch (...) {
+                // Ignore exceptions thrown by user callbacks, and keep reading the reply.
+            }
+
+            continue;
+        }
+
+        if (reply::is_attribute(*reply)) {
+            // Attributes are auxiliary data of the next reply, and we don't support them.
+            continue;
+        }
+
+        break;
     }
 
-    assert(!broken() && r != nullptr);
+    auto is_error = reply::is_error(*reply);
 
-    auto reply = ReplyUPtr(static_cast<redisReply*>(r));
+    if (_metrics) {
+        _metrics->received(*ctx, is_error, StringView(reply->str, is_error ? reply->len : 0));
+    }
 
-    if (reply::is_error(*reply)) {
+    if (is_error) {
         throw_error(*reply);
     }
 
     return reply;
 }
 
+ReplyViewUPtr Connection::recv_view() {
+    auto *ctx = _context();
+
+    assert(ctx != nullptr);
+
+    ReplyViewUPtr reply;
+    {
+        ReplyViewReader reader(*ctx);
+
+        // Skip attributes, and push messages if they're handled out-of-band.
+        reply = reader.recv();
+        while (reply->type() == REDIS_REPLY_ATTR
+                || (reply->type() == REDIS_REPLY_PUSH && _opts.push_handler)) {
+            reply = reader.recv();
+        }
+    }
+
+    if (_metrics) {
+        _metrics->received(*ctx, reply->is_error(), reply->is_error() ? reply->str() : StringView{});
+    }
+
+    if (reply->is_error()) {
+        auto err = reply->str();
+        throw_error(std::string(err.data(), err.size()));
+    }
+
+    return reply;
+}
+
+void Connection::recv_stream(ReplySink &sink) {
+    auto *ctx = _context();
+
+    assert(ctx != nullptr);
+
+    ReplyStreamReader reader(*ctx, sink);
+
+    try {
+        reader.recv();
+    } catch (const IoError &) {
+        throw;
+    } catch (const ClosedError &) {
+        throw;
+    } catch (const Error &e) {
+        // The whole reply has been consumed.
+        if (_metrics) {
+            _metrics->received(*ctx, true, e.what());
+        }
+
+        throw;
+    }
+
+    if (_metrics) {
+        _metrics->received(*ctx, false);
+    }
+}
+
 void Connection::_set_options() {
     _auth();
 
+    _hello();
+
     _select_db();
+
+    _enable_readonly();
 }
 
 void Connection::_auth() {
@@ -284,6 +502,24 @@ void Connection::_auth() {
     reply::parse<void>(*reply);
 }
 
+void Connection::_hello() {
+    if (_opts.resp == 2) {
+        return;
+    }
+
+    if (_opts.resp != 3) {
+        throw Error("Unsupported protocol version: " + std::to_string(_opts.resp));
+    }
+
+    send("HELLO 3");
+
+    auto reply = recv();
+
+    if (!reply::is_map(*reply)) {
+        throw ProtoError("Expect MAP reply of HELLO command");
+    }
+}
+
 void Connection::_select_db() {
     if (_opts.db == 0) {
         return;
@@ -295,3 +531,15 @@ void Connection::_select_db() {
 
     reply::parse<void>(*reply);
 }
+
+void Connection::_enable_readonly() {
+    if (!_opts.readonly) {
+        return;
+    }
+
+    send("READONLY");
+
+    auto reply = recv();
+
+    reply::parse<void>(*reply);
+}
@@ -23,9 +23,13 @@
 #include <string>
 #include <sstream>
 #include <chrono>
+#include <functional>
 #include "hiredis.h"
 #include "errors.h"
+#include "metrics.h"
 #include "reply.h"
+#include "reply_view.h"
+#include "reply_stream.h"
 #include "utils.h"
 
 enum class ConnectionType {
@@ -65,6 +69,39 @@ public:
 
     std::chrono::milliseconds socket_timeout{0};
 
+    // Whether to send READONLY command after connecting to a Redis Cluster replica,
+    // so that the replica serves read commands.
+    bool readonly = false;
+
+    // Whether to allocate each reply tree from an arena, i.e. a few bump allocations
+    // per reply, instead of one allocation per node. Useful for large array replies.
+    bool reply_arena = false;
+
+    // Once all received data is parsed, the read buffer is freed if its unused space
+    // is larger than twice this, or twice the size of the next read, whichever is larger.
+    // Larger values avoid reallocating the buffer for each large reply, at the cost of
+    // memory held by idle connections. 0 means never free it.
+    std::size_t reader_max_buf = REDIS_READER_MAX_BUF;
+
+    // Protocol version, i.e. 2 or 3. With 3, connections are negotiated with
+    // HELLO 3, which requires Redis 6.0 or later.
+    int resp = 2;
+
+    // Called with out-of-band push messages, e.g. invalidation messages of client
+    // side caching, received while waiting for a reply. Only RESP3 has push messages.
+    // If it's NOT set, push messages are returned as normal replies, e.g. to Subscriber.
+    // NOTE: push messages received by *recv_view* or *recv_stream* are discarded.
+    std::function<void (redisReply &)> push_handler;
+
+    // Arguments not smaller than this are NOT copied into the output buffer, but
+    // written from the caller's memory with writev, if the command is sent within
+    // a *ZeroCopyGuard*. 0 disables it. NOTE: SSL connections always copy arguments.
+    std::size_t zero_copy_threshold = 64 * 1024;
+
+    // If it's set, metrics of connections created with these options, and of pools
+    // and clusters using these options, are recorded into it. See *Metrics*.
+    MetricsSPtr metrics;
+
 private:
     ConnectionOptions _parse_options(const std::string &uri) const;
 
@@ -82,6 +119,22 @@ class Connection {
 public:
     explicit Connection(const ConnectionOptions &opts);
 
+    // Tag type to create a non-blocking connection, i.e. connect with
+    // *redisConnectNonBlock*. The constructor returns before the connection
+    // is established, and it DOES NOT send AUTH, SELECT or READONLY command. Commands
+    // sent to such a connection are only appended to the output buffer, and
+    // the owner, e.g. *AsyncRedis*, drives the socket with its own event loop.
+    struct NonBlocking {};
+
+    Connection(const ConnectionOptions &opts, NonBlocking);
+
+    // Tag type to create a connection that is never connected. Commands sent to
+    // it are only formatted into the output buffer, e.g. *ClusterPipeline* queues
+    // commands with it before it knows which node to send them to.
+    struct Detached {};
+
+    Connection(const ConnectionOptions &opts, Detached);
+
     Connection(const Connection &) = delete;
     Connection& operator=(const Connection &) = delete;
 
@@ -99,6 +152,16 @@ public:
 
     void reconnect();
 
+    // Mark the connection as invalid, e.g. its state might have been changed,
+    // so that the pool reconnects it before reusing it. It's still usable until then.
+    void invalidate() noexcept {
+        _invalid = true;
+    }
+
+    bool invalid() const noexcept {
+        return _invalid;
+    }
+
     auto last_active() const
         -> std::chrono::time_point<std::chrono::steady_clock> {
         return _last_active;
@@ -111,8 +174,21 @@ public:
 
     void send(CmdArgs &args);
 
+    // Write all commands in the output buffer to the socket, without reading replies.
+    // So that we can send commands to several connections before waiting for any reply.
+    void flush();
+
+    // Drop commands in the output buffer, i.e. commands that have NOT been sent.
+    void clear_output();
+
     ReplyUPtr recv();
 
+    // Same as *recv*, but strings in the reply point into the reader buffer.
+    ReplyViewUPtr recv_view();
+
+    // Read an ARRAY reply, and pass its elements to the sink while they're parsed.
+    void recv_stream(ReplySink &sink);
+
     const ConnectionOptions& options() const {
         return _opts;
     }
@@ -120,6 +196,14 @@ public:
     friend void swap(Connection &lhs, Connection &rhs) noexcept;
 
 private:
+    friend class AsyncConnection;
+
+    friend class ClusterPipeline;
+
+    friend class NearCache;
+
+    friend class ZeroCopyGuard;
+
     class Connector;
 
     struct ContextDeleter {
@@ -136,8 +220,12 @@ private:
 
     void _auth();
 
+    void _hello();
+
     void _select_db();
 
+    void _enable_readonly();
+
     redisContext* _context();
 
     ContextUPtr _ctx;
@@ -147,10 +235,47 @@ private:
     std::chrono::time_point<std::chrono::steady_clock> _last_active{};
 
     ConnectionOptions _opts;
+
+    bool _invalid = false;
+
+    // Whether large arguments are referenced in place. See *ZeroCopyGuard*.
+    bool _zero_copy = false;
+
+    // Null if *ConnectionOptions::metrics* is NOT set, or it's a non-blocking connection.
+    std::unique_ptr<ConnectionMetrics> _metrics;
 };
 
 using ConnectionSPtr = std::shared_ptr<Connection>;
 
+// Within its scope, large arguments of commands sent by *Connection::send(CmdArgs &)*
+// are NOT copied, so they MUST outlive the scope, and the output MUST be flushed,
+// e.g. by *recv*, before the scope ends. Otherwise, unsent output is discarded.
+class ZeroCopyGuard {
+public:
+    explicit ZeroCopyGuard(Connection &connection) : _connection(connection) {
+        _connection._zero_copy = true;
+    }
+
+    ZeroCopyGuard(const ZeroCopyGuard &) = delete;
+    ZeroCopyGuard& operator=(const ZeroCopyGuard &) = delete;
+
+    ZeroCopyGuard(ZeroCopyGuard &&) = delete;
+    ZeroCopyGuard& operator=(ZeroCopyGuard &&) = delete;
+
+    ~ZeroCopyGuard() {
+        _connection._zero_copy = false;
+
+        auto *ctx = _connection._ctx.get();
+        if (ctx != nullptr && ctx->orefslen > 0) {
+            // Failed to flush, and referenced arguments are going to be destroyed.
+            redisClearOutput(ctx);
+        }
+    }
+
+private:
+    Connection &_connection;
+};
+
 // Inline implementaions.
 
 template <typename ...Args>
@@ -165,6 +290,11 @@ inline void Connection::send(const char *format, Args &&...args) {
         throw_error(*ctx, "Failed to send command");
     }
 
+    if (_metrics) {
+        // Command name is the first word of the format.
+        _metrics->sent(StringView(format, std::strcspn(format, " ")));
+    }
+
     assert(!broken());
 }
 
@@ -16,6 +16,7 @@
 
 #include "connection_pool.h"
 #include <cassert>
+#include <thread>
 #include "errors.h"
 
 ConnectionPool::ConnectionPool(const ConnectionPoolOptions &pool_opts,
@@ -26,10 +27,20 @@ ConnectionPool::ConnectionPool(const ConnectionPoolOptions &pool_opts,
         throw Error("CANNOT create an empty pool");
     }
 
+    if (_pool_opts.multiplexing) {
+        _init_multiplexer();
+    } else if (_pool_opts.lock_free) {
+        _slots.reset(new ConnectionSlot[_pool_opts.size]);
+    }
+
     // Lazily create connections.
 }
 
 ConnectionPool::ConnectionPool(ConnectionPool &&that) {
+    // Lock the owner before the pool, in the same order as returning a borrowed
+    // connection. Keep it alive until it's unlocked.
+    auto that_owner = that._owner;
+    std::lock_guard<std::mutex> lock_owner(that_owner->mutex);
     std::lock_guard<std::mutex> lock(that._mutex);
 
     _move(std::move(that));
@@ -37,6 +48,12 @@ ConnectionPool::ConnectionPool(ConnectionPool &&that) {
 
 ConnectionPool& ConnectionPool::operator=(ConnectionPool &&that) {
     if (this != &that) {
+        auto owner = _owner;
+        auto that_owner = that._owner;
+        std::lock(owner->mutex, that_owner->mutex);
+        std::lock_guard<std::mutex> lock_owner(owner->mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> lock_that_owner(that_owner->mutex, std::adopt_lock);
+
         std::lock(_mutex, that._mutex);
         std::lock_guard<std::mutex> lock_this(_mutex, std::adopt_lock);
         std::lock_guard<std::mutex> lock_that(that._mutex, std::adopt_lock);
@@ -47,7 +64,28 @@ ConnectionPool& ConnectionPool::operator=(ConnectionPool &&that) {
     return *this;
 }
 
+ConnectionPool::~ConnectionPool() {
+    // Borrowed connections released from now on are closed.
+    std::lock_guard<std::mutex> lock(_owner->mutex);
+
+    _owner->pool = nullptr;
+}
+
 Connection ConnectionPool::fetch() {
+    if (!_opts.metrics) {
+        return _slots ? _lock_free_fetch() : _locked_fetch();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto connection = _slots ? _lock_free_fetch() : _locked_fetch();
+
+    _opts.metrics->_record_pool_wait(std::chrono::steady_clock::now() - start);
+
+    return connection;
+}
+
+Connection ConnectionPool::_locked_fetch() {
     std::unique_lock<std::mutex> lock(_mutex);
 
     if (_pool.empty()) {
@@ -88,6 +126,11 @@ ConnectionOptions ConnectionPool::connection_options() {
 }
 
 void ConnectionPool::release(Connection connection) {
+    if (_slots) {
+        _lock_free_release(std::move(connection));
+        return;
+    }
+
     {
         std::lock_guard<std::mutex> lock(_mutex);
 
@@ -97,11 +140,249 @@ void ConnectionPool::release(Connection connection) {
     _cv.notify_one();
 }
 
+void ConnectionPool::close_idle() {
+    // Close them without holding the lock.
+    std::deque<Connection> idle;
+
+    if (_slots) {
+        for (std::size_t idx = 0; idx != _pool_opts.size; ++idx) {
+            auto &slot = _slots[idx];
+            int expected = ConnectionSlot::FULL;
+            if (slot.state.compare_exchange_strong(expected, ConnectionSlot::LOCKED)) {
+                idle.push_back(std::move(slot.connection()));
+                slot.connection().~Connection();
+                slot.state.store(ConnectionSlot::EMPTY);
+                --_created_connections;
+            }
+        }
+
+        _notify_waiters();
+    } else {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _used_connections -= _pool.size();
+        idle.swap(_pool);
+    }
+}
+
+ConnectionSPtr ConnectionPool::borrow() {
+    std::weak_ptr<Owner> owner = _owner;
+
+    return ConnectionSPtr(new Connection(fetch()),
+                            [owner](Connection *connection) {
+                                std::unique_ptr<Connection> guard(connection);
+
+                                auto pool_owner = owner.lock();
+                                if (!pool_owner) {
+                                    return;
+                                }
+
+                                std::lock_guard<std::mutex> lock(pool_owner->mutex);
+                                if (pool_owner->pool != nullptr) {
+                                    pool_owner->pool->release(std::move(*connection));
+                                }
+                            });
+}
+
 void ConnectionPool::_move(ConnectionPool &&that) {
+    // Connections borrowed from our old connections are closed, and those borrowed
+    // from *that* are returned to us.
+    _owner->pool = nullptr;
+    _owner = std::move(that._owner);
+    _owner->pool = this;
+    that._owner = std::make_shared<Owner>(&that);
+
     _opts = std::move(that._opts);
     _pool_opts = std::move(that._pool_opts);
     _pool = std::move(that._pool);
     _used_connections = that._used_connections;
+    // Stop our own loop, before destroying the connections it watches.
+    _loop = std::move(that._loop);
+    _shared_connections = std::move(that._shared_connections);
+    _next_connection = that._next_connection.load();
+    _slots = std::move(that._slots);
+    _created_connections = that._created_connections.load();
+    _waiters = that._waiters.load();
+}
+
+void ConnectionPool::_init_multiplexer() {
+    _loop.reset(new EventLoop);
+
+    // Lazily connect, when we send the first command.
+    _shared_connections.reserve(_pool_opts.size);
+    for (std::size_t idx = 0; idx != _pool_opts.size; ++idx) {
+        _shared_connections.emplace_back(new AsyncConnection(_opts, *_loop));
+    }
+}
+
+AsyncConnection& ConnectionPool::_shared_connection() {
+    if (_shared_connections.empty()) {
+        throw Error("Connection pool is NOT in multiplexing mode");
+    }
+
+    auto idx = _next_connection.fetch_add(1, std::memory_order_relaxed);
+
+    return *_shared_connections[idx % _shared_connections.size()];
+}
+
+ReplyUPtr ConnectionPool::_wait_for_reply(std::future<ReplyUPtr> fut) {
+    auto timeout = _opts.socket_timeout;
+    if (timeout > std::chrono::milliseconds(0)
+            && fut.wait_for(timeout) != std::future_status::ready) {
+        // The reply will be discarded when it arrives, so the shared connection
+        // is still usable, unless the event loop closes it for the same timeout.
+        throw TimeoutError("Failed to get reply in "
+                + std::to_string(timeout.count()) + " milliseconds");
+    }
+
+    return fut.get();
+}
+
+Connection ConnectionPool::_lock_free_fetch() {
+    auto idx = _lock_full_slot();
+    if (idx == _pool_opts.size) {
+        if (!_reserve_connection()) {
+            idx = _wait_for_slot();
+        }
+
+        if (idx == _pool_opts.size) {
+            // Lazily create a new connection.
+            try {
+                return Connection(_opts);
+            } catch (const Error &e) {
+                --_created_connections;
+                _notify_waiters();
+                throw;
+            }
+        }
+    }
+
+    auto &slot = _slots[idx];
+    auto connection = std::move(slot.connection());
+    slot.connection().~Connection();
+    slot.state.store(ConnectionSlot::EMPTY);
+
+    if (_need_reconnect(connection)) {
+        try {
+            connection.reconnect();
+        } catch (const Error &e) {
+            // Failed to reconnect, return it to the pool, and retry latter.
+            release(std::move(connection));
+            throw;
+        }
+    }
+
+    return connection;
+}
+
+void ConnectionPool::_lock_free_release(Connection connection) {
+    auto size = _pool_opts.size;
+    auto home = _home_slot();
+
+    // There're at most *size* connections, so we can always find an empty slot.
+    // However, a slot might be locked temporarily by a fetching thread.
+    for (std::size_t idx = 0; ; ++idx) {
+        auto &slot = _slots[(home + idx) % size];
+        int expected = ConnectionSlot::EMPTY;
+        if (slot.state.load(std::memory_order_relaxed) == expected
+                && slot.state.compare_exchange_strong(expected, ConnectionSlot::LOCKED)) {
+            new (&slot.connection()) Connection(std::move(connection));
+            slot.state.store(ConnectionSlot::FULL);
+            break;
+        }
+
+        if (idx % size == size - 1) {
+            std::this_thread::yield();
+        }
+    }
+
+    _notify_waiters();
+}
+
+std::size_t ConnectionPool::_lock_full_slot() {
+    auto size = _pool_opts.size;
+    auto home = _home_slot();
+
+    for (std::size_t idx = 0; idx != size; ++idx) {
+        auto slot_idx = (home + idx) % size;
+        auto &slot = _slots[slot_idx];
+        int expected = ConnectionSlot::FULL;
+        if (slot.state.load(std::memory_order_relaxed) == expected
+                && slot.state.compare_exchange_strong(expected, ConnectionSlot::LOCKED)) {
+            return slot_idx;
+        }
+    }
+
+    return size;
+}
+
+bool ConnectionPool::_reserve_connection() {
+    auto created = _created_connections.load();
+    while (created < _pool_opts.size) {
+        if (_created_connections.compare_exchange_weak(created, created + 1)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::size_t ConnectionPool::_wait_for_slot() {
+    auto idx = _pool_opts.size;
+    auto ready = [this, &idx]() {
+                    idx = this->_lock_full_slot();
+                    return idx != this->_pool_opts.size || this->_reserve_connection();
+    };
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // Releasing threads check *_waiters* after publishing a connection, and we
+    // check slots after increasing *_waiters*. Slots are loaded with relaxed order,
+    // so fences on both sides are needed to make sure that either we see the
+    // connection, or the releasing thread sees us. So we won't miss it.
+    ++_waiters;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto timeout = _pool_opts.wait_timeout;
+    bool ok = true;
+    if (timeout > std::chrono::milliseconds(0)) {
+        ok = _cv.wait_for(lock, timeout, ready);
+    } else {
+        _cv.wait(lock, ready);
+    }
+
+    --_waiters;
+
+    if (!ok) {
+        throw Error("Failed to fetch a connection in "
+                + std::to_string(timeout.count()) + " milliseconds");
+    }
+
+    return idx;
+}
+
+void ConnectionPool::_notify_waiters() {
+    // Pairs with the fence in *_wait_for_slot*.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (_waiters.load() == 0) {
+        return;
+    }
+
+    {
+        // Make sure the waiter is either blocked or hasn't checked the slots yet.
+        std::lock_guard<std::mutex> lock(_mutex);
+    }
+
+    _cv.notify_one();
+}
+
+std::size_t ConnectionPool::_home_slot() {
+    // Spread threads evenly across slots.
+    static std::atomic<std::size_t> next_home{0};
+    static thread_local std::size_t home = next_home.fetch_add(1, std::memory_order_relaxed);
+
+    return home;
 }
 
 Connection ConnectionPool::_fetch() {
@@ -130,7 +411,7 @@ void ConnectionPool::_wait_for_connection(std::unique_lock<std::mutex> &lock) {
 }
 
 bool ConnectionPool::_need_reconnect(const Connection &connection) {
-    if (connection.broken()) {
+    if (connection.broken() || connection.invalid()) {
         return true;
     }
 
@@ -17,11 +17,16 @@
 #ifndef SEWENEW_REDISPLUSPLUS_CONNECTION_POOL_H
 #define SEWENEW_REDISPLUSPLUS_CONNECTION_POOL_H
 
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <deque>
+#include <future>
+#include <memory>
+#include <vector>
 #include "connection.h"
+#include "async_connection.h"
 
 struct ConnectionPoolOptions {
     // Max number of connections, including both in-use and idle ones.
@@ -32,8 +37,28 @@ struct ConnectionPoolOptions {
 
     // Max lifetime of a connection. 0ms means we never expire the connection.
     std::chrono::milliseconds connection_lifetime{0};
+
+    // Whether to multiplex commands from different threads over shared connections.
+    // In this mode, *size* is the number of shared connections. Commands are appended
+    // to the output buffer of a connection, and replies are dispatched in FIFO order
+    // by a reader thread, so that many threads can share a few connections with
+    // implicit pipelining. *wait_timeout* and *connection_lifetime* are ignored.
+    // Blocking commands, e.g. BLPOP, block all commands sharing the same connection.
+    //
+    // NOTE: Only *Redis* supports this mode, and *RedisCluster* ignores it.
+    bool multiplexing = false;
+
+    // Whether to fetch and release connections without locking. In this mode, idle
+    // connections are kept in a fixed array of *size* slots, and each thread prefers
+    // the slot it used last time, so that it can usually get its own connection back
+    // without contention. The mutex and condition variable are only used when all
+    // connections are in use. *size*, *wait_timeout* and *connection_lifetime* keep
+    // the same meaning. Ignored in multiplexing mode.
+    bool lock_free = false;
 };
 
+// It can be shared with *std::shared_ptr*, e.g. *ShardsPool* keeps a pool alive
+// while connections fetched from it are in use.
 class ConnectionPool {
 public:
     ConnectionPool(const ConnectionPoolOptions &pool_opts,
@@ -47,7 +72,7 @@ public:
     ConnectionPool(const ConnectionPool &) = delete;
     ConnectionPool& operator=(const ConnectionPool &) = delete;
 
-    ~ConnectionPool() = default;
+    ~ConnectionPool();
 
     // Fetch a connection from pool.
     Connection fetch();
@@ -56,9 +81,54 @@ public:
 
     void release(Connection connection);
 
+    // Close idle connections, e.g. when the node is removed. Connections in use are
+    // NOT affected, and new connections are still created on demand. Connections of
+    // multiplexing mode are NOT closed.
+    void close_idle();
+
+    // Fetch a connection, which is released to the pool when the last
+    // reference goes away. If the pool has been moved, it's released to the new
+    // one, and if the pool has been destroyed, it's closed.
+    ConnectionSPtr borrow();
+
+    bool multiplexing() const {
+        return _pool_opts.multiplexing;
+    }
+
+    // Multiplexing mode only. Send command with a shared connection,
+    // and block until the reply arrives. Thread-safe.
+    template <typename Cmd, typename ...Args>
+    ReplyUPtr multiplex(Cmd cmd, Args &&...args);
+
 private:
     void _move(ConnectionPool &&that);
 
+    void _init_multiplexer();
+
+    Connection _locked_fetch();
+
+    Connection _lock_free_fetch();
+
+    void _lock_free_release(Connection connection);
+
+    // Lock a slot holding an idle connection.
+    // Return the index of the slot, or *_pool_opts.size* if no idle connection.
+    std::size_t _lock_full_slot();
+
+    // Try to reserve the quota for a new connection.
+    bool _reserve_connection();
+
+    // Wait until we lock a full slot, or reserve a new connection.
+    std::size_t _wait_for_slot();
+
+    void _notify_waiters();
+
+    static std::size_t _home_slot();
+
+    AsyncConnection& _shared_connection();
+
+    ReplyUPtr _wait_for_reply(std::future<ReplyUPtr> fut);
+
     // NOT thread-safe
     Connection _fetch();
 
@@ -66,6 +136,18 @@ private:
 
     bool _need_reconnect(const Connection &connection);
 
+    // The pool that borrowed connections are returned to. It follows the pool when
+    // it's moved, and it's reset when the pool is destroyed.
+    struct Owner {
+        explicit Owner(ConnectionPool *p) : pool(p) {}
+
+        std::mutex mutex;
+
+        ConnectionPool *pool;
+    };
+
+    std::shared_ptr<Owner> _owner = std::make_shared<Owner>(this);
+
     ConnectionOptions _opts;
 
     ConnectionPoolOptions _pool_opts;
@@ -77,6 +159,69 @@ private:
     std::mutex _mutex;
 
     std::condition_variable _cv;
+
+    // Multiplexing mode. The loop MUST be destroyed before the shared
+    // connections, since the loop thread accesses them.
+    std::vector<std::unique_ptr<AsyncConnection>> _shared_connections;
+
+    std::unique_ptr<EventLoop> _loop;
+
+    std::atomic<std::size_t> _next_connection{0};
+
+    // Lock-free mode.
+    class ConnectionSlot {
+    public:
+        enum State {
+            EMPTY = 0,
+            LOCKED,
+            FULL
+        };
+
+        ConnectionSlot() = default;
+
+        ConnectionSlot(const ConnectionSlot &) = delete;
+        ConnectionSlot& operator=(const ConnectionSlot &) = delete;
+
+        ConnectionSlot(ConnectionSlot &&) = delete;
+        ConnectionSlot& operator=(ConnectionSlot &&) = delete;
+
+        ~ConnectionSlot() {
+            if (state.load() == FULL) {
+                connection().~Connection();
+            }
+        }
+
+        // Only the thread that has locked the slot can access the connection.
+        Connection& connection() {
+            return *reinterpret_cast<Connection*>(&_storage);
+        }
+
+        std::atomic<int> state{EMPTY};
+
+    private:
+        typename std::aligned_storage<sizeof(Connection), alignof(Connection)>::type _storage;
+    };
+
+    std::unique_ptr<ConnectionSlot[]> _slots;
+
+    // Number of connections created in lock-free mode.
+    std::atomic<std::size_t> _created_connections{0};
+
+    // Number of threads waiting for a connection in lock-free mode.
+    std::atomic<std::size_t> _waiters{0};
 };
 
+// Inline implementations.
+
+template <typename Cmd, typename ...Args>
+ReplyUPtr ConnectionPool::multiplex(Cmd cmd, Args &&...args) {
+    std::unique_ptr<FutureEvent<ReplyUPtr>> event(new FutureEvent<ReplyUPtr>);
+
+    auto fut = event->get_future();
+
+    _shared_connection().send(std::move(event), cmd, std::forward<Args>(args)...);
+
+    return _wait_for_reply(std::move(fut));
+}
+
 #endif // end SEWENEW_REDISPLUSPLUS_CONNECTION_POOL_H
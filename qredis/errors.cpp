@@ -75,8 +75,10 @@ void throw_error(const redisReply &reply) {
         throw Error("Null error reply");
     }
 
-    auto err_str = std::string(reply.str, reply.len);
+    throw_error(std::string(reply.str, reply.len));
+}
 
+void throw_error(const std::string &err_str) {
     auto err_type = ReplyErrorType::ERR;
     std::string err_msg;
     std::tie(err_type, err_msg) = parse_error(err_str);
@@ -148,4 +148,7 @@ void throw_error(redisContext &context, const std::string &err_info);
 
 void throw_error(const redisReply &reply);
 
+// Throw exception for an error reply with the given message, e.g. "MOVED 3999 127.0.0.1:6381".
+void throw_error(const std::string &err_str);
+
 #endif // end SEWENEW_REDISPLUSPLUS_ERRORS_H
@@ -38,6 +38,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <ctype.h>
+#include <sys/uio.h>
 
 #include "hiredis.h"
 #include "net.h"
@@ -48,7 +49,16 @@ static redisReply *createReplyObject(int type);
 static void *createStringObject(const redisReadTask *task, char *str, size_t len);
 static void *createArrayObject(const redisReadTask *task, int elements);
 static void *createIntegerObject(const redisReadTask *task, long long value);
+static void *createDoubleObject(const redisReadTask *task, double value, char *str, size_t len);
 static void *createNilObject(const redisReadTask *task);
+static void *createBoolObject(const redisReadTask *task, int bval);
+static void *createArenaStringObject(const redisReadTask *task, char *str, size_t len);
+static void *createArenaArrayObject(const redisReadTask *task, int elements);
+static void *createArenaIntegerObject(const redisReadTask *task, long long value);
+static void *createArenaDoubleObject(const redisReadTask *task, double value, char *str, size_t len);
+static void *createArenaNilObject(const redisReadTask *task);
+static void *createArenaBoolObject(const redisReadTask *task, int bval);
+static void releaseArenaReply(redisReply *r);
 
 /* Default set of functions to build the reply. Keep in mind that such a
  * function returning NULL is interpreted as OOM. */
@@ -56,10 +66,30 @@ static redisReplyObjectFunctions defaultFunctions = {
     createStringObject,
     createArrayObject,
     createIntegerObject,
+    createDoubleObject,
     createNilObject,
+    createBoolObject,
     freeReplyObject
 };
 
+/* Functions to build the reply in arena mode. */
+static redisReplyObjectFunctions arenaFunctions = {
+    createArenaStringObject,
+    createArenaArrayObject,
+    createArenaIntegerObject,
+    createArenaDoubleObject,
+    createArenaNilObject,
+    createArenaBoolObject,
+    freeReplyObject
+};
+
+/* Whether the reply has elements, i.e. array, map, set, attribute or push. */
+static int isAggregateType(int type) {
+    return type == REDIS_REPLY_ARRAY || type == REDIS_REPLY_MAP ||
+           type == REDIS_REPLY_SET || type == REDIS_REPLY_ATTR ||
+           type == REDIS_REPLY_PUSH;
+}
+
 /* Create a reply object */
 static redisReply *createReplyObject(int type) {
     redisReply *r = calloc(1,sizeof(*r));
@@ -71,33 +101,66 @@ static redisReply *createReplyObject(int type) {
     return r;
 }
 
-/* Free a reply object */
-void freeReplyObject(void *reply) {
-    redisReply *r = reply;
-    size_t j;
-
-    if (r == NULL)
-        return;
-
+/* Free a reply object that has no elements. */
+static void freeScalarReplyObject(redisReply *r) {
     switch(r->type) {
-    case REDIS_REPLY_INTEGER:
-        break; /* Nothing to free */
-    case REDIS_REPLY_ARRAY:
-        if (r->element != NULL) {
-            for (j = 0; j < r->elements; j++)
-                freeReplyObject(r->element[j]);
-            free(r->element);
-        }
-        break;
     case REDIS_REPLY_ERROR:
     case REDIS_REPLY_STATUS:
     case REDIS_REPLY_STRING:
+    case REDIS_REPLY_DOUBLE:
+    case REDIS_REPLY_VERB:
+    case REDIS_REPLY_BIGNUM:
         free(r->str);
         break;
+    default:
+        break; /* Nothing to free */
     }
     free(r);
 }
 
+/* Free a reply object. It's iterative, so that deeply nested replies never
+ * overflow the stack: aggregate objects waiting to be freed are chained through
+ * their str field, which is unused for these types. */
+void freeReplyObject(void *reply) {
+    redisReply *r = reply, *todo = NULL, *child;
+    size_t j;
+
+    if (r == NULL)
+        return;
+
+    if (r->arena != NULL) {
+        releaseArenaReply(r);
+        return;
+    }
+
+    for (;;) {
+        if (!isAggregateType(r->type)) {
+            freeScalarReplyObject(r);
+        } else {
+            if (r->element != NULL) {
+                for (j = 0; j < r->elements; j++) {
+                    child = r->element[j];
+                    if (child == NULL)
+                        continue;
+                    if (isAggregateType(child->type)) {
+                        child->str = (char*)todo;
+                        todo = child;
+                    } else {
+                        freeScalarReplyObject(child);
+                    }
+                }
+                free(r->element);
+            }
+            free(r);
+        }
+
+        if (todo == NULL)
+            break;
+        r = todo;
+        todo = (redisReply*)r->str;
+    }
+}
+
 static void *createStringObject(const redisReadTask *task, char *str, size_t len) {
     redisReply *r, *parent;
     char *buf;
@@ -114,9 +177,18 @@ static void *createStringObject(const redisReadTask *task, char *str, size_t len
 
     assert(task->type == REDIS_REPLY_ERROR  ||
            task->type == REDIS_REPLY_STATUS ||
-           task->type == REDIS_REPLY_STRING);
+           task->type == REDIS_REPLY_STRING ||
+           task->type == REDIS_REPLY_VERB   ||
+           task->type == REDIS_REPLY_BIGNUM);
 
     /* Copy string value */
+    if (task->type == REDIS_REPLY_VERB) {
+        /* Strip the "txt:" prefix, which has been checked by the reader. */
+        memcpy(r->vtype,str,3);
+        r->vtype[3] = '\0';
+        str += 4;
+        len -= 4;
+    }
     memcpy(buf,str,len);
     buf[len] = '\0';
     r->str = buf;
@@ -124,7 +196,7 @@ static void *createStringObject(const redisReadTask *task, char *str, size_t len
 
     if (task->parent) {
         parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
+        assert(isAggregateType(parent->type));
         parent->element[task->idx] = r;
     }
     return r;
@@ -133,7 +205,7 @@ static void *createStringObject(const redisReadTask *task, char *str, size_t len
 static void *createArrayObject(const redisReadTask *task, int elements) {
     redisReply *r, *parent;
 
-    r = createReplyObject(REDIS_REPLY_ARRAY);
+    r = createReplyObject(task->type);
     if (r == NULL)
         return NULL;
 
@@ -149,7 +221,7 @@ static void *createArrayObject(const redisReadTask *task, int elements) {
 
     if (task->parent) {
         parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
+        assert(isAggregateType(parent->type));
         parent->element[task->idx] = r;
     }
     return r;
@@ -166,7 +238,51 @@ static void *createIntegerObject(const redisReadTask *task, long long value) {
 
     if (task->parent) {
         parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
+        assert(isAggregateType(parent->type));
+        parent->element[task->idx] = r;
+    }
+    return r;
+}
+
+static void *createDoubleObject(const redisReadTask *task, double value, char *str, size_t len) {
+    redisReply *r, *parent;
+
+    r = createReplyObject(REDIS_REPLY_DOUBLE);
+    if (r == NULL)
+        return NULL;
+
+    /* Also keep the string representation, e.g. to return it as is. */
+    r->str = malloc(len+1);
+    if (r->str == NULL) {
+        freeReplyObject(r);
+        return NULL;
+    }
+
+    memcpy(r->str,str,len);
+    r->str[len] = '\0';
+    r->len = len;
+    r->dval = value;
+
+    if (task->parent) {
+        parent = task->parent->obj;
+        assert(isAggregateType(parent->type));
+        parent->element[task->idx] = r;
+    }
+    return r;
+}
+
+static void *createBoolObject(const redisReadTask *task, int bval) {
+    redisReply *r, *parent;
+
+    r = createReplyObject(REDIS_REPLY_BOOL);
+    if (r == NULL)
+        return NULL;
+
+    r->integer = bval != 0;
+
+    if (task->parent) {
+        parent = task->parent->obj;
+        assert(isAggregateType(parent->type));
         parent->element[task->idx] = r;
     }
     return r;
@@ -181,12 +297,257 @@ static void *createNilObject(const redisReadTask *task) {
 
     if (task->parent) {
         parent = task->parent->obj;
-        assert(parent->type == REDIS_REPLY_ARRAY);
+        assert(isAggregateType(parent->type));
         parent->element[task->idx] = r;
     }
     return r;
 }
 
+/* Arena mode. The arena is a list of chunks, and the newest chunk is the head.
+ * The arena header and the first chunk share one allocation. */
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+#define ARENA_MAX_HINT (1024*1024)
+
+typedef struct arenaChunk {
+    struct arenaChunk *next;
+    size_t size;
+    size_t used;
+} arenaChunk;
+
+typedef struct replyArena {
+    arenaChunk *chunks;
+    size_t nodes; /* Number of nodes that have NOT been freed */
+} replyArena;
+
+#define ARENA_CHUNK_DATA(c) ((char*)(c) + ARENA_ROUND(sizeof(arenaChunk)))
+
+static replyArena *arenaCreate(size_t hint) {
+    replyArena *a;
+    arenaChunk *c;
+
+    hint = ARENA_ROUND(hint);
+    a = malloc(ARENA_ROUND(sizeof(replyArena)) + ARENA_ROUND(sizeof(arenaChunk)) + hint);
+    if (a == NULL)
+        return NULL;
+
+    c = (arenaChunk*)((char*)a + ARENA_ROUND(sizeof(replyArena)));
+    c->next = NULL;
+    c->size = hint;
+    c->used = 0;
+
+    a->chunks = c;
+    a->nodes = 0;
+    return a;
+}
+
+static void arenaFree(replyArena *a) {
+    arenaChunk *c = a->chunks, *next;
+
+    /* The last chunk is allocated with the arena header. */
+    while (c->next != NULL) {
+        next = c->next;
+        free(c);
+        c = next;
+    }
+    free(a);
+}
+
+static void *arenaAlloc(replyArena *a, size_t size) {
+    arenaChunk *c = a->chunks;
+    size_t csize;
+    void *p;
+
+    size = ARENA_ROUND(size);
+    if (c->size - c->used < size) {
+        csize = c->size * 2;
+        if (csize < size)
+            csize = size;
+
+        c = malloc(ARENA_ROUND(sizeof(arenaChunk)) + csize);
+        if (c == NULL)
+            return NULL;
+
+        c->next = a->chunks;
+        c->size = csize;
+        c->used = 0;
+        a->chunks = c;
+    }
+
+    p = ARENA_CHUNK_DATA(c) + c->used;
+    c->used += size;
+    return p;
+}
+
+/* Allocate a node with 'extra' bytes after it. The root node creates the arena
+ * with 'hint' bytes, and other nodes are allocated from the arena of the parent. */
+static redisReply *createArenaReplyObject(const redisReadTask *task, int type,
+                                          size_t extra, size_t hint)
+{
+    replyArena *a;
+    redisReply *r, *parent = NULL;
+
+    if (task->parent) {
+        parent = task->parent->obj;
+        assert(isAggregateType(parent->type) && parent->arena != NULL);
+        a = parent->arena;
+    } else {
+        if (hint > ARENA_MAX_HINT)
+            hint = ARENA_MAX_HINT;
+        a = arenaCreate(hint > sizeof(*r) + extra ? hint : sizeof(*r) + extra);
+        if (a == NULL)
+            return NULL;
+    }
+
+    r = arenaAlloc(a,sizeof(*r) + extra);
+    if (r == NULL) {
+        if (parent == NULL)
+            arenaFree(a);
+        return NULL;
+    }
+
+    memset(r,0,sizeof(*r));
+    r->type = type;
+    r->arena = a;
+    a->nodes++;
+
+    if (parent != NULL)
+        parent->element[task->idx] = r;
+    return r;
+}
+
+static void *createArenaStringObject(const redisReadTask *task, char *str, size_t len) {
+    redisReply *r;
+
+    assert(task->type == REDIS_REPLY_ERROR  ||
+           task->type == REDIS_REPLY_STATUS ||
+           task->type == REDIS_REPLY_STRING ||
+           task->type == REDIS_REPLY_VERB   ||
+           task->type == REDIS_REPLY_BIGNUM);
+
+    /* The string is stored right after the node. */
+    r = createArenaReplyObject(task,task->type,len+1,0);
+    if (r == NULL)
+        return NULL;
+
+    if (task->type == REDIS_REPLY_VERB) {
+        memcpy(r->vtype,str,3);
+        r->vtype[3] = '\0';
+        str += 4;
+        len -= 4;
+    }
+
+    r->str = (char*)(r+1);
+    memcpy(r->str,str,len);
+    r->str[len] = '\0';
+    r->len = len;
+    return r;
+}
+
+static void *createArenaArrayObject(const redisReadTask *task, int elements) {
+    redisReply *r;
+    size_t vlen = elements > 0 ? elements*sizeof(redisReply*) : 0;
+
+    /* The elements vector is stored right after the node. Guess the size
+     * of the whole tree, assuming short strings. */
+    r = createArenaReplyObject(task,task->type,vlen,
+            sizeof(*r) + vlen + (size_t)elements*(ARENA_ROUND(sizeof(*r)) + 32));
+    if (r == NULL)
+        return NULL;
+
+    if (elements > 0) {
+        r->element = (redisReply**)(r+1);
+        memset(r->element,0,vlen);
+    }
+
+    r->elements = elements;
+    return r;
+}
+
+static void *createArenaIntegerObject(const redisReadTask *task, long long value) {
+    redisReply *r;
+
+    r = createArenaReplyObject(task,REDIS_REPLY_INTEGER,0,0);
+    if (r == NULL)
+        return NULL;
+
+    r->integer = value;
+    return r;
+}
+
+static void *createArenaDoubleObject(const redisReadTask *task, double value, char *str, size_t len) {
+    redisReply *r;
+
+    r = createArenaReplyObject(task,REDIS_REPLY_DOUBLE,len+1,0);
+    if (r == NULL)
+        return NULL;
+
+    r->str = (char*)(r+1);
+    memcpy(r->str,str,len);
+    r->str[len] = '\0';
+    r->len = len;
+    r->dval = value;
+    return r;
+}
+
+static void *createArenaNilObject(const redisReadTask *task) {
+    return createArenaReplyObject(task,REDIS_REPLY_NIL,0,0);
+}
+
+static void *createArenaBoolObject(const redisReadTask *task, int bval) {
+    redisReply *r;
+
+    r = createArenaReplyObject(task,REDIS_REPLY_BOOL,0,0);
+    if (r == NULL)
+        return NULL;
+
+    r->integer = bval != 0;
+    return r;
+}
+
+/* Count the nodes of a (sub-)tree that is being released. Like freeReplyObject,
+ * it's iterative: aggregate nodes waiting to be visited are chained through their
+ * str field, which is unused for these types. */
+static size_t countArenaNodes(redisReply *r) {
+    redisReply *todo = NULL, *child;
+    size_t n = 0, j;
+
+    for (;;) {
+        n++;
+        if (isAggregateType(r->type) && r->element != NULL) {
+            for (j = 0; j < r->elements; j++) {
+                child = r->element[j];
+                if (child == NULL)
+                    continue;
+                if (isAggregateType(child->type)) {
+                    child->str = (char*)todo;
+                    todo = child;
+                } else {
+                    n++;
+                }
+            }
+        }
+
+        if (todo == NULL)
+            break;
+        r = todo;
+        todo = (redisReply*)r->str;
+    }
+    return n;
+}
+
+/* Free a (sub-)tree of an arena reply. Detached sub-trees are NOT counted,
+ * and the arena is freed when all nodes have been freed. */
+static void releaseArenaReply(redisReply *r) {
+    replyArena *a = r->arena;
+    size_t n = countArenaNodes(r);
+
+    assert(a->nodes >= n);
+    a->nodes -= n;
+    if (a->nodes == 0)
+        arenaFree(a);
+}
+
 /* Return the number of digits of 'v' when converted to string in radix 10.
  * Implementation borrowed from link in redis/src/util.c:string2ll(). */
 static uint32_t countDigits(uint64_t v) {
@@ -584,6 +945,10 @@ redisReader *redisReaderCreate(void) {
     return redisReaderCreateWithFunctions(&defaultFunctions);
 }
 
+void redisReaderUseArena(redisReader *r) {
+    r->fn = &arenaFunctions;
+}
+
 static redisContext *redisContextInit(const redisOptions *options) {
     redisContext *c;
 
@@ -609,6 +974,7 @@ void redisFree(redisContext *c) {
         close(c->fd);
 
     sdsfree(c->obuf);
+    free(c->orefs);
     redisReaderFree(c->reader);
     free(c->tcp.host);
     free(c->tcp.source_addr);
@@ -641,6 +1007,9 @@ int redisReconnect(redisContext *c) {
     redisReaderFree(c->reader);
 
     c->obuf = sdsempty();
+    c->opos = 0;
+    c->orefslen = 0;
+    c->orefsidx = 0;
     c->reader = redisReaderCreate();
 
     if (c->connection_type == REDIS_CONN_TCP) {
@@ -800,32 +1169,143 @@ static int rawRead(redisContext *c, char *buf, size_t bufcap) {
  * After this function is called, you may use redisGetReplyFromReader to
  * see if there is a reply available. */
 int redisBufferRead(redisContext *c) {
-    char buf[1024*16];
+    size_t size;
+    char *buf;
     int nread;
 
     /* Return early when the context has seen an error. */
     if (c->err)
         return REDIS_ERR;
 
+    /* Read straight into the reader buffer. */
+    size = redisReaderReadSize(c->reader);
+    buf = redisReaderReserve(c->reader, size);
+    if (buf == NULL) {
+        __redisSetError(c, c->reader->err, c->reader->errstr);
+        return REDIS_ERR;
+    }
+
     nread = c->flags & REDIS_SSL ?
-        redisSslRead(c, buf, sizeof(buf)) : rawRead(c, buf, sizeof(buf));
+        redisSslRead(c, buf, size) : rawRead(c, buf, size);
     if (nread > 0) {
-        if (redisReaderFeed(c->reader, buf, nread) != REDIS_OK) {
-            __redisSetError(c, c->reader->err, c->reader->errstr);
-            return REDIS_ERR;
-        } else {
-        }
+        redisReaderCommit(c->reader, nread);
+        c->nread += nread;
     } else if (nread < 0) {
         return REDIS_ERR;
     }
     return REDIS_OK;
 }
 
+/* Max number of buffers written with a single writev call. */
+#define REDIS_MAX_IOV 64
+
+/* Once everything is written, obuf is cleared and reused, unless it's larger
+ * than this, so that a large command doesn't pin memory. */
+#define REDIS_OBUF_MAX_IDLE (1024*64)
+
+/* Drop written bytes from the beginning of obuf, once there're at least this many
+ * of them, and they're at least half of obuf. Until then, partial writes only
+ * advance c->opos. */
+#define REDIS_OBUF_COMPACT (1024*16)
+
+/* Fill "iov" with unwritten bytes of obuf, and referenced arguments in order.
+ * Return the number of buffers. */
+static int __redisOutputIov(redisContext *c, struct iovec *iov, int max) {
+    size_t pos = c->opos, i;
+    int cnt = 0;
+
+    for (i = c->orefsidx; i < c->orefslen && cnt + 2 <= max; i++) {
+        redisOutputRef *ref = &c->orefs[i];
+        if (ref->pos > pos) {
+            iov[cnt].iov_base = c->obuf + pos;
+            iov[cnt].iov_len = ref->pos - pos;
+            cnt++;
+        }
+        iov[cnt].iov_base = (void*)ref->data;
+        iov[cnt].iov_len = ref->len;
+        cnt++;
+        pos = ref->pos;
+    }
+    if (i == c->orefslen && sdslen(c->obuf) > pos && cnt < max) {
+        iov[cnt].iov_base = c->obuf + pos;
+        iov[cnt].iov_len = sdslen(c->obuf) - pos;
+        cnt++;
+    }
+    return cnt;
+}
+
+/* Clear the output queue, and keep obuf for reuse if it's not too large. */
+static void __redisResetOutput(redisContext *c) {
+    if (sdsalloc(c->obuf) > REDIS_OBUF_MAX_IDLE) {
+        sds obuf = sdsempty();
+        if (obuf != NULL) {
+            sdsfree(c->obuf);
+            c->obuf = obuf;
+        } else {
+            sdsclear(c->obuf);
+        }
+    } else {
+        sdsclear(c->obuf);
+    }
+    c->opos = 0;
+    c->orefslen = 0;
+    c->orefsidx = 0;
+}
+
+/* Advance the output queue by "n" written bytes. */
+static void __redisConsumeOutput(redisContext *c, size_t n) {
+    size_t end, take, i;
+
+    while (n > 0) {
+        end = c->orefsidx < c->orefslen ? c->orefs[c->orefsidx].pos : sdslen(c->obuf);
+        if (c->opos < end) {
+            take = n < end - c->opos ? n : end - c->opos;
+            c->opos += take;
+            n -= take;
+        } else {
+            redisOutputRef *ref = &c->orefs[c->orefsidx];
+            assert(c->orefsidx < c->orefslen);
+            take = n < ref->len ? n : ref->len;
+            ref->data += take;
+            ref->len -= take;
+            n -= take;
+            if (ref->len == 0) c->orefsidx++;
+        }
+    }
+
+    if (c->opos == sdslen(c->obuf) && c->orefsidx == c->orefslen) {
+        __redisResetOutput(c);
+    } else if (c->opos >= REDIS_OBUF_COMPACT && c->opos * 2 >= sdslen(c->obuf)) {
+        /* Commands keep being appended before the queue is drained, e.g. with
+         * a non-blocking context. Drop written bytes, so that obuf doesn't grow. */
+        if (c->orefsidx > 0) {
+            memmove(c->orefs, c->orefs + c->orefsidx,
+                    (c->orefslen - c->orefsidx) * sizeof(*c->orefs));
+            c->orefslen -= c->orefsidx;
+            c->orefsidx = 0;
+        }
+        for (i = 0; i < c->orefslen; i++) {
+            c->orefs[i].pos -= c->opos;
+        }
+        sdsrange(c->obuf,c->opos,-1);
+        c->opos = 0;
+    }
+}
+
 static int rawWrite(redisContext *c) {
-    int nwritten = write(c->fd, c->obuf, sdslen(c->obuf));
+    struct iovec iov[REDIS_MAX_IOV];
+    int cnt, nwritten;
+
+    cnt = __redisOutputIov(c, iov, REDIS_MAX_IOV);
+    if (cnt == 1) {
+        nwritten = write(c->fd, iov[0].iov_base, iov[0].iov_len);
+    } else {
+        nwritten = writev(c->fd, iov, cnt);
+    }
     if (nwritten < 0) {
         if ((errno == EAGAIN && !(c->flags & REDIS_BLOCK)) || (errno == EINTR)) {
             /* Try again later */
+            return 0;
         } else {
             __redisSetError(c, REDIS_ERR_IO, NULL);
             return -1;
@@ -849,20 +1329,17 @@ int redisBufferWrite(redisContext *c, int *done) {
     if (c->err)
         return REDIS_ERR;
 
-    if (sdslen(c->obuf) > 0) {
+    if (sdslen(c->obuf) > c->opos || c->orefsidx < c->orefslen) {
         int nwritten = (c->flags & REDIS_SSL) ? redisSslWrite(c) : rawWrite(c);
         if (nwritten < 0) {
             return REDIS_ERR;
         } else if (nwritten > 0) {
-            if (nwritten == (signed)sdslen(c->obuf)) {
-                sdsfree(c->obuf);
-                c->obuf = sdsempty();
-            } else {
-                sdsrange(c->obuf,nwritten,-1);
-            }
+            __redisConsumeOutput(c,nwritten);
+            c->nwritten += nwritten;
         }
     }
-    if (done != NULL) *done = (sdslen(c->obuf) == 0);
+    /* The queue is reset once it's drained. */
+    if (done != NULL) *done = (sdslen(c->obuf) == 0 && c->orefslen == 0);
     return REDIS_OK;
 }
 
@@ -968,22 +1445,92 @@ int redisAppendCommand(redisContext *c, const char *format, ...) {
 }
 
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen) {
-    sds cmd;
-    int len;
+    return redisAppendCommandArgvRef(c,argc,argv,argvlen,NULL);
+}
 
-    len = redisFormatSdsCommandArgv(&cmd,argc,argv,argvlen);
-    if (len == -1) {
-        __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
-        return REDIS_ERR;
+/* Write "prefix", "len" and CRLF, and return the end. */
+static char *writeLength(char *p, char prefix, size_t len) {
+    char buf[32];
+    char *q = buf + sizeof(buf);
+
+    do {
+        *--q = '0' + (len % 10);
+        len /= 10;
+    } while (len > 0);
+
+    *p++ = prefix;
+    memcpy(p,q,buf + sizeof(buf) - q);
+    p += buf + sizeof(buf) - q;
+    *p++ = '\r';
+    *p++ = '\n';
+    return p;
+}
+
+int redisAppendCommandArgvRef(redisContext *c, int argc, const char **argv,
+                              const size_t *argvlen, const char *argvref) {
+    size_t totlen, len;
+    int j, nrefs = 0;
+    sds newbuf;
+    char *p;
+
+    if (c->flags & REDIS_SSL)
+        argvref = NULL;
+
+    /* Calculate the length once, and write the command straight into obuf. */
+    totlen = 1+countDigits(argc)+2;
+    for (j = 0; j < argc; j++) {
+        len = argvlen ? argvlen[j] : strlen(argv[j]);
+        if (argvref && argvref[j]) {
+            totlen += bulklen(len) - len;
+            nrefs++;
+        } else {
+            totlen += bulklen(len);
+        }
     }
 
-    if (__redisAppendCommand(c,cmd,len) != REDIS_OK) {
-        sdsfree(cmd);
-        return REDIS_ERR;
+    if (c->orefslen + nrefs > c->orefscap) {
+        size_t cap = c->orefscap ? c->orefscap * 2 : 4;
+        redisOutputRef *refs;
+
+        while (cap < c->orefslen + nrefs) cap *= 2;
+        refs = realloc(c->orefs, cap * sizeof(*refs));
+        if (refs == NULL) goto oom;
+        c->orefs = refs;
+        c->orefscap = cap;
     }
 
-    sdsfree(cmd);
+    newbuf = sdsMakeRoomFor(c->obuf,totlen);
+    if (newbuf == NULL) goto oom;
+    c->obuf = newbuf;
+
+    p = writeLength(c->obuf + sdslen(c->obuf), '*', argc);
+    for (j = 0; j < argc; j++) {
+        len = argvlen ? argvlen[j] : strlen(argv[j]);
+        p = writeLength(p, '$', len);
+        if (argvref && argvref[j]) {
+            redisOutputRef *ref = &c->orefs[c->orefslen++];
+            ref->pos = p - c->obuf;
+            ref->data = argv[j];
+            ref->len = len;
+        } else {
+            memcpy(p,argv[j],len);
+            p += len;
+        }
+        *p++ = '\r';
+        *p++ = '\n';
+    }
+
+    assert((size_t)(p - c->obuf) == sdslen(c->obuf) + totlen);
+    sdsIncrLen(c->obuf,totlen);
     return REDIS_OK;
+
+oom:
+    __redisSetError(c,REDIS_ERR_OOM,"Out of memory");
+    return REDIS_ERR;
+}
+
+void redisClearOutput(redisContext *c) {
+    __redisResetOutput(c);
 }
 
 /* Helper function for the redisCommand* family of functions.
@@ -96,15 +96,25 @@ extern "C" {
 /* This is the reply object returned by redisCommand() */
 typedef struct redisReply {
     int type; /* REDIS_REPLY_* */
-    long long integer; /* The integer when type is REDIS_REPLY_INTEGER */
+    long long integer; /* The integer when type is REDIS_REPLY_INTEGER or REDIS_REPLY_BOOL */
+    double dval; /* The double when type is REDIS_REPLY_DOUBLE */
     size_t len; /* Length of string */
-    char *str; /* Used for both REDIS_REPLY_ERROR and REDIS_REPLY_STRING */
-    size_t elements; /* number of elements, for REDIS_REPLY_ARRAY */
-    struct redisReply **element; /* elements vector for REDIS_REPLY_ARRAY */
+    char *str; /* Used for REDIS_REPLY_ERROR, REDIS_REPLY_STRING, REDIS_REPLY_VERB,
+                  REDIS_REPLY_BIGNUM, and the string representation of REDIS_REPLY_DOUBLE */
+    char vtype[4]; /* Format of REDIS_REPLY_VERB, e.g. "txt", null-terminated */
+    size_t elements; /* number of elements, for aggregate types, e.g. REDIS_REPLY_ARRAY */
+    struct redisReply **element; /* elements vector for aggregate types */
+    void *arena; /* Arena that the reply is allocated from, or NULL */
 } redisReply;
 
 redisReader *redisReaderCreate(void);
 
+/* Build replies in arena mode: each reply tree, including strings and element
+ * vectors, is bump-allocated from a few chunks, instead of one allocation per
+ * node. freeReplyObject() works as usual, and sub-replies can still be detached
+ * from their parent. The chunks are freed once all nodes have been freed. */
+void redisReaderUseArena(redisReader *r);
+
 /* Function to free the reply objects hiredis returns by default. */
 void freeReplyObject(void *reply);
 
@@ -171,6 +181,14 @@ typedef struct {
     (opts)->type = REDIS_CONN_UNIX;        \
     (opts)->endpoint.unix_socket = path;
 
+/* A large argument in the output buffer, which is NOT copied, but written from
+ * the caller's memory. It's written before the byte at offset "pos" of obuf. */
+typedef struct redisOutputRef {
+    size_t pos;
+    const char *data;
+    size_t len;
+} redisOutputRef;
+
 /* Context for a connection to Redis */
 typedef struct redisContext {
     int err; /* Error flags, 0 when there is no error */
@@ -178,8 +196,20 @@ typedef struct redisContext {
     int fd;
     int flags;
     char *obuf; /* Write buffer */
+    size_t opos; /* Bytes of obuf that have been written */
     redisReader *reader; /* Protocol reader */
 
+    /* Referenced arguments of obuf, ordered by pos. Arguments before orefsidx
+     * have been written, and the one at orefsidx might be partially written. */
+    redisOutputRef *orefs;
+    size_t orefslen;
+    size_t orefsidx;
+    size_t orefscap;
+
+    /* Total bytes read from and written to the socket. */
+    unsigned long long nread;
+    unsigned long long nwritten;
+
     enum redisConnectionType connection_type;
     struct timeval *timeout;
 
@@ -256,6 +286,16 @@ int redisvAppendCommand(redisContext *c, const char *format, va_list ap);
 int redisAppendCommand(redisContext *c, const char *format, ...);
 int redisAppendCommandArgv(redisContext *c, int argc, const char **argv, const size_t *argvlen);
 
+/* Same as redisAppendCommandArgv, but argv[j] is NOT copied if argvref[j] is
+ * non-zero, i.e. it MUST be valid until the output buffer is flushed. Such arguments
+ * are written with writev. If "argvref" is NULL, or it's an SSL connection, all
+ * arguments are copied. */
+int redisAppendCommandArgvRef(redisContext *c, int argc, const char **argv,
+                              const size_t *argvlen, const char *argvref);
+
+/* Drop commands in the output buffer, which have NOT been sent. */
+void redisClearOutput(redisContext *c);
+
 /* Issue a command to Redis. In a blocking context, it is identical to calling
  * redisAppendCommand, followed by redisGetReply. The function will return
  * NULL if there was an error in performing the request, otherwise it will
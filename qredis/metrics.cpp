@@ -0,0 +1,323 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#include "metrics.h"
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+// Position of the highest set bit, and value MUST NOT be 0.
+std::size_t highest_bit(std::uint64_t value) {
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(value);
+#else
+    std::size_t bit = 0;
+    while (value >>= 1) {
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+void update_max(std::atomic<std::uint64_t> &max, std::uint64_t value) {
+    auto cur = max.load(std::memory_order_relaxed);
+    while (value > cur
+            && !max.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {}
+}
+
+void merge_node(NodeStats &stats, const NodeStats &that) {
+    stats.calls += that.calls;
+    stats.errors += that.errors;
+    stats.bytes_in += that.bytes_in;
+    stats.bytes_out += that.bytes_out;
+    stats.reconnects += that.reconnects;
+    stats.moved += that.moved;
+    stats.ask += that.ask;
+    stats.latency.merge(that.latency);
+}
+
+std::atomic<std::uint64_t> metrics_id{0};
+
+}
+
+const std::size_t Histogram::SUB_BITS;
+const std::size_t Histogram::SUB_BUCKETS;
+const std::size_t Histogram::MAX_BITS;
+const std::size_t Histogram::BUCKETS;
+
+Histogram::Histogram() {
+    for (auto &count : _counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::record(std::uint64_t value) noexcept {
+    _counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+    update_max(_max, value);
+}
+
+std::size_t Histogram::bucket(std::uint64_t value) noexcept {
+    if (value < SUB_BUCKETS) {
+        return value;
+    }
+
+    auto bit = highest_bit(value);
+    if (bit >= MAX_BITS) {
+        return BUCKETS - 1;
+    }
+
+    auto shift = bit - SUB_BITS;
+
+    return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+std::uint64_t Histogram::lower_bound(std::size_t idx) noexcept {
+    if (idx < SUB_BUCKETS) {
+        return idx;
+    }
+
+    auto shift = idx / SUB_BUCKETS - 1;
+
+    return static_cast<std::uint64_t>(SUB_BUCKETS + idx % SUB_BUCKETS) << shift;
+}
+
+void HistogramSnapshot::merge(const Histogram &histogram) {
+    // Count is the sum of buckets, so that they're consistent, even if some
+    // values are being recorded.
+    for (std::size_t idx = 0; idx != Histogram::BUCKETS; ++idx) {
+        auto count = histogram._counts[idx].load(std::memory_order_relaxed);
+        _counts[idx] += count;
+        _count += count;
+    }
+
+    _sum += histogram._sum.load(std::memory_order_relaxed);
+    _max = std::max(_max, histogram._max.load(std::memory_order_relaxed));
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot &that) {
+    for (std::size_t idx = 0; idx != Histogram::BUCKETS; ++idx) {
+        _counts[idx] += that._counts[idx];
+    }
+
+    _count += that._count;
+    _sum += that._sum;
+    _max = std::max(_max, that._max);
+}
+
+std::uint64_t HistogramSnapshot::percentile(double p) const {
+    if (_count == 0) {
+        return 0;
+    }
+
+    p = std::min(std::max(p, 0.0), 100.0);
+    auto rank = static_cast<std::uint64_t>(std::ceil(p / 100 * _count));
+    rank = std::max<std::uint64_t>(rank, 1);
+
+    std::uint64_t seen = 0;
+    for (std::size_t idx = 0; idx != Histogram::BUCKETS; ++idx) {
+        seen += _counts[idx];
+        if (seen >= rank) {
+            return std::min(Histogram::upper_bound(idx), _max);
+        }
+    }
+
+    return _max;
+}
+
+Metrics::Metrics() : _id(++metrics_id) {}
+
+MetricsSnapshot Metrics::snapshot() const {
+    MetricsSnapshot snapshot;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (const auto &shard : _shards) {
+        std::lock_guard<std::mutex> shard_lock(shard->mutex);
+
+        for (const auto &entry : shard->commands) {
+            const auto &metrics = *entry.second;
+            auto &stats = snapshot.commands[entry.first];
+            stats.calls += metrics.calls.load(std::memory_order_relaxed);
+            stats.errors += metrics.errors.load(std::memory_order_relaxed);
+            stats.latency.merge(metrics.latency);
+        }
+
+        for (const auto &entry : shard->nodes) {
+            const auto &metrics = *entry.second;
+            auto &stats = snapshot.nodes[entry.first];
+            stats.calls += metrics.calls.load(std::memory_order_relaxed);
+            stats.errors += metrics.errors.load(std::memory_order_relaxed);
+            stats.bytes_in += metrics.bytes_in.load(std::memory_order_relaxed);
+            stats.bytes_out += metrics.bytes_out.load(std::memory_order_relaxed);
+            stats.reconnects += metrics.reconnects.load(std::memory_order_relaxed);
+            stats.moved += metrics.moved.load(std::memory_order_relaxed);
+            stats.ask += metrics.ask.load(std::memory_order_relaxed);
+            stats.latency.merge(metrics.latency);
+        }
+
+        snapshot.pool_wait.merge(shard->pool_wait);
+        snapshot.slot_updates += shard->slot_updates.load(std::memory_order_relaxed);
+        snapshot.slot_update_latency.merge(shard->slot_update_latency);
+    }
+
+    for (const auto &node : snapshot.nodes) {
+        merge_node(snapshot.total, node.second);
+    }
+
+    return snapshot;
+}
+
+Metrics::Shard& Metrics::_shard() {
+    // Most threads work with a single Metrics object, so cache the last one.
+    thread_local std::uint64_t last_id = 0;
+    thread_local Shard *last_shard = nullptr;
+
+    if (last_id == _id) {
+        return *last_shard;
+    }
+
+    // Metrics objects are never reused, since ids are unique. So entries of
+    // destroyed objects are never found, even if they're NOT removed.
+    thread_local std::unordered_map<std::uint64_t, Shard*> shards;
+
+    auto &shard = shards[_id];
+    if (shard == nullptr) {
+        std::unique_ptr<Shard> new_shard(new Shard);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _shards.push_back(std::move(new_shard));
+        shard = _shards.back().get();
+    }
+
+    last_id = _id;
+    last_shard = shard;
+
+    return *shard;
+}
+
+Metrics::CommandMetrics& Metrics::_command(Shard &shard, const StringView &name) {
+    std::string key(name.data(), name.size());
+    for (auto &c : key) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+
+    auto iter = shard.commands.find(key);
+    if (iter != shard.commands.end()) {
+        return *(iter->second);
+    }
+
+    std::unique_ptr<CommandMetrics> metrics(new CommandMetrics);
+    auto &entry = *metrics;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.commands.emplace(std::move(key), std::move(metrics));
+
+    return entry;
+}
+
+Metrics::NodeMetrics& Metrics::_node(Shard &shard, const std::string &node) {
+    auto iter = shard.nodes.find(node);
+    if (iter != shard.nodes.end()) {
+        return *(iter->second);
+    }
+
+    std::unique_ptr<NodeMetrics> metrics(new NodeMetrics);
+    auto &entry = *metrics;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.nodes.emplace(node, std::move(metrics));
+
+    return entry;
+}
+
+void Metrics::_record_pool_wait(std::chrono::steady_clock::duration wait) {
+    _shard().pool_wait.record(_to_us(wait));
+}
+
+void Metrics::_record_slot_update(std::chrono::steady_clock::duration duration) {
+    auto &shard = _shard();
+    shard.slot_updates.fetch_add(1, std::memory_order_relaxed);
+    shard.slot_update_latency.record(_to_us(duration));
+}
+
+void ConnectionMetrics::sent(const StringView &cmd_name) {
+    auto &shard = _metrics._shard();
+
+    _pending.push_back(PendingCommand{&_metrics._command(shard, cmd_name),
+                                        std::chrono::steady_clock::now()});
+}
+
+void ConnectionMetrics::received(const redisContext &ctx, bool error, const StringView &err) {
+    auto &node = _node_metrics();
+
+    node.bytes_in.fetch_add(ctx.nread - _bytes_in, std::memory_order_relaxed);
+    node.bytes_out.fetch_add(ctx.nwritten - _bytes_out, std::memory_order_relaxed);
+    _bytes_in = ctx.nread;
+    _bytes_out = ctx.nwritten;
+
+    if (error) {
+        node.errors.fetch_add(1, std::memory_order_relaxed);
+
+        if (err.size() > 6 && std::memcmp(err.data(), "MOVED ", 6) == 0) {
+            node.moved.fetch_add(1, std::memory_order_relaxed);
+        } else if (err.size() > 4 && std::memcmp(err.data(), "ASK ", 4) == 0) {
+            node.ask.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (_pending.empty()) {
+        // Reply of a command that we did NOT send, e.g. a pub/sub message.
+        return;
+    }
+
+    auto pending = _pending.front();
+    _pending.pop_front();
+
+    auto latency = Metrics::_to_us(std::chrono::steady_clock::now() - pending.start);
+
+    auto &cmd = *pending.metrics;
+    cmd.calls.fetch_add(1, std::memory_order_relaxed);
+    cmd.latency.record(latency);
+
+    node.calls.fetch_add(1, std::memory_order_relaxed);
+    node.latency.record(latency);
+
+    if (error) {
+        cmd.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void ConnectionMetrics::reconnected() {
+    _node_metrics().reconnects.fetch_add(1, std::memory_order_relaxed);
+}
+
+Metrics::NodeMetrics& ConnectionMetrics::_node_metrics() {
+    auto &shard = _metrics._shard();
+    if (&shard != _shard) {
+        _shard = &shard;
+        _node_entry = &_metrics._node(shard, _node);
+    }
+
+    return *_node_entry;
+}
@@ -0,0 +1,323 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#ifndef SEWENEW_REDISPLUSPLUS_METRICS_H
+#define SEWENEW_REDISPLUSPLUS_METRICS_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "hiredis.h"
+#include "utils.h"
+
+// Histogram of values, e.g. latencies in microseconds. Same as HdrHistogram, each
+// power of 2 is split into SUB_BUCKETS linear buckets, so that a value is recorded
+// with a relative error less than 1 / SUB_BUCKETS. Values NOT less than 2^MAX_BITS
+// are recorded in the last bucket. Recording is lock-free.
+class Histogram {
+public:
+    static const std::size_t SUB_BITS = 3;
+
+    static const std::size_t SUB_BUCKETS = 1 << SUB_BITS;
+
+    // 2^32 microseconds is about 71 minutes.
+    static const std::size_t MAX_BITS = 32;
+
+    static const std::size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    Histogram();
+
+    Histogram(const Histogram &) = delete;
+    Histogram& operator=(const Histogram &) = delete;
+
+    Histogram(Histogram &&) = delete;
+    Histogram& operator=(Histogram &&) = delete;
+
+    ~Histogram() = default;
+
+    void record(std::uint64_t value) noexcept;
+
+    // Index of the bucket that the value is recorded in.
+    static std::size_t bucket(std::uint64_t value) noexcept;
+
+    // Values in the bucket are in [lower_bound(idx), upper_bound(idx)],
+    // except that the last bucket also has larger values.
+    static std::uint64_t lower_bound(std::size_t idx) noexcept;
+
+    static std::uint64_t upper_bound(std::size_t idx) noexcept {
+        return lower_bound(idx + 1) - 1;
+    }
+
+private:
+    friend class HistogramSnapshot;
+
+    std::atomic<std::uint64_t> _counts[BUCKETS];
+
+    std::atomic<std::uint64_t> _sum{0};
+
+    std::atomic<std::uint64_t> _max{0};
+};
+
+// Point-in-time copy of one or more histograms.
+class HistogramSnapshot {
+public:
+    HistogramSnapshot() : _counts(Histogram::BUCKETS, 0) {}
+
+    void merge(const Histogram &histogram);
+
+    void merge(const HistogramSnapshot &that);
+
+    std::uint64_t count() const {
+        return _count;
+    }
+
+    std::uint64_t sum() const {
+        return _sum;
+    }
+
+    std::uint64_t max() const {
+        return _max;
+    }
+
+    double mean() const {
+        return _count == 0 ? 0 : static_cast<double>(_sum) / _count;
+    }
+
+    // Upper bound of the bucket with the value at the given percentile, e.g. 99.9.
+    // It's capped with the max recorded value. Return 0 if it's empty.
+    std::uint64_t percentile(double p) const;
+
+    // Count of each bucket. See *Histogram::lower_bound* and *Histogram::upper_bound*.
+    const std::vector<std::uint64_t>& counts() const {
+        return _counts;
+    }
+
+private:
+    std::vector<std::uint64_t> _counts;
+
+    std::uint64_t _count = 0;
+
+    std::uint64_t _sum = 0;
+
+    std::uint64_t _max = 0;
+};
+
+struct CommandStats {
+    long long calls = 0;
+
+    // Number of error replies.
+    long long errors = 0;
+
+    // Microseconds from sending the command, i.e. appending it to the output buffer,
+    // to receiving its reply.
+    HistogramSnapshot latency;
+};
+
+struct NodeStats {
+    long long calls = 0;
+
+    long long errors = 0;
+
+    long long bytes_in = 0;
+
+    long long bytes_out = 0;
+
+    long long reconnects = 0;
+
+    // Number of MOVED and ASK errors, i.e. redirections of Redis Cluster.
+    long long moved = 0;
+
+    long long ask = 0;
+
+    HistogramSnapshot latency;
+};
+
+struct MetricsSnapshot {
+    // By command name in upper case, e.g. GET.
+    std::map<std::string, CommandStats> commands;
+
+    // By node, i.e. host:port, or the path of a unix domain socket.
+    std::map<std::string, NodeStats> nodes;
+
+    // Sum of all nodes.
+    NodeStats total;
+
+    // Microseconds to fetch a connection from a pool, including waiting for an idle one,
+    // creating or reconnecting it.
+    HistogramSnapshot pool_wait;
+
+    // Number of full refreshes of the Redis Cluster slot mapping, and microseconds
+    // that each of them takes.
+    long long slot_updates = 0;
+
+    HistogramSnapshot slot_update_latency;
+};
+
+// Metrics of connections, pools and cluster slot mapping. Set it to *ConnectionOptions::metrics*
+// to record metrics of connections created with these options, and pools and clusters
+// created with these options, e.g. *Redis* and *RedisCluster* objects.
+//
+// Each thread records into its own shard, and *snapshot* aggregates all shards, so that
+// recording never contends on a lock. Thread-safe.
+//
+// NOTE: Connections of *AsyncRedis* and multiplexing pools are NOT recorded. Latencies of
+// commands that have no reply or more than one reply, e.g. SUBSCRIBE, are NOT accurate.
+class Metrics {
+public:
+    Metrics();
+
+    Metrics(const Metrics &) = delete;
+    Metrics& operator=(const Metrics &) = delete;
+
+    Metrics(Metrics &&) = delete;
+    Metrics& operator=(Metrics &&) = delete;
+
+    ~Metrics() = default;
+
+    MetricsSnapshot snapshot() const;
+
+private:
+    friend class ConnectionMetrics;
+
+    friend class ConnectionPool;
+
+    friend class ShardsPool;
+
+    struct CommandMetrics {
+        std::atomic<long long> calls{0};
+        std::atomic<long long> errors{0};
+        Histogram latency;
+    };
+
+    struct NodeMetrics {
+        std::atomic<long long> calls{0};
+        std::atomic<long long> errors{0};
+        std::atomic<long long> bytes_in{0};
+        std::atomic<long long> bytes_out{0};
+        std::atomic<long long> reconnects{0};
+        std::atomic<long long> moved{0};
+        std::atomic<long long> ask{0};
+        Histogram latency;
+    };
+
+    // Metrics recorded by a thread. Only the owner thread adds entries, and it looks up
+    // entries without locking. Other threads might update entries with atomic operations.
+    struct Shard {
+        // Protects adding entries, and reading entries by *snapshot*.
+        std::mutex mutex;
+
+        std::unordered_map<std::string, std::unique_ptr<CommandMetrics>> commands;
+
+        std::unordered_map<std::string, std::unique_ptr<NodeMetrics>> nodes;
+
+        Histogram pool_wait;
+
+        std::atomic<long long> slot_updates{0};
+
+        Histogram slot_update_latency;
+    };
+
+    // Shard of the current thread.
+    Shard& _shard();
+
+    // Entry of the command, which is added if it does NOT exist. Only called by the owner.
+    CommandMetrics& _command(Shard &shard, const StringView &name);
+
+    NodeMetrics& _node(Shard &shard, const std::string &node);
+
+    void _record_pool_wait(std::chrono::steady_clock::duration wait);
+
+    void _record_slot_update(std::chrono::steady_clock::duration duration);
+
+    static std::uint64_t _to_us(std::chrono::steady_clock::duration duration) {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        return us < 0 ? 0 : static_cast<std::uint64_t>(us);
+    }
+
+    // Unique for each Metrics object, and used to find the shard of the current thread.
+    const std::uint64_t _id;
+
+    // Protects *_shards*.
+    mutable std::mutex _mutex;
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+};
+
+using MetricsSPtr = std::shared_ptr<Metrics>;
+
+// Records metrics of a connection: commands are timed from *sent* to the matching
+// *received*, in order, so that pipelined commands are also timed.
+// NOT thread-safe, same as Connection.
+class ConnectionMetrics {
+public:
+    ConnectionMetrics(Metrics &metrics, std::string node) :
+                        _metrics(metrics), _node(std::move(node)) {}
+
+    ConnectionMetrics(const ConnectionMetrics &) = delete;
+    ConnectionMetrics& operator=(const ConnectionMetrics &) = delete;
+
+    ConnectionMetrics(ConnectionMetrics &&) = delete;
+    ConnectionMetrics& operator=(ConnectionMetrics &&) = delete;
+
+    ~ConnectionMetrics() = default;
+
+    // Called after a command is appended to the output buffer.
+    void sent(const StringView &cmd_name);
+
+    // Called with each reply. *err* is the message of an error reply.
+    void received(const redisContext &ctx, bool error, const StringView &err = {});
+
+    void reconnected();
+
+    // Forget commands waiting for replies, e.g. they've been discarded.
+    void reset() {
+        _pending.clear();
+    }
+
+private:
+    struct PendingCommand {
+        Metrics::CommandMetrics *metrics;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    Metrics::NodeMetrics& _node_metrics();
+
+    Metrics &_metrics;
+
+    std::string _node;
+
+    // Entry of the node in the shard of the last thread that used the connection.
+    Metrics::Shard *_shard = nullptr;
+
+    Metrics::NodeMetrics *_node_entry = nullptr;
+
+    std::deque<PendingCommand> _pending;
+
+    // Bytes of the context that have been recorded.
+    unsigned long long _bytes_in = 0;
+
+    unsigned long long _bytes_out = 0;
+};
+
+#endif // end SEWENEW_REDISPLUSPLUS_METRICS_H
@@ -0,0 +1,434 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#include "metrics_exporter.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "errors.h"
+
+namespace {
+
+// Max size of an HTTP request header that we read.
+const std::size_t MAX_REQUEST_SIZE = 8 * 1024;
+
+// Timeout of reading a request, or writing a response, so that a stuck client
+// doesn't block the server for long.
+const long IO_TIMEOUT_MS = 1000;
+
+std::string escape_label(const std::string &value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (auto c : value) {
+        switch (c) {
+        case '\\':
+            escaped += "\\\\";
+            break;
+
+        case '"':
+            escaped += "\\\"";
+            break;
+
+        case '\n':
+            escaped += "\\n";
+            break;
+
+        default:
+            escaped += c;
+            break;
+        }
+    }
+
+    return escaped;
+}
+
+std::string format_double(double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.15g", value);
+    return buf;
+}
+
+// Labels of a sample, e.g. {command="GET",le="0.001"}.
+std::string labels(const std::string &name,
+                    const std::string &value,
+                    const std::string &le = "") {
+    std::string out;
+    if (!name.empty()) {
+        out += name + "=\"" + escape_label(value) + "\"";
+    }
+
+    if (!le.empty()) {
+        if (!out.empty()) {
+            out += ",";
+        }
+        out += "le=\"" + le + "\"";
+    }
+
+    return out.empty() ? out : "{" + out + "}";
+}
+
+void close_fd(int &fd) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void set_timeout(int fd) {
+    timeval tv;
+    tv.tv_sec = IO_TIMEOUT_MS / 1000;
+    tv.tv_usec = (IO_TIMEOUT_MS % 1000) * 1000;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+}
+
+std::string PrometheusExporter::render(const MetricsSnapshot &snapshot) const {
+    std::string out;
+
+    std::vector<std::pair<std::string, long long>> calls;
+    std::vector<std::pair<std::string, long long>> errors;
+    std::vector<std::pair<std::string, const HistogramSnapshot*>> latencies;
+    for (const auto &cmd : snapshot.commands) {
+        calls.emplace_back(cmd.first, cmd.second.calls);
+        errors.emplace_back(cmd.first, cmd.second.errors);
+        latencies.emplace_back(cmd.first, &cmd.second.latency);
+    }
+
+    _counter(out, "command_calls_total", "Replies received, by command.", "command", calls);
+    _counter(out, "command_errors_total", "Error replies received, by command.", "command", errors);
+    _histogram(out, "command_duration_seconds",
+                "Time from sending a command to receiving its reply, by command.",
+                "command", latencies);
+
+    calls.clear();
+    errors.clear();
+    latencies.clear();
+    std::vector<std::pair<std::string, long long>> bytes_in;
+    std::vector<std::pair<std::string, long long>> bytes_out;
+    std::vector<std::pair<std::string, long long>> reconnects;
+    std::vector<std::pair<std::string, long long>> moved;
+    std::vector<std::pair<std::string, long long>> ask;
+    for (const auto &node : snapshot.nodes) {
+        const auto &stats = node.second;
+        calls.emplace_back(node.first, stats.calls);
+        errors.emplace_back(node.first, stats.errors);
+        bytes_in.emplace_back(node.first, stats.bytes_in);
+        bytes_out.emplace_back(node.first, stats.bytes_out);
+        reconnects.emplace_back(node.first, stats.reconnects);
+        moved.emplace_back(node.first, stats.moved);
+        ask.emplace_back(node.first, stats.ask);
+        latencies.emplace_back(node.first, &stats.latency);
+    }
+
+    _counter(out, "node_calls_total", "Replies received, by node.", "node", calls);
+    _counter(out, "node_errors_total", "Error replies received, by node.", "node", errors);
+    _counter(out, "node_received_bytes_total", "Bytes read from sockets, by node.",
+                "node", bytes_in);
+    _counter(out, "node_sent_bytes_total", "Bytes written to sockets, by node.",
+                "node", bytes_out);
+    _counter(out, "node_reconnects_total", "Reconnections, by node.", "node", reconnects);
+    _counter(out, "node_moved_total", "MOVED redirections, by node.", "node", moved);
+    _counter(out, "node_ask_total", "ASK redirections, by node.", "node", ask);
+    _histogram(out, "node_duration_seconds",
+                "Time from sending a command to receiving its reply, by node.",
+                "node", latencies);
+
+    _histogram(out, "pool_wait_seconds",
+                "Time to fetch a connection from a pool.",
+                "", {{"", &snapshot.pool_wait}});
+
+    _counter(out, "slot_updates_total", "Full refreshes of the cluster slot mapping.",
+                "", {{"", snapshot.slot_updates}});
+    _histogram(out, "slot_update_duration_seconds",
+                "Time of a full refresh of the cluster slot mapping.",
+                "", {{"", &snapshot.slot_update_latency}});
+
+    return out;
+}
+
+void PrometheusExporter::_header(std::string &out,
+                                    const std::string &name,
+                                    const std::string &help,
+                                    const std::string &type) const {
+    out += "# HELP " + _opts.prefix + "_" + name + " " + help + "\n";
+    out += "# TYPE " + _opts.prefix + "_" + name + " " + type + "\n";
+}
+
+void PrometheusExporter::_counter(std::string &out,
+                                    const std::string &name,
+                                    const std::string &help,
+                                    const std::string &label,
+                                    const std::vector<std::pair<std::string, long long>> &values) const {
+    if (values.empty()) {
+        return;
+    }
+
+    _header(out, name, help, "counter");
+
+    for (const auto &value : values) {
+        out += _opts.prefix + "_" + name + labels(label, value.first)
+                + " " + std::to_string(value.second) + "\n";
+    }
+}
+
+void PrometheusExporter::_histogram(std::string &out,
+                                    const std::string &name,
+                                    const std::string &help,
+                                    const std::string &label,
+                                    const std::vector<std::pair<std::string,
+                                        const HistogramSnapshot*>> &values) const {
+    if (values.empty()) {
+        return;
+    }
+
+    _header(out, name, help, "histogram");
+
+    auto metric = _opts.prefix + "_" + name;
+    for (const auto &value : values) {
+        const auto &histogram = *value.second;
+        const auto &counts = histogram.counts();
+
+        // Buckets of *Histogram* are in microseconds, and in ascending order.
+        std::size_t idx = 0;
+        std::uint64_t cumulative = 0;
+        for (auto bound : _opts.buckets) {
+            auto bound_us = bound * 1e6;
+            while (idx != counts.size() && Histogram::upper_bound(idx) <= bound_us) {
+                cumulative += counts[idx];
+                ++idx;
+            }
+
+            out += metric + "_bucket" + labels(label, value.first, format_double(bound))
+                    + " " + std::to_string(cumulative) + "\n";
+        }
+
+        out += metric + "_bucket" + labels(label, value.first, "+Inf")
+                + " " + std::to_string(histogram.count()) + "\n";
+        out += metric + "_sum" + labels(label, value.first)
+                + " " + format_double(histogram.sum() / 1e6) + "\n";
+        out += metric + "_count" + labels(label, value.first)
+                + " " + std::to_string(histogram.count()) + "\n";
+    }
+}
+
+MetricsServer::MetricsServer(MetricsSPtr metrics,
+                                const MetricsServerOptions &opts,
+                                MetricsExporterSPtr exporter) :
+                                _metrics(std::move(metrics)),
+                                _opts(opts),
+                                _exporter(std::move(exporter)) {
+    if (!_metrics) {
+        throw Error("Metrics is NOT set");
+    }
+
+    if (!_exporter) {
+        _exporter = std::make_shared<PrometheusExporter>();
+    }
+
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo *res = nullptr;
+    auto port = std::to_string(_opts.port);
+    auto err = ::getaddrinfo(_opts.host.empty() ? nullptr : _opts.host.c_str(),
+                                port.c_str(),
+                                &hints,
+                                &res);
+    if (err != 0) {
+        throw Error("Failed to resolve " + _opts.host + ": " + ::gai_strerror(err));
+    }
+
+    std::string errmsg = "no address";
+    for (auto *addr = res; addr != nullptr; addr = addr->ai_next) {
+        _listen_fd = ::socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (_listen_fd < 0) {
+            errmsg = std::strerror(errno);
+            continue;
+        }
+
+        int on = 1;
+        ::setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if (::bind(_listen_fd, addr->ai_addr, addr->ai_addrlen) == 0
+                && ::listen(_listen_fd, 16) == 0) {
+            break;
+        }
+
+        errmsg = std::strerror(errno);
+        close_fd(_listen_fd);
+    }
+
+    ::freeaddrinfo(res);
+
+    if (_listen_fd < 0) {
+        throw Error("Failed to listen on " + _opts.host + ":" + port + ": " + errmsg);
+    }
+
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (::getsockname(_listen_fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0) {
+        if (addr.ss_family == AF_INET) {
+            _port = ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+        } else if (addr.ss_family == AF_INET6) {
+            _port = ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+        }
+    }
+
+    if (::pipe(_wakeup_fds) != 0) {
+        errmsg = std::strerror(errno);
+        close_fd(_listen_fd);
+        throw Error("Failed to create pipe: " + errmsg);
+    }
+
+    _thread = std::thread([this]() { _run(); });
+}
+
+MetricsServer::~MetricsServer() {
+    // Wake up the thread, and it exits once it sees the pipe is readable.
+    char c = 0;
+    while (::write(_wakeup_fds[1], &c, 1) < 0 && errno == EINTR) {}
+
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    close_fd(_listen_fd);
+    close_fd(_wakeup_fds[0]);
+    close_fd(_wakeup_fds[1]);
+}
+
+void MetricsServer::_run() {
+    pollfd fds[2];
+    fds[0].fd = _wakeup_fds[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = _listen_fd;
+    fds[1].events = POLLIN;
+
+    while (true) {
+        fds[0].revents = fds[1].revents = 0;
+        if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        if (fds[0].revents != 0) {
+            // Stopped.
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            auto fd = ::accept(_listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                _serve(fd);
+                ::close(fd);
+            }
+        }
+    }
+}
+
+void MetricsServer::_serve(int fd) {
+    set_timeout(fd);
+
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos
+            && request.size() < MAX_REQUEST_SIZE) {
+        auto n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return;
+        }
+
+        request.append(buf, n);
+    }
+
+    auto response = _response(request);
+
+    std::size_t sent = 0;
+    while (sent < response.size()) {
+        auto n = ::send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            return;
+        }
+
+        sent += n;
+    }
+}
+
+std::string MetricsServer::_response(const std::string &request) const {
+    // Request line, e.g. GET /metrics HTTP/1.1
+    auto line = request.substr(0, request.find("\r\n"));
+
+    auto method_end = line.find(' ');
+    auto target_end = line.find(' ', method_end == std::string::npos ? 0 : method_end + 1);
+
+    std::string method;
+    std::string status;
+    std::string content_type = "text/plain; charset=utf-8";
+    std::string body;
+    if (method_end == std::string::npos || target_end == std::string::npos) {
+        status = "400 Bad Request";
+        body = "Bad Request\n";
+    } else {
+        method = line.substr(0, method_end);
+        auto target = line.substr(method_end + 1, target_end - method_end - 1);
+        target = target.substr(0, target.find('?'));
+
+        if (target != _opts.path) {
+            status = "404 Not Found";
+            body = "Not Found\n";
+        } else if (method != "GET" && method != "HEAD") {
+            status = "405 Method Not Allowed";
+            body = "Method Not Allowed\n";
+        } else {
+            status = "200 OK";
+            content_type = _exporter->content_type();
+            body = _exporter->render(_metrics->snapshot());
+        }
+    }
+
+    auto response = "HTTP/1.1 " + status + "\r\nContent-Type: " + content_type
+                    + "\r\nContent-Length: " + std::to_string(body.size())
+                    + "\r\nConnection: close\r\n\r\n";
+    if (method != "HEAD") {
+        response += body;
+    }
+
+    return response;
+}
@@ -0,0 +1,141 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#ifndef SEWENEW_REDISPLUSPLUS_METRICS_EXPORTER_H
+#define SEWENEW_REDISPLUSPLUS_METRICS_EXPORTER_H
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+
+// Renders a snapshot of metrics, e.g. for a scraper. Implement it for other formats.
+class MetricsExporter {
+public:
+    virtual ~MetricsExporter() = default;
+
+    virtual std::string render(const MetricsSnapshot &snapshot) const = 0;
+
+    // Content type of the rendered text, e.g. for an HTTP response.
+    virtual std::string content_type() const = 0;
+};
+
+using MetricsExporterSPtr = std::shared_ptr<MetricsExporter>;
+
+struct PrometheusExporterOptions {
+    // Prefix of metric names.
+    std::string prefix = "redis_client";
+
+    // Upper bounds of histogram buckets in seconds. Counts are rounded to the
+    // buckets of *Histogram*, i.e. with less than 12.5% error.
+    std::vector<double> buckets = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+                                    0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+};
+
+// Prometheus text exposition format, version 0.0.4. Latencies are in seconds,
+// command metrics are labeled with *command*, and node metrics with *node*.
+class PrometheusExporter : public MetricsExporter {
+public:
+    explicit PrometheusExporter(const PrometheusExporterOptions &opts = {}) : _opts(opts) {}
+
+    virtual std::string render(const MetricsSnapshot &snapshot) const override;
+
+    virtual std::string content_type() const override {
+        return "text/plain; version=0.0.4; charset=utf-8";
+    }
+
+private:
+    void _counter(std::string &out,
+                    const std::string &name,
+                    const std::string &help,
+                    const std::string &label,
+                    const std::vector<std::pair<std::string, long long>> &values) const;
+
+    void _histogram(std::string &out,
+                    const std::string &name,
+                    const std::string &help,
+                    const std::string &label,
+                    const std::vector<std::pair<std::string, const HistogramSnapshot*>> &values) const;
+
+    void _header(std::string &out,
+                    const std::string &name,
+                    const std::string &help,
+                    const std::string &type) const;
+
+    PrometheusExporterOptions _opts;
+};
+
+struct MetricsServerOptions {
+    // Only serve local scrapers by default.
+    std::string host = "127.0.0.1";
+
+    // 0 means a random port, see *MetricsServer::port*.
+    int port = 9121;
+
+    std::string path = "/metrics";
+};
+
+// A tiny HTTP server, which renders a snapshot of metrics for each GET request of
+// *MetricsServerOptions::path*. Requests are served one by one with a background
+// thread. Taking a snapshot never blocks recording, see *Metrics*.
+class MetricsServer {
+public:
+    // If *exporter* is null, a *PrometheusExporter* with default options is used.
+    // Throw Error if it fails to listen on the address.
+    MetricsServer(MetricsSPtr metrics,
+                    const MetricsServerOptions &opts = {},
+                    MetricsExporterSPtr exporter = nullptr);
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer& operator=(const MetricsServer &) = delete;
+
+    MetricsServer(MetricsServer &&) = delete;
+    MetricsServer& operator=(MetricsServer &&) = delete;
+
+    // Stop the server, and wait for the request being served.
+    ~MetricsServer();
+
+    // The port that it listens on.
+    int port() const {
+        return _port;
+    }
+
+private:
+    void _run();
+
+    void _serve(int fd);
+
+    std::string _response(const std::string &request) const;
+
+    MetricsSPtr _metrics;
+
+    MetricsServerOptions _opts;
+
+    MetricsExporterSPtr _exporter;
+
+    int _listen_fd = -1;
+
+    // Self-pipe to wake up the thread.
+    int _wakeup_fds[2] = {-1, -1};
+
+    int _port = 0;
+
+    std::thread _thread;
+};
+
+#endif // end SEWENEW_REDISPLUSPLUS_METRICS_EXPORTER_H
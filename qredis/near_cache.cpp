@@ -0,0 +1,314 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#include "near_cache.h"
+#include <sys/socket.h>
+#include "command_args.h"
+
+namespace {
+
+// Estimated memory of an entry besides its key and values, i.e. hash nodes,
+// LRU node, and the copy of the key in the LRU list.
+const std::size_t ENTRY_OVERHEAD = 128;
+
+const std::string INVALIDATE_CHANNEL = "__redis__:invalidate";
+
+}
+
+NearCache::NearCache(const ConnectionOptions &connection_opts, const NearCacheOptions &opts) :
+                        _connection_opts(connection_opts), _opts(opts) {
+    // Invalidation messages are delivered as pub/sub messages, which work with RESP2.
+    // The connection blocks until it's woken up by the destructor.
+    _connection_opts.resp = 2;
+    _connection_opts.push_handler = nullptr;
+    _connection_opts.socket_timeout = std::chrono::milliseconds(0);
+    _connection_opts.readonly = false;
+
+    _thread = std::thread([this]() { _run(); });
+}
+
+NearCache::~NearCache() {
+    {
+        std::lock_guard<std::mutex> lock(_connection_mutex);
+
+        _stopped = true;
+
+        if (_connection != nullptr) {
+            // Wake up the thread, which is blocking on reading invalidation messages.
+            ::shutdown(_connection->_context()->fd, SHUT_RDWR);
+        }
+    }
+
+    _cv.notify_all();
+
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void NearCache::invalidate(const StringView &key) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto iter = _entries.find(std::string(key.data(), key.size()));
+    if (iter != _entries.end()) {
+        _erase(iter);
+    }
+}
+
+void NearCache::invalidate() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _clear();
+}
+
+NearCacheStats NearCache::stats() const {
+    NearCacheStats stats;
+    stats.hits = _hits.load();
+    stats.misses = _misses.load();
+    stats.invalidations = _invalidations.load();
+    stats.evictions = _evictions.load();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    stats.keys = _entries.size();
+    stats.memory = _memory;
+
+    return stats;
+}
+
+bool NearCache::_cacheable(const StringView &key) const {
+    if (_opts.prefixes.empty()) {
+        return true;
+    }
+
+    for (const auto &prefix : _opts.prefixes) {
+        if (key.size() >= prefix.size()
+                && std::char_traits<char>::compare(key.data(), prefix.data(), prefix.size()) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+NearCache::Entry* NearCache::_find(const std::string &key) {
+    auto iter = _entries.find(key);
+    if (iter == _entries.end()) {
+        return nullptr;
+    }
+
+    auto &entry = iter->second;
+    _lru.splice(_lru.begin(), _lru, entry.lru);
+
+    return &entry;
+}
+
+std::uint64_t NearCache::_reserve(const std::string &key) {
+    auto iter = _entries.find(key);
+    if (iter != _entries.end()) {
+        return iter->second.token;
+    }
+
+    _lru.push_front(key);
+
+    Entry entry;
+    entry.lru = _lru.begin();
+    entry.token = ++_next_token;
+    entry.memory = 2 * key.size() + ENTRY_OVERHEAD;
+
+    _memory += entry.memory;
+
+    auto token = entry.token;
+    _entries.emplace(key, std::move(entry));
+
+    return token;
+}
+
+NearCache::Entry* NearCache::_find(const std::string &key, std::uint64_t token) {
+    auto iter = _entries.find(key);
+    if (iter == _entries.end() || iter->second.token != token) {
+        return nullptr;
+    }
+
+    return &iter->second;
+}
+
+void NearCache::_charge(const std::string &key, Entry &entry, std::size_t memory) {
+    entry.memory += memory;
+    _memory += memory;
+
+    // Evict least recently used keys, but keep the key we just cached if possible.
+    while (_memory > _opts.max_memory && !_lru.empty() && _lru.back() != key) {
+        auto iter = _entries.find(_lru.back());
+
+        assert(iter != _entries.end());
+
+        _erase(iter);
+
+        ++_evictions;
+    }
+
+    if (_memory > _opts.max_memory) {
+        // The key alone is too large.
+        auto iter = _entries.find(key);
+        if (iter != _entries.end()) {
+            _erase(iter);
+
+            ++_evictions;
+        }
+    }
+}
+
+void NearCache::_erase(EntryMap::iterator iter) {
+    auto &entry = iter->second;
+
+    assert(_memory >= entry.memory);
+
+    _memory -= entry.memory;
+    _lru.erase(entry.lru);
+    _entries.erase(iter);
+}
+
+void NearCache::_clear() {
+    _entries.clear();
+    _lru.clear();
+    _memory = 0;
+}
+
+void NearCache::_run() {
+    while (true) {
+        try {
+            _consume();
+        } catch (const Error &) {
+            // Connection is broken, or we're stopped.
+        }
+
+        {
+            // Without invalidation messages, we cannot tell if cached keys are stale.
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            _tracking = false;
+            _clear();
+        }
+
+        std::unique_lock<std::mutex> lock(_connection_mutex);
+        if (_cv.wait_for(lock, _opts.reconnect_interval, [this]() { return _stopped; })) {
+            break;
+        }
+    }
+}
+
+void NearCache::_consume() {
+    Connection connection(_connection_opts);
+
+    _set_connection(&connection);
+
+    try {
+        _subscribe(connection);
+
+        while (true) {
+            auto reply = connection.recv();
+
+            _handle_message(*reply);
+        }
+    } catch (...) {
+        _set_connection(nullptr);
+        throw;
+    }
+}
+
+void NearCache::_subscribe(Connection &connection) {
+    connection.send("CLIENT ID");
+
+    auto id = reply::parse<long long>(*connection.recv());
+
+    // Track keys in BCAST mode, so that we get invalidation messages of keys
+    // modified by anyone, no matter which connection has read them.
+    CmdArgs args;
+    args << "CLIENT" << "TRACKING" << "ON" << "REDIRECT" << id << "BCAST";
+    for (const auto &prefix : _opts.prefixes) {
+        args << "PREFIX" << prefix;
+    }
+
+    connection.send(args);
+
+    reply::parse<void>(*connection.recv());
+
+    connection.send("SUBSCRIBE %b", INVALIDATE_CHANNEL.data(), INVALIDATE_CHANNEL.size());
+
+    // Reply of SUBSCRIBE command.
+    connection.recv();
+
+    // Keys cached before the connection is established might be stale.
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _clear();
+    _tracking = true;
+}
+
+void NearCache::_handle_message(redisReply &reply) {
+    // ["message", "__redis__:invalidate", keys], and keys is nil if all keys are invalidated.
+    if (!reply::is_array(reply) || reply.elements != 3 || reply.element == nullptr) {
+        throw ProtoError("Invalid invalidation message");
+    }
+
+    auto *type_reply = reply.element[0];
+    auto *keys_reply = reply.element[2];
+    if (type_reply == nullptr || keys_reply == nullptr) {
+        throw ProtoError("Null invalidation message");
+    }
+
+    if (reply::parse<std::string>(*type_reply) != "message") {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (reply::is_nil(*keys_reply)) {
+        _invalidations += _entries.size();
+        _clear();
+        return;
+    }
+
+    if (!reply::is_array(*keys_reply)) {
+        throw ProtoError("Expect ARRAY reply of invalidated keys");
+    }
+
+    for (std::size_t idx = 0; idx != keys_reply->elements; ++idx) {
+        auto *key_reply = keys_reply->element[idx];
+        if (key_reply == nullptr) {
+            throw ProtoError("Null invalidated key");
+        }
+
+        auto iter = _entries.find(reply::parse<std::string>(*key_reply));
+        if (iter != _entries.end()) {
+            _erase(iter);
+
+            ++_invalidations;
+        }
+    }
+}
+
+void NearCache::_set_connection(Connection *connection) {
+    std::lock_guard<std::mutex> lock(_connection_mutex);
+
+    if (connection != nullptr && _stopped) {
+        throw Error("Near cache has been stopped");
+    }
+
+    _connection = connection;
+}
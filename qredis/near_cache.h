@@ -0,0 +1,368 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#ifndef SEWENEW_REDISPLUSPLUS_NEAR_CACHE_H
+#define SEWENEW_REDISPLUSPLUS_NEAR_CACHE_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "connection.h"
+#include "errors.h"
+#include "reply.h"
+#include "utils.h"
+
+struct NearCacheOptions {
+    // Max memory of cached keys and values in bytes, which is an estimation.
+    // Least recently used keys are evicted.
+    std::size_t max_memory = 64 * 1024 * 1024;
+
+    // Only keys with these prefixes are cached, and Redis only sends invalidation
+    // messages of these keys. If it's empty, all keys are cached, and Redis sends
+    // an invalidation message for every write in the DB, by any client. Unless the
+    // write rate is low, set the prefixes of keys that are worth caching.
+    std::vector<std::string> prefixes;
+
+    // Interval to reconnect the invalidation connection, if it's broken.
+    std::chrono::milliseconds reconnect_interval{1000};
+};
+
+struct NearCacheStats {
+    long long hits = 0;
+
+    long long misses = 0;
+
+    // Number of keys invalidated by Redis.
+    long long invalidations = 0;
+
+    // Number of keys evicted by LRU.
+    long long evictions = 0;
+
+    std::size_t keys = 0;
+
+    std::size_t memory = 0;
+};
+
+// Client side cache of GET, HGET and HMGET replies, i.e. a near cache, which is kept
+// coherent with server-assisted invalidation. A dedicated connection enables
+// CLIENT TRACKING in BCAST mode, redirected to itself, and subscribes to the
+// __redis__:invalidate channel, so that it works with RESP2 and connections in
+// the pool need no setup. If the connection is broken, the cache is flushed and
+// bypassed until it's reconnected. It requires Redis 6.0 or later. Thread-safe.
+//
+// *Redis* also drops a key as soon as its own write command on the key returns, so
+// that it can read its writes. Writes sent with the generic *command* methods,
+// pipelines, transactions and scripts are NOT covered. Keys written that way
+// might be read stale until Redis's invalidation message arrives.
+class NearCache {
+public:
+    NearCache(const ConnectionOptions &connection_opts, const NearCacheOptions &opts);
+
+    NearCache(const NearCache &) = delete;
+    NearCache& operator=(const NearCache &) = delete;
+
+    NearCache(NearCache &&) = delete;
+    NearCache& operator=(NearCache &&) = delete;
+
+    // Close the invalidation connection, and stop its thread.
+    ~NearCache();
+
+    // Return the cached value of the key, or call *fetch* to get it from Redis, and cache it.
+    template <typename Fetch>
+    OptionalString get(const StringView &key, Fetch fetch);
+
+    template <typename Fetch>
+    OptionalString hget(const StringView &key, const StringView &field, Fetch fetch);
+
+    // *fetch* is called with fields that are NOT cached, and returns their values in order.
+    template <typename Fetch>
+    std::vector<OptionalString> hmget(const StringView &key,
+                                        const std::vector<std::string> &fields,
+                                        Fetch fetch);
+
+    // Drop the key, e.g. after it's modified by ourselves, so that we can read our writes
+    // before the invalidation message arrives.
+    void invalidate(const StringView &key);
+
+    // Drop all keys.
+    void invalidate();
+
+    NearCacheStats stats() const;
+
+private:
+    struct Entry {
+        std::list<std::string>::iterator lru;
+
+        // Unique for each entry. A value fetched before the key is invalidated is
+        // NOT cached, since the entry has been erased, or recreated with a new token.
+        std::uint64_t token = 0;
+
+        bool has_value = false;
+
+        OptionalString value;
+
+        std::unordered_map<std::string, OptionalString> fields;
+
+        std::size_t memory = 0;
+    };
+
+    using EntryMap = std::unordered_map<std::string, Entry>;
+
+    bool _cacheable(const StringView &key) const;
+
+    // The following methods are NOT thread-safe, and should be called with *_mutex* held.
+
+    // Find the entry, and mark it as the most recently used one.
+    Entry* _find(const std::string &key);
+
+    // Return the token of the entry, which is created if it doesn't exist.
+    std::uint64_t _reserve(const std::string &key);
+
+    // Find the entry, only if its token is unchanged.
+    Entry* _find(const std::string &key, std::uint64_t token);
+
+    // Account memory of newly cached data, and evict keys if necessary.
+    void _charge(const std::string &key, Entry &entry, std::size_t memory);
+
+    void _erase(EntryMap::iterator iter);
+
+    void _clear();
+
+    // Thread function of the invalidation connection.
+    void _run();
+
+    // Connect, and read invalidation messages until the connection is broken.
+    void _consume();
+
+    void _subscribe(Connection &connection);
+
+    void _handle_message(redisReply &reply);
+
+    // Set the connection that the thread is reading, so that we can wake it up.
+    void _set_connection(Connection *connection);
+
+    ConnectionOptions _connection_opts;
+
+    NearCacheOptions _opts;
+
+    mutable std::mutex _mutex;
+
+    EntryMap _entries;
+
+    // Keys in LRU order, i.e. the most recently used one is the first.
+    std::list<std::string> _lru;
+
+    std::size_t _memory = 0;
+
+    std::uint64_t _next_token = 0;
+
+    // Whether the invalidation connection is subscribed. Protected by *_mutex*.
+    bool _tracking = false;
+
+    std::atomic<long long> _hits{0};
+
+    std::atomic<long long> _misses{0};
+
+    std::atomic<long long> _invalidations{0};
+
+    std::atomic<long long> _evictions{0};
+
+    // Protect *_connection* and *_stopped*.
+    std::mutex _connection_mutex;
+
+    std::condition_variable _cv;
+
+    Connection *_connection = nullptr;
+
+    bool _stopped = false;
+
+    std::thread _thread;
+};
+
+// Inline implementations.
+
+template <typename Fetch>
+OptionalString NearCache::get(const StringView &key, Fetch fetch) {
+    if (!_cacheable(key)) {
+        ++_misses;
+        return fetch();
+    }
+
+    std::string cache_key(key.data(), key.size());
+    std::uint64_t token = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_tracking) {
+            auto *entry = _find(cache_key);
+            if (entry != nullptr && entry->has_value) {
+                ++_hits;
+                return entry->value;
+            }
+
+            token = _reserve(cache_key);
+        }
+    }
+
+    ++_misses;
+
+    auto value = fetch();
+    if (token == 0) {
+        // Cache is disabled.
+        return value;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto *entry = _find(cache_key, token);
+    if (entry != nullptr && !entry->has_value) {
+        entry->has_value = true;
+        entry->value = value;
+        _charge(cache_key, *entry, value ? value->size() : 0);
+    }
+
+    return value;
+}
+
+template <typename Fetch>
+OptionalString NearCache::hget(const StringView &key, const StringView &field, Fetch fetch) {
+    if (!_cacheable(key)) {
+        ++_misses;
+        return fetch();
+    }
+
+    std::string cache_key(key.data(), key.size());
+    std::string cache_field(field.data(), field.size());
+    std::uint64_t token = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_tracking) {
+            auto *entry = _find(cache_key);
+            if (entry != nullptr) {
+                auto iter = entry->fields.find(cache_field);
+                if (iter != entry->fields.end()) {
+                    ++_hits;
+                    return iter->second;
+                }
+            }
+
+            token = _reserve(cache_key);
+        }
+    }
+
+    ++_misses;
+
+    const auto value = fetch();
+    if (token == 0) {
+        return value;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto *entry = _find(cache_key, token);
+    if (entry != nullptr) {
+        auto memory = cache_field.size() + (value ? value->size() : 0);
+        if (entry->fields.emplace(std::move(cache_field), value).second) {
+            _charge(cache_key, *entry, memory);
+        }
+    }
+
+    return value;
+}
+
+template <typename Fetch>
+std::vector<OptionalString> NearCache::hmget(const StringView &key,
+                                                const std::vector<std::string> &fields,
+                                                Fetch fetch) {
+    if (!_cacheable(key)) {
+        ++_misses;
+        return fetch(fields);
+    }
+
+    std::string cache_key(key.data(), key.size());
+    std::vector<OptionalString> values(fields.size());
+    std::vector<std::size_t> missing_idx;
+    std::vector<std::string> missing;
+    std::uint64_t token = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_tracking) {
+            auto *entry = _find(cache_key);
+            for (std::size_t idx = 0; idx != fields.size(); ++idx) {
+                if (entry != nullptr) {
+                    auto iter = entry->fields.find(fields[idx]);
+                    if (iter != entry->fields.end()) {
+                        values[idx] = iter->second;
+                        continue;
+                    }
+                }
+
+                missing_idx.push_back(idx);
+                missing.push_back(fields[idx]);
+            }
+
+            if (missing.empty()) {
+                ++_hits;
+                return values;
+            }
+
+            token = _reserve(cache_key);
+        }
+    }
+
+    ++_misses;
+
+    if (token == 0) {
+        return fetch(fields);
+    }
+
+    auto fetched = fetch(missing);
+    if (fetched.size() != missing.size()) {
+        throw ProtoError("Expect " + std::to_string(missing.size()) + " values of HMGET");
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto *entry = _find(cache_key, token);
+    std::size_t memory = 0;
+    for (std::size_t idx = 0; idx != missing.size(); ++idx) {
+        const auto &value = fetched[idx];
+        if (entry != nullptr
+                && entry->fields.emplace(missing[idx], value).second) {
+            memory += missing[idx].size() + (value ? value->size() : 0);
+        }
+
+        values[missing_idx[idx]] = value;
+    }
+
+    if (entry != nullptr) {
+        _charge(cache_key, *entry, memory);
+    }
+
+    return values;
+}
+
+#endif // end SEWENEW_REDISPLUSPLUS_NEAR_CACHE_H
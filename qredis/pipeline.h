@@ -33,8 +33,9 @@ public:
     std::vector<ReplyUPtr> exec(Connection &connection, std::size_t cmd_num);
 
     void discard(Connection &connection, std::size_t /*cmd_num*/) {
-        // Reconnect to Redis to discard all commands.
-        connection.reconnect();
+        // Commands are buffered until *exec*, so none of them has been sent.
+        // Drop them, and the connection can be reused without reconnecting.
+        connection.clear_output();
     }
 };
 
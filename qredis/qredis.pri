@@ -8,12 +8,18 @@ HEADERS += $$PWD/fmacros.h \
            $$PWD/sds.h \
            $$PWD/sdsalloc.h \
            $$PWD/sslio.h \
+           $$PWD/async_connection.h \
+           $$PWD/async_redis.h \
+           $$PWD/cluster_pipeline.h \
            $$PWD/command.h \
            $$PWD/command_args.h \
            $$PWD/command_options.h \
            $$PWD/connection.h \
            $$PWD/connection_pool.h \
            $$PWD/errors.h \
+           $$PWD/metrics.h \
+           $$PWD/metrics_exporter.h \
+           $$PWD/near_cache.h \
            $$PWD/pipeline.h \
            $$PWD/queued_redis.h \
            $$PWD/queued_redis.hpp \
@@ -23,6 +29,8 @@ HEADERS += $$PWD/fmacros.h \
            $$PWD/redis_cluster.h \
            $$PWD/redis_cluster.hpp \
            $$PWD/reply.h \
+           $$PWD/reply_stream.h \
+           $$PWD/reply_view.h \
            $$PWD/shards.h \
            $$PWD/shards_pool.h \
            $$PWD/subscriber.h \
@@ -34,17 +42,29 @@ SOURCES += $$PWD/hiredis.c \
            $$PWD/read.c \
            $$PWD/sds.c \
            $$PWD/sslio.c \
+           $$PWD/async_connection.cpp \
+           $$PWD/async_redis.cpp \
+           $$PWD/cluster_pipeline.cpp \
            $$PWD/command.cpp \
            $$PWD/command_options.cpp \
            $$PWD/connection.cpp \
            $$PWD/connection_pool.cpp \
            $$PWD/crc16.cpp \
            $$PWD/errors.cpp \
+           $$PWD/metrics.cpp \
+           $$PWD/metrics_exporter.cpp \
+           $$PWD/near_cache.cpp \
            $$PWD/pipeline.cpp \
            $$PWD/redis.cpp \
            $$PWD/redis_cluster.cpp \
            $$PWD/reply.cpp \
+           $$PWD/reply_stream.cpp \
+           $$PWD/reply_view.cpp \
            $$PWD/shards.cpp \
            $$PWD/shards_pool.cpp \
            $$PWD/subscriber.cpp \
            $$PWD/transaction.cpp
+
+# SSE2 is used by the RESP reader on x86-64 by default. Uncomment to use AVX2
+# instead, which requires an AVX2 capable CPU at runtime.
+# QMAKE_CFLAGS += -mavx2
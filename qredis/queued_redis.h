@@ -31,15 +31,16 @@ class QueuedReplies;
 
 // If any command throws, QueuedRedis resets the connection, and becomes invalid.
 // In this case, the only thing we can do is to destory the QueuedRedis object.
+// Except that if *exec* throws *WatchError*, it's still valid and can be retried.
 template <typename Impl>
 class QueuedRedis {
 public:
     QueuedRedis(QueuedRedis &&) = default;
     QueuedRedis& operator=(QueuedRedis &&) = default;
 
-    // When it destructs, the underlying *Connection* will be closed,
-    // and any command that has NOT been executed will be ignored.
-    ~QueuedRedis() = default;
+    // When it destructs, any command that has NOT been executed will be discarded,
+    // and the underlying *Connection* will be closed or returned to the pool.
+    ~QueuedRedis();
 
     Redis redis();
 
@@ -62,6 +63,8 @@ public:
     // CONNECTION commands.
 
     QueuedRedis& auth(const StringView &password) {
+        _dirty = true;
+
         return command(cmd::auth, password);
     }
 
@@ -82,6 +85,8 @@ public:
     // QueuedRedis& quit();
 
     QueuedRedis& select(long long idx) {
+        _dirty = true;
+
         return command(cmd::select, idx);
     }
 
@@ -1382,8 +1387,9 @@ private:
 
     friend class RedisCluster;
 
+    // *borrowed* tells whether *connection* is borrowed from a connection pool.
     template <typename ...Args>
-    QueuedRedis(const ConnectionSPtr &connection, Args &&...args);
+    QueuedRedis(const ConnectionSPtr &connection, bool borrowed, Args &&...args);
 
     void _sanity_check() const;
 
@@ -1391,6 +1397,9 @@ private:
 
     void _invalidate();
 
+    // Leave a borrowed connection in a clean state, so that it can be reused.
+    void _clean_up();
+
     void _rewrite_replies(std::vector<ReplyUPtr> &replies) const;
 
     template <typename Func>
@@ -1400,6 +1409,8 @@ private:
 
     ConnectionSPtr _connection;
 
+    bool _borrowed = false;
+
     Impl _impl;
 
     std::size_t _cmd_num = 0;
@@ -1409,6 +1420,10 @@ private:
     std::vector<std::size_t> _georadius_cmd_indexes;
 
     bool _valid = true;
+
+    // Whether the state of the connection, e.g. the selected DB, might have been
+    // changed, so that it should NOT be reused as it is.
+    bool _dirty = false;
 };
 
 class QueuedReplies {
@@ -1427,6 +1442,8 @@ private:
     template <typename Impl>
     friend class QueuedRedis;
 
+    friend class ClusterPipeline;
+
     explicit QueuedReplies(std::vector<ReplyUPtr> replies) : _replies(std::move(replies)) {}
 
     void _index_check(std::size_t idx) const;
@@ -19,14 +19,27 @@
 
 template <typename Impl>
 template <typename ...Args>
-QueuedRedis<Impl>::QueuedRedis(const ConnectionSPtr &connection, Args &&...args) :
+QueuedRedis<Impl>::QueuedRedis(const ConnectionSPtr &connection, bool borrowed, Args &&...args) :
             _connection(connection),
+            _borrowed(borrowed),
             _impl(std::forward<Args>(args)...) {
     assert(_connection);
 }
 
+template <typename Impl>
+QueuedRedis<Impl>::~QueuedRedis() {
+    try {
+        _clean_up();
+    } catch (const Error &e) {
+        // Avoid throwing in destructor.
+    }
+}
+
 template <typename Impl>
 Redis QueuedRedis<Impl>::redis() {
+    // We cannot track commands sent with the returned object.
+    _dirty = true;
+
     return Redis(_connection);
 }
 
@@ -93,6 +106,10 @@ QueuedReplies QueuedRedis<Impl>::exec() {
         _reset();
 
         return QueuedReplies(std::move(replies));
+    } catch (const WatchError &e) {
+        // Transaction has been aborted, and the connection is still in a clean state.
+        _reset();
+        throw;
     } catch (const Error &e) {
         _invalidate();
         throw;
@@ -140,6 +157,29 @@ void QueuedRedis<Impl>::_invalidate() {
     _reset();
 }
 
+template <typename Impl>
+void QueuedRedis<Impl>::_clean_up() {
+    if (!_connection) {
+        // Moved.
+        return;
+    }
+
+    // A connection of our own is closed when we're destroyed, and there's no need
+    // to wait for replies of pending commands, which might block forever if the
+    // server doesn't respond. Only a borrowed connection goes back to the pool.
+    if (_borrowed && _valid && !_dirty && _cmd_num > 0) {
+        try {
+            discard();
+        } catch (const Error &e) {
+            // *discard* has invalidated this object.
+        }
+    }
+
+    if (!_valid || _dirty) {
+        _connection->invalidate();
+    }
+}
+
 template <typename Impl>
 void QueuedRedis<Impl>::_rewrite_replies(std::vector<ReplyUPtr> &replies) const {
     _rewrite_replies(_set_cmd_indexes, reply::rewrite_set_reply, replies);
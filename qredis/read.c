@@ -40,6 +40,12 @@
 #include <errno.h>
 #include <ctype.h>
 #include <limits.h>
+#include <math.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "read.h"
 #include "sds.h"
@@ -53,8 +59,10 @@ static void __redisReaderSetError(redisReader *r, int type, const char *str) {
     }
 
     /* Clear input buffer on errors. */
-    sdsfree(r->buf);
+    if (!r->pinned)
+        sdsfree(r->buf);
     r->buf = NULL;
+    r->pinned = 0;
     r->pos = r->len = 0;
 
     /* Reset task stack. */
@@ -115,30 +123,62 @@ static char *readBytes(redisReader *r, unsigned int bytes) {
     return NULL;
 }
 
-/* Find pointer to \r\n. */
+/* Find pointer to \r\n.
+ *
+ * Position should be < len-1 because the character at "pos" should be
+ * followed by a \n. Note that strchr cannot be used because it doesn't
+ * allow to search a limited length and the buffer that is being searched
+ * might not have a trailing NULL character.
+ *
+ * Most lines, e.g. lengths, integers and short fields, end within a few bytes,
+ * so the first bytes are scanned one by one. For longer lines, with SSE2 or
+ * AVX2, a block of bytes is compared against '\r', and the same block shifted
+ * by one byte against '\n', so that each bit of the combined mask marks a \r\n
+ * pair. Both loads stay inside [s, s+len). */
 static char *seekNewline(char *s, size_t len) {
-    int pos = 0;
-    int _len = len-1;
-
-    /* Position should be < len-1 because the character at "pos" should be
-     * followed by a \n. Note that strchr cannot be used because it doesn't
-     * allow to search a limited length and the buffer that is being searched
-     * might not have a trailing NULL character. */
-    while (pos < _len) {
-        while(pos < _len && s[pos] != '\r') pos++;
-        if (pos==_len) {
-            /* Not found. */
-            return NULL;
-        } else {
-            if (s[pos+1] == '\n') {
-                /* Found. */
-                return s+pos;
-            } else {
-                /* Continue searching. */
-                pos++;
-            }
+    size_t pos = 0;
+    size_t _len, head;
+
+    if (len < 2) return NULL;
+    _len = len-1;
+
+    head = _len < 16 ? _len : 16;
+    for (; pos < head; pos++) {
+        if (s[pos] == '\r' && s[pos+1] == '\n') return s+pos;
+    }
+
+#if defined(__AVX2__)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        for (; pos + 32 <= _len; pos += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(s+pos));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(s+pos+1));
+            unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+                    _mm256_and_si256(_mm256_cmpeq_epi8(a,cr),
+                                     _mm256_cmpeq_epi8(b,lf)));
+            if (mask != 0) return s+pos+__builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        for (; pos + 16 <= _len; pos += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(s+pos));
+            __m128i b = _mm_loadu_si128((const __m128i *)(s+pos+1));
+            unsigned int mask = (unsigned int)_mm_movemask_epi8(
+                    _mm_and_si128(_mm_cmpeq_epi8(a,cr),_mm_cmpeq_epi8(b,lf)));
+            if (mask != 0) return s+pos+__builtin_ctz(mask);
         }
     }
+#endif
+
+    /* Scalar fallback, and the tail of the vectorized search. */
+    for (; pos < _len; pos++) {
+        if (s[pos] == '\r' && s[pos+1] == '\n') return s+pos;
+    }
     return NULL;
 }
 
@@ -241,9 +281,13 @@ static void moveToNextTask(redisReader *r) {
             return;
         }
 
-        cur = &(r->rstack[r->ridx]);
-        prv = &(r->rstack[r->ridx-1]);
-        assert(prv->type == REDIS_REPLY_ARRAY);
+        cur = r->rstack[r->ridx];
+        prv = r->rstack[r->ridx-1];
+        assert(prv->type == REDIS_REPLY_ARRAY ||
+               prv->type == REDIS_REPLY_MAP ||
+               prv->type == REDIS_REPLY_SET ||
+               prv->type == REDIS_REPLY_ATTR ||
+               prv->type == REDIS_REPLY_PUSH);
         if (cur->idx == prv->elements-1) {
             r->ridx--;
         } else {
@@ -258,7 +302,7 @@ static void moveToNextTask(redisReader *r) {
 }
 
 static int processLineItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+    redisReadTask *cur = r->rstack[r->ridx];
     void *obj;
     char *p;
     int len;
@@ -276,6 +320,82 @@ static int processLineItem(redisReader *r) {
             } else {
                 obj = (void*)REDIS_REPLY_INTEGER;
             }
+        } else if (cur->type == REDIS_REPLY_DOUBLE) {
+            if (r->fn && r->fn->createDouble) {
+                char buf[326], *eptr;
+                double d;
+
+                if ((size_t)len >= sizeof(buf)) {
+                    __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                            "Double value is too large");
+                    return REDIS_ERR;
+                }
+
+                memcpy(buf,p,len);
+                buf[len] = '\0';
+
+                if (strcmp(buf,"inf") == 0) {
+                    d = INFINITY;
+                } else if (strcmp(buf,"-inf") == 0) {
+                    d = -INFINITY;
+                } else if (strcmp(buf,"nan") == 0) {
+                    d = NAN;
+                } else {
+                    d = strtod(buf,&eptr);
+                    if (len == 0 || eptr[0] != '\0' || isnan(d)) {
+                        __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                                "Bad double value");
+                        return REDIS_ERR;
+                    }
+                }
+                obj = r->fn->createDouble(cur,d,p,len);
+            } else {
+                obj = (void*)REDIS_REPLY_DOUBLE;
+            }
+        } else if (cur->type == REDIS_REPLY_NIL) {
+            if (len != 0) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Bad nil value");
+                return REDIS_ERR;
+            }
+
+            if (r->fn && r->fn->createNil)
+                obj = r->fn->createNil(cur);
+            else
+                obj = (void*)REDIS_REPLY_NIL;
+        } else if (cur->type == REDIS_REPLY_BOOL) {
+            if (len != 1 || (p[0] != 't' && p[0] != 'f')) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Bad bool value");
+                return REDIS_ERR;
+            }
+
+            if (r->fn && r->fn->createBool)
+                obj = r->fn->createBool(cur,p[0] == 't');
+            else
+                obj = (void*)REDIS_REPLY_BOOL;
+        } else if (cur->type == REDIS_REPLY_BIGNUM) {
+            int i;
+
+            /* Keep the digits as a string, since it might NOT fit in any C type. */
+            for (i = 0; i < len; i++) {
+                if (!(isdigit((unsigned char)p[i]) || (i == 0 && p[i] == '-' && len > 1))) {
+                    __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                            "Bad big number value");
+                    return REDIS_ERR;
+                }
+            }
+
+            if (len == 0) {
+                __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                        "Bad big number value");
+                return REDIS_ERR;
+            }
+
+            if (r->fn && r->fn->createString)
+                obj = r->fn->createString(cur,p,len);
+            else
+                obj = (void*)REDIS_REPLY_BIGNUM;
         } else {
             /* Type will be error or status. */
             if (r->fn && r->fn->createString)
@@ -299,7 +419,7 @@ static int processLineItem(redisReader *r) {
 }
 
 static int processBulkItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+    redisReadTask *cur = r->rstack[r->ridx];
     void *obj = NULL;
     char *p, *s;
     long long len;
@@ -318,13 +438,14 @@ static int processBulkItem(redisReader *r) {
             return REDIS_ERR;
         }
 
-        if (len < -1 || (LLONG_MAX > SIZE_MAX && len > (long long)SIZE_MAX)) {
+        if (len < -1 || (len == -1 && cur->type != REDIS_REPLY_STRING) ||
+            (LLONG_MAX > SIZE_MAX && len > (long long)SIZE_MAX)) {
             __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
                     "Bulk string length out of range");
             return REDIS_ERR;
         }
 
-        if (len == -1) {
+        if (len == -1 && cur->type == REDIS_REPLY_STRING) {
             /* The nil object can always be created. */
             if (r->fn && r->fn->createNil)
                 obj = r->fn->createNil(cur);
@@ -334,11 +455,23 @@ static int processBulkItem(redisReader *r) {
         } else {
             /* Only continue when the buffer contains the entire bulk item. */
             bytelen += len+2; /* include \r\n */
-            if (r->pos+bytelen <= r->len) {
+            if (r->pos+bytelen > r->len) {
+                /* So that the rest of the item is read at once. */
+                r->pending = r->pos+bytelen-r->len;
+            } else {
+                /* Verbatim string is prefixed with its format, e.g. "txt:". */
+                if (cur->type == REDIS_REPLY_VERB &&
+                    (len < 4 || s[2+3] != ':')) {
+                    __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                            "Verbatim string 4 bytes of content type are "
+                            "missing or incorrectly encoded.");
+                    return REDIS_ERR;
+                }
+
                 if (r->fn && r->fn->createString)
                     obj = r->fn->createString(cur,s+2,len);
                 else
-                    obj = (void*)REDIS_REPLY_STRING;
+                    obj = (void*)(size_t)(cur->type);
                 success = 1;
             }
         }
@@ -362,20 +495,32 @@ static int processBulkItem(redisReader *r) {
     return REDIS_ERR;
 }
 
-static int processMultiBulkItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+/* Grow the task stack. Tasks are allocated one by one, so that pointers to
+ * them, i.e. the parent of a task, stay valid when the stack grows. */
+static int redisReaderGrow(redisReader *r) {
+    redisReadTask **aux;
+    int newlen = r->tasks ? r->tasks*2 : REDIS_READER_STACK_SIZE;
+
+    aux = realloc(r->rstack,sizeof(*r->rstack)*newlen);
+    if (aux == NULL)
+        return REDIS_ERR;
+    r->rstack = aux;
+
+    for (; r->tasks < newlen; r->tasks++) {
+        r->rstack[r->tasks] = calloc(1,sizeof(**r->rstack));
+        if (r->rstack[r->tasks] == NULL)
+            return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+static int processAggregateItem(redisReader *r) {
+    redisReadTask *cur = r->rstack[r->ridx];
     void *obj;
     char *p;
     long long elements;
     int root = 0, len;
 
-    /* Set error for nested multi bulks with depth > 7 */
-    if (r->ridx == 8) {
-        __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
-            "No support for nested multi bulk replies with depth > 7");
-        return REDIS_ERR;
-    }
-
     if ((p = readLine(r,&len)) != NULL) {
         if (string2ll(p, len, &elements) == REDIS_ERR) {
             __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
@@ -385,7 +530,17 @@ static int processMultiBulkItem(redisReader *r) {
 
         root = (r->ridx == 0);
 
-        if (elements < -1 || elements > INT_MAX) {
+        if (elements < -1 || (elements == -1 && cur->type != REDIS_REPLY_ARRAY)) {
+            __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
+                    "Multi-bulk length out of range");
+            return REDIS_ERR;
+        }
+
+        /* Map and attribute have 2 elements, i.e. key and value, per entry. */
+        if (cur->type == REDIS_REPLY_MAP || cur->type == REDIS_REPLY_ATTR)
+            elements *= 2;
+
+        if (elements > INT_MAX) {
             __redisReaderSetError(r,REDIS_ERR_PROTOCOL,
                     "Multi-bulk length out of range");
             return REDIS_ERR;
@@ -407,7 +562,7 @@ static int processMultiBulkItem(redisReader *r) {
             if (r->fn && r->fn->createArray)
                 obj = r->fn->createArray(cur,elements);
             else
-                obj = (void*)REDIS_REPLY_ARRAY;
+                obj = (void*)(size_t)(cur->type);
 
             if (obj == NULL) {
                 __redisReaderSetErrorOOM(r);
@@ -416,15 +571,22 @@ static int processMultiBulkItem(redisReader *r) {
 
             /* Modify task stack when there are more than 0 elements. */
             if (elements > 0) {
+                if (r->ridx+1 == r->tasks && redisReaderGrow(r) != REDIS_OK) {
+                    if (r->fn && r->fn->freeObject && root)
+                        r->fn->freeObject(obj);
+                    __redisReaderSetErrorOOM(r);
+                    return REDIS_ERR;
+                }
+
                 cur->elements = elements;
                 cur->obj = obj;
                 r->ridx++;
-                r->rstack[r->ridx].type = -1;
-                r->rstack[r->ridx].elements = -1;
-                r->rstack[r->ridx].idx = 0;
-                r->rstack[r->ridx].obj = NULL;
-                r->rstack[r->ridx].parent = cur;
-                r->rstack[r->ridx].privdata = r->privdata;
+                r->rstack[r->ridx]->type = -1;
+                r->rstack[r->ridx]->elements = -1;
+                r->rstack[r->ridx]->idx = 0;
+                r->rstack[r->ridx]->obj = NULL;
+                r->rstack[r->ridx]->parent = cur;
+                r->rstack[r->ridx]->privdata = r->privdata;
             } else {
                 moveToNextTask(r);
             }
@@ -439,7 +601,7 @@ static int processMultiBulkItem(redisReader *r) {
 }
 
 static int processItem(redisReader *r) {
-    redisReadTask *cur = &(r->rstack[r->ridx]);
+    redisReadTask *cur = r->rstack[r->ridx];
     char *p;
 
     /* check if we need to read type */
@@ -461,6 +623,33 @@ static int processItem(redisReader *r) {
             case '*':
                 cur->type = REDIS_REPLY_ARRAY;
                 break;
+            case ',':
+                cur->type = REDIS_REPLY_DOUBLE;
+                break;
+            case '_':
+                cur->type = REDIS_REPLY_NIL;
+                break;
+            case '#':
+                cur->type = REDIS_REPLY_BOOL;
+                break;
+            case '(':
+                cur->type = REDIS_REPLY_BIGNUM;
+                break;
+            case '=':
+                cur->type = REDIS_REPLY_VERB;
+                break;
+            case '%':
+                cur->type = REDIS_REPLY_MAP;
+                break;
+            case '~':
+                cur->type = REDIS_REPLY_SET;
+                break;
+            case '|':
+                cur->type = REDIS_REPLY_ATTR;
+                break;
+            case '>':
+                cur->type = REDIS_REPLY_PUSH;
+                break;
             default:
                 __redisReaderSetErrorProtocolByte(r,*p);
                 return REDIS_ERR;
@@ -476,11 +665,20 @@ static int processItem(redisReader *r) {
     case REDIS_REPLY_ERROR:
     case REDIS_REPLY_STATUS:
     case REDIS_REPLY_INTEGER:
+    case REDIS_REPLY_DOUBLE:
+    case REDIS_REPLY_NIL:
+    case REDIS_REPLY_BOOL:
+    case REDIS_REPLY_BIGNUM:
         return processLineItem(r);
     case REDIS_REPLY_STRING:
+    case REDIS_REPLY_VERB:
         return processBulkItem(r);
     case REDIS_REPLY_ARRAY:
-        return processMultiBulkItem(r);
+    case REDIS_REPLY_MAP:
+    case REDIS_REPLY_SET:
+    case REDIS_REPLY_ATTR:
+    case REDIS_REPLY_PUSH:
+        return processAggregateItem(r);
     default:
         assert(NULL);
         return REDIS_ERR; /* Avoid warning. */
@@ -497,24 +695,61 @@ redisReader *redisReaderCreateWithFunctions(redisReplyObjectFunctions *fn) {
     r->fn = fn;
     r->buf = sdsempty();
     r->maxbuf = REDIS_READER_MAX_BUF;
-    if (r->buf == NULL) {
-        free(r);
+    r->ridx = -1;
+    if (r->buf == NULL || redisReaderGrow(r) != REDIS_OK) {
+        redisReaderFree(r);
         return NULL;
     }
 
-    r->ridx = -1;
     return r;
 }
 
 void redisReaderFree(redisReader *r) {
+    int i;
+
     if (r == NULL)
         return;
     if (r->reply != NULL && r->fn && r->fn->freeObject)
         r->fn->freeObject(r->reply);
-    sdsfree(r->buf);
+    if (!r->pinned)
+        sdsfree(r->buf);
+    for (i = 0; i < r->tasks; i++)
+        free(r->rstack[i]);
+    free(r->rstack);
     free(r);
 }
 
+/* Prepare the buffer for appending 'need' bytes: unpin it, and shrink it if
+ * it's empty and quite large. */
+static int __redisReaderPrepareBuffer(redisReader *r, size_t need) {
+    size_t limit;
+
+    /* Never append to a pinned buffer. */
+    if (redisReaderUnpinBuffer(r) != REDIS_OK)
+        return REDIS_ERR;
+
+    /* Everything has been consumed. */
+    if (r->pos > 0 && r->pos == r->len) {
+        sdsclear(r->buf);
+        r->pos = r->len = 0;
+    }
+
+    /* Destroy internal buffer when it is empty and is quite large. sdsMakeRoomFor
+     * doubles the requested size, so keep a buffer up to twice the size of what
+     * we're going to append, otherwise it's reallocated for every read. */
+    limit = r->maxbuf > need ? r->maxbuf : need;
+    if (r->len == 0 && r->maxbuf != 0 && sdsavail(r->buf) > limit * 2) {
+        sdsfree(r->buf);
+        r->buf = sdsempty();
+        r->pos = 0;
+
+        /* r->buf should not be NULL since we just free'd a larger one. */
+        assert(r->buf != NULL);
+    }
+
+    return REDIS_OK;
+}
+
 int redisReaderFeed(redisReader *r, const char *buf, size_t len) {
     sds newbuf;
 
@@ -524,15 +759,8 @@ int redisReaderFeed(redisReader *r, const char *buf, size_t len) {
 
     /* Copy the provided buffer. */
     if (buf != NULL && len >= 1) {
-        /* Destroy internal buffer when it is empty and is quite large. */
-        if (r->len == 0 && r->maxbuf != 0 && sdsavail(r->buf) > r->maxbuf) {
-            sdsfree(r->buf);
-            r->buf = sdsempty();
-            r->pos = 0;
-
-            /* r->buf should not be NULL since we just free'd a larger one. */
-            assert(r->buf != NULL);
-        }
+        if (__redisReaderPrepareBuffer(r,len) != REDIS_OK)
+            return REDIS_ERR;
 
         newbuf = sdscatlen(r->buf,buf,len);
         if (newbuf == NULL) {
@@ -547,6 +775,38 @@ int redisReaderFeed(redisReader *r, const char *buf, size_t len) {
     return REDIS_OK;
 }
 
+char *redisReaderReserve(redisReader *r, size_t len) {
+    sds newbuf;
+
+    /* Return early when this reader is in an erroneous state. */
+    if (r->err)
+        return NULL;
+
+    if (__redisReaderPrepareBuffer(r,len) != REDIS_OK)
+        return NULL;
+
+    newbuf = sdsMakeRoomFor(r->buf,len);
+    if (newbuf == NULL) {
+        __redisReaderSetErrorOOM(r);
+        return NULL;
+    }
+
+    r->buf = newbuf;
+    return r->buf+sdslen(r->buf);
+}
+
+void redisReaderCommit(redisReader *r, size_t len) {
+    assert(sdsavail(r->buf) >= len);
+    sdsIncrLen(r->buf,len);
+    r->len = sdslen(r->buf);
+}
+
+size_t redisReaderReadSize(const redisReader *r) {
+    if (r->pending <= REDIS_READER_READ_SIZE)
+        return REDIS_READER_READ_SIZE;
+    return r->pending < REDIS_READER_MAX_READ ? r->pending : REDIS_READER_MAX_READ;
+}
+
 int redisReaderGetReply(redisReader *r, void **reply) {
     /* Default target pointer to NULL. */
     if (reply != NULL)
@@ -560,14 +820,17 @@ int redisReaderGetReply(redisReader *r, void **reply) {
     if (r->len == 0)
         return REDIS_OK;
 
+    /* Set again if we stop at an incomplete bulk item. */
+    r->pending = 0;
+
     /* Set first item to process when the stack is empty. */
     if (r->ridx == -1) {
-        r->rstack[0].type = -1;
-        r->rstack[0].elements = -1;
-        r->rstack[0].idx = -1;
-        r->rstack[0].obj = NULL;
-        r->rstack[0].parent = NULL;
-        r->rstack[0].privdata = r->privdata;
+        r->rstack[0]->type = -1;
+        r->rstack[0]->elements = -1;
+        r->rstack[0]->idx = -1;
+        r->rstack[0]->obj = NULL;
+        r->rstack[0]->parent = NULL;
+        r->rstack[0]->privdata = r->privdata;
         r->ridx = 0;
     }
 
@@ -582,7 +845,7 @@ int redisReaderGetReply(redisReader *r, void **reply) {
 
     /* Discard part of the buffer when we've consumed at least 1k, to avoid
      * doing unnecessary calls to memmove() in sds.c. */
-    if (r->pos >= 1024) {
+    if (r->pos >= 1024 && !r->pinned) {
         sdsrange(r->buf,r->pos,-1);
         r->pos = 0;
         r->len = sdslen(r->buf);
@@ -596,3 +859,35 @@ int redisReaderGetReply(redisReader *r, void **reply) {
     }
     return REDIS_OK;
 }
+
+char *redisReaderPinBuffer(redisReader *r) {
+    r->pinned = 1;
+    return r->buf;
+}
+
+/* Stop using the pinned buffer: copy the unconsumed part to a new buffer. */
+int redisReaderUnpinBuffer(redisReader *r) {
+    sds newbuf;
+
+    if (!r->pinned)
+        return REDIS_OK;
+
+    newbuf = sdsnewlen(r->buf+r->pos,r->len-r->pos);
+    if (newbuf == NULL) {
+        /* The pinned buffer still belongs to the caller. */
+        r->buf = NULL;
+        r->pinned = 0;
+        __redisReaderSetErrorOOM(r);
+        return REDIS_ERR;
+    }
+
+    r->buf = newbuf;
+    r->pos = 0;
+    r->len = sdslen(r->buf);
+    r->pinned = 0;
+    return REDIS_OK;
+}
+
+void redisReaderFreeBuffer(char *buf) {
+    sdsfree(buf);
+}
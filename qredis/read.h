@@ -55,7 +55,20 @@
 #define REDIS_REPLY_STATUS 5
 #define REDIS_REPLY_ERROR 6
 
+/* RESP3 types, see https://github.com/antirez/RESP3 */
+#define REDIS_REPLY_DOUBLE 7
+#define REDIS_REPLY_BOOL 8
+#define REDIS_REPLY_MAP 9
+#define REDIS_REPLY_SET 10
+#define REDIS_REPLY_ATTR 11
+#define REDIS_REPLY_PUSH 12
+#define REDIS_REPLY_BIGNUM 13
+#define REDIS_REPLY_VERB 14
+
 #define REDIS_READER_MAX_BUF (1024*16)  /* Default max unused reader buffer. */
+#define REDIS_READER_READ_SIZE (1024*16) /* Min size of a single read. */
+#define REDIS_READER_MAX_READ (1024*1024*64) /* Max size of a single read. */
+#define REDIS_READER_STACK_SIZE 9 /* Initial depth of the task stack. */
 
 #ifdef __cplusplus
 extern "C" {
@@ -63,18 +76,23 @@ extern "C" {
 
 typedef struct redisReadTask {
     int type;
-    int elements; /* number of elements in multibulk container */
+    int elements; /* number of elements in aggregate, i.e. 2x entries for map and attribute */
     int idx; /* index in parent (array) object */
     void *obj; /* holds user-generated value for a read task */
     struct redisReadTask *parent; /* parent task */
     void *privdata; /* user-settable arbitrary field */
 } redisReadTask;
 
+/* createString is also called for big number and verbatim string, the latter
+ * includes the "txt:" prefix. createArray is called for all aggregate types,
+ * and createDouble gets both the value and its string representation. */
 typedef struct redisReplyObjectFunctions {
     void *(*createString)(const redisReadTask*, char*, size_t);
     void *(*createArray)(const redisReadTask*, int);
     void *(*createInteger)(const redisReadTask*, long long);
+    void *(*createDouble)(const redisReadTask*, double, char*, size_t);
     void *(*createNil)(const redisReadTask*);
+    void *(*createBool)(const redisReadTask*, int);
     void (*freeObject)(void*);
 } redisReplyObjectFunctions;
 
@@ -86,8 +104,11 @@ typedef struct redisReader {
     size_t pos; /* Buffer cursor */
     size_t len; /* Buffer length */
     size_t maxbuf; /* Max length of unused buffer */
+    int pinned; /* Buffer is owned by the user, see redisReaderPinBuffer() */
+    size_t pending; /* Bytes missing from the incomplete bulk item, 0 if unknown */
 
-    redisReadTask rstack[9];
+    redisReadTask **rstack; /* Task stack, grown on demand and reused for all replies */
+    int tasks; /* Number of allocated tasks */
     int ridx; /* Index of current read task */
     void *reply; /* Temporary reply pointer */
 
@@ -101,6 +122,24 @@ void redisReaderFree(redisReader *r);
 int redisReaderFeed(redisReader *r, const char *buf, size_t len);
 int redisReaderGetReply(redisReader *r, void **reply);
 
+/* Instead of copying data with redisReaderFeed(), read it straight into the buffer:
+ * redisReaderReserve() returns at least "len" bytes of writable space at the end of
+ * the buffer, or NULL on error, and redisReaderCommit() appends "len" bytes that
+ * have been written into it. */
+char *redisReaderReserve(redisReader *r, size_t len);
+void redisReaderCommit(redisReader *r, size_t len);
+
+/* Size of the next read: large enough for the incomplete bulk item if its
+ * length is known, and between REDIS_READER_READ_SIZE and REDIS_READER_MAX_READ. */
+size_t redisReaderReadSize(const redisReader *r);
+
+/* Pin the read buffer, so that objects can point into it instead of copying.
+ * The reader never modifies or frees a pinned buffer. The caller owns it, and
+ * frees it with redisReaderFreeBuffer() after calling redisReaderUnpinBuffer(). */
+char *redisReaderPinBuffer(redisReader *r);
+int redisReaderUnpinBuffer(redisReader *r);
+void redisReaderFreeBuffer(char *buf);
+
 #define redisReaderSetPrivdata(_r, _p) (int)(((redisReader*)(_r))->privdata = (_p))
 #define redisReaderGetObject(_r) (((redisReader*)(_r))->reply)
 #define redisReaderGetError(_r) (((redisReader*)(_r))->errstr)
@@ -26,21 +26,49 @@ Redis::Redis(const ConnectionSPtr &connection) : _connection(connection) {
     assert(_connection);
 }
 
-Pipeline Redis::pipeline() {
-    auto opts = _pool.connection_options();
-    return Pipeline(std::make_shared<Connection>(opts));
+Pipeline Redis::pipeline(bool new_connection) {
+    if (new_connection) {
+        auto opts = _pool.connection_options();
+        return Pipeline(std::make_shared<Connection>(opts), false);
+    }
+
+    return Pipeline(_pool.borrow(), true);
 }
 
-Transaction Redis::transaction(bool piped) {
-    auto opts = _pool.connection_options();
-    return Transaction(std::make_shared<Connection>(opts), piped);
+Transaction Redis::transaction(bool piped, bool new_connection) {
+    if (new_connection) {
+        auto opts = _pool.connection_options();
+        return Transaction(std::make_shared<Connection>(opts), false, piped);
+    }
+
+    return Transaction(_pool.borrow(), true, piped);
 }
 
 Subscriber Redis::subscriber() {
     auto opts = _pool.connection_options();
+
+    // Subscriber reads push messages, i.e. pub/sub messages with RESP3, as replies.
+    opts.push_handler = nullptr;
+
     return Subscriber(Connection(opts));
 }
 
+void Redis::enable_near_cache(const NearCacheOptions &opts) {
+    if (_connection) {
+        throw Error("Near cache is NOT supported in single connection mode");
+    }
+
+    _near_cache.reset(new NearCache(_pool.connection_options(), opts));
+}
+
+NearCacheStats Redis::near_cache_stats() const {
+    if (!_near_cache) {
+        return {};
+    }
+
+    return _near_cache->stats();
+}
+
 // CONNECTION commands.
 
 void Redis::auth(const StringView &password) {
@@ -96,12 +124,16 @@ long long Redis::dbsize() {
 void Redis::flushall(bool async) {
     auto reply = command(cmd::flushall, async);
 
+    _invalidate();
+
     reply::parse<void>(*reply);
 }
 
 void Redis::flushdb(bool async) {
     auto reply = command(cmd::flushdb, async);
 
+    _invalidate();
+
     reply::parse<void>(*reply);
 }
 
@@ -134,6 +166,8 @@ void Redis::save() {
 long long Redis::del(const StringView &key) {
     auto reply = command(cmd::del, key);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
@@ -152,18 +186,24 @@ long long Redis::exists(const StringView &key) {
 bool Redis::expire(const StringView &key, long long timeout) {
     auto reply = command(cmd::expire, key, timeout);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
 bool Redis::expireat(const StringView &key, long long timestamp) {
     auto reply = command(cmd::expireat, key, timestamp);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
 bool Redis::move(const StringView &key, long long db) {
     auto reply = command(cmd::move, key, db);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
@@ -176,12 +216,16 @@ bool Redis::persist(const StringView &key) {
 bool Redis::pexpire(const StringView &key, long long timeout) {
     auto reply = command(cmd::pexpire, key, timeout);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
 bool Redis::pexpireat(const StringView &key, long long timestamp) {
     auto reply = command(cmd::pexpireat, key, timestamp);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
@@ -200,12 +244,18 @@ OptionalString Redis::randomkey() {
 void Redis::rename(const StringView &key, const StringView &newkey) {
     auto reply = command(cmd::rename, key, newkey);
 
+    _invalidate(key);
+    _invalidate(newkey);
+
     reply::parse<void>(*reply);
 }
 
 bool Redis::renamenx(const StringView &key, const StringView &newkey) {
     auto reply = command(cmd::renamenx, key, newkey);
 
+    _invalidate(key);
+    _invalidate(newkey);
+
     return reply::parse<bool>(*reply);
 }
 
@@ -215,6 +265,8 @@ void Redis::restore(const StringView &key,
                     bool replace) {
     auto reply = command(cmd::restore, key, val, ttl, replace);
 
+    _invalidate(key);
+
     reply::parse<void>(*reply);
 }
 
@@ -239,6 +291,8 @@ std::string Redis::type(const StringView &key) {
 long long Redis::unlink(const StringView &key) {
     auto reply = command(cmd::unlink, key);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
@@ -253,6 +307,8 @@ long long Redis::wait(long long numslaves, long long timeout) {
 long long Redis::append(const StringView &key, const StringView &val) {
     auto reply = command(cmd::append, key, val);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
@@ -274,19 +330,31 @@ long long Redis::bitpos(const StringView &key,
 long long Redis::decr(const StringView &key) {
     auto reply = command(cmd::decr, key);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
 long long Redis::decrby(const StringView &key, long long decrement) {
     auto reply = command(cmd::decrby, key, decrement);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
 OptionalString Redis::get(const StringView &key) {
-    auto reply = command(cmd::get, key);
+    auto fetch = [this, &key]() {
+        auto reply = command(cmd::get, key);
 
-    return reply::parse<OptionalString>(*reply);
+        return reply::parse<OptionalString>(*reply);
+    };
+
+    if (_near_cache) {
+        return _near_cache->get(key, fetch);
+    }
+
+    return fetch();
 }
 
 long long Redis::getbit(const StringView &key, long long offset) {
@@ -301,27 +369,45 @@ std::string Redis::getrange(const StringView &key, long long start, long long en
     return reply::parse<std::string>(*reply);
 }
 
+ReplyViewUPtr Redis::get_view(const StringView &key) {
+    auto reply = command_view(cmd::get, key);
+
+    if (!reply->is_nil() && !reply->is_string()) {
+        throw ProtoError("Expect STRING reply");
+    }
+
+    return reply;
+}
+
 OptionalString Redis::getset(const StringView &key, const StringView &val) {
     auto reply = command(cmd::getset, key, val);
 
+    _invalidate(key);
+
     return reply::parse<OptionalString>(*reply);
 }
 
 long long Redis::incr(const StringView &key) {
     auto reply = command(cmd::incr, key);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
 long long Redis::incrby(const StringView &key, long long increment) {
     auto reply = command(cmd::incrby, key, increment);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
 double Redis::incrbyfloat(const StringView &key, double increment) {
     auto reply = command(cmd::incrbyfloat, key, increment);
 
+    _invalidate(key);
+
     return reply::parse<double>(*reply);
 }
 
@@ -330,6 +416,8 @@ void Redis::psetex(const StringView &key,
                         const StringView &val) {
     auto reply = command(cmd::psetex, key, ttl, val);
 
+    _invalidate(key);
+
     reply::parse<void>(*reply);
 }
 
@@ -339,6 +427,8 @@ bool Redis::set(const StringView &key,
                     UpdateType type) {
     auto reply = command(cmd::set, key, val, ttl.count(), type);
 
+    _invalidate(key);
+
     reply::rewrite_set_reply(*reply);
 
     return reply::parse<bool>(*reply);
@@ -347,6 +437,8 @@ bool Redis::set(const StringView &key,
 long long Redis::setbit(const StringView &key, long long offset, long long value) {
     auto reply = command(cmd::setbit, key, offset, value);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
@@ -355,18 +447,24 @@ void Redis::setex(const StringView &key,
                     const StringView &val) {
     auto reply = command(cmd::setex, key, ttl, val);
 
+    _invalidate(key);
+
     reply::parse<void>(*reply);
 }
 
 bool Redis::setnx(const StringView &key, const StringView &val) {
     auto reply = command(cmd::setnx, key, val);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
 long long Redis::setrange(const StringView &key, long long offset, const StringView &val) {
     auto reply = command(cmd::setrange, key, offset, val);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
@@ -470,6 +568,8 @@ long long Redis::rpushx(const StringView &key, const StringView &val) {
 long long Redis::hdel(const StringView &key, const StringView &field) {
     auto reply = command(cmd::hdel, key, field);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
@@ -480,20 +580,32 @@ bool Redis::hexists(const StringView &key, const StringView &field) {
 }
 
 OptionalString Redis::hget(const StringView &key, const StringView &field) {
-    auto reply = command(cmd::hget, key, field);
+    auto fetch = [this, &key, &field]() {
+        auto reply = command(cmd::hget, key, field);
 
-    return reply::parse<OptionalString>(*reply);
+        return reply::parse<OptionalString>(*reply);
+    };
+
+    if (_near_cache) {
+        return _near_cache->hget(key, field, fetch);
+    }
+
+    return fetch();
 }
 
 long long Redis::hincrby(const StringView &key, const StringView &field, long long increment) {
     auto reply = command(cmd::hincrby, key, field, increment);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
 double Redis::hincrbyfloat(const StringView &key, const StringView &field, double increment) {
     auto reply = command(cmd::hincrbyfloat, key, field, increment);
 
+    _invalidate(key);
+
     return reply::parse<double>(*reply);
 }
 
@@ -506,6 +618,8 @@ long long Redis::hlen(const StringView &key) {
 bool Redis::hset(const StringView &key, const StringView &field, const StringView &val) {
     auto reply = command(cmd::hset, key, field, val);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
@@ -516,6 +630,8 @@ bool Redis::hset(const StringView &key, const std::pair<StringView, StringView>
 bool Redis::hsetnx(const StringView &key, const StringView &field, const StringView &val) {
     auto reply = command(cmd::hsetnx, key, field, val);
 
+    _invalidate(key);
+
     return reply::parse<bool>(*reply);
 }
 
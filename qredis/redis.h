@@ -20,8 +20,10 @@
 #include <string>
 #include <chrono>
 #include <initializer_list>
+#include <memory>
 #include <tuple>
 #include "connection_pool.h"
+#include "near_cache.h"
 #include "reply.h"
 #include "command_options.h"
 #include "utils.h"
@@ -51,12 +53,26 @@ public:
     Redis(Redis &&) = default;
     Redis& operator=(Redis &&) = default;
 
-    Pipeline pipeline();
+    // By default, Pipeline and Transaction create a new connection, and close it
+    // when they're destroyed. If *new_connection* is false, they borrow a connection
+    // from the pool instead, and return it when they're destroyed. A borrowed
+    // connection is NOT available to other commands until then, e.g. with the
+    // default pool size, i.e. 1, calling Redis methods while holding a Pipeline
+    // blocks forever. If the Redis object is destroyed first, the connection is closed.
+    Pipeline pipeline(bool new_connection = true);
 
-    Transaction transaction(bool piped = false);
+    Transaction transaction(bool piped = false, bool new_connection = true);
 
     Subscriber subscriber();
 
+    // Serve GET, HGET and HMGET from a client side cache, which is kept coherent with
+    // invalidation messages of CLIENT TRACKING. It requires Redis 6.0 or later.
+    // NOT thread-safe, i.e. call it before sharing the Redis object with other threads.
+    void enable_near_cache(const NearCacheOptions &opts = {});
+
+    // Return zeros, if near cache is NOT enabled.
+    NearCacheStats near_cache_stats() const;
+
     template <typename Cmd, typename ...Args>
     auto command(Cmd cmd, Args &&...args)
         -> typename std::enable_if<!std::is_convertible<Cmd, StringView>::value, ReplyUPtr>::type;
@@ -85,6 +101,18 @@ public:
     auto command(Input first, Input last, Output output)
         -> typename std::enable_if<IsIter<Input>::value, void>::type;
 
+    // Same as *command*, but strings in the reply are NOT copied, i.e. they point into
+    // the reader buffer, which is kept alive by the reply. Useful for large values.
+    // In multiplexing mode, the command is sent with a dedicated connection.
+    template <typename Cmd, typename ...Args>
+    ReplyViewUPtr command_view(Cmd cmd, Args &&...args);
+
+    // Send command, and write elements of the ARRAY reply into *output* while the reply
+    // is parsed, i.e. without building a *redisReply* tree. In multiplexing mode,
+    // the reply is read by the event loop, and converted with *reply::to_array*.
+    template <typename Output, typename Cmd, typename ...Args>
+    void command_stream(Output output, Cmd cmd, Args &&...args);
+
     // CONNECTION commands.
 
     void auth(const StringView &password);
@@ -285,6 +313,9 @@ public:
 
     OptionalString get(const StringView &key);
 
+    // Same as *get*, but returns a view of the value. It's nil if the key doesn't exist.
+    ReplyViewUPtr get_view(const StringView &key);
+
     long long getbit(const StringView &key, long long offset);
 
     std::string getrange(const StringView &key, long long start, long long end);
@@ -1122,6 +1153,26 @@ private:
     template <typename Output, typename Cmd, typename ...Args>
     ReplyUPtr _score_command(Cmd cmd, Args &&... args);
 
+    template <typename Input, typename Output>
+    void _hmget(std::true_type, const StringView &key, Input first, Input last, Output output);
+
+    template <typename Input, typename Output>
+    void _hmget(std::false_type, const StringView &key, Input first, Input last, Output output);
+
+    // Drop the key from near cache after we modify it, so that we can read our writes.
+    void _invalidate(const StringView &key) {
+        if (_near_cache) {
+            _near_cache->invalidate(key);
+        }
+    }
+
+    // Drop all keys from near cache, e.g. after FLUSHDB.
+    void _invalidate() {
+        if (_near_cache) {
+            _near_cache->invalidate();
+        }
+    }
+
     // Pool Mode.
     // Public constructors create a *Redis* instance with a pool.
     // In this case, *_connection* is a null pointer, and is never used.
@@ -1132,6 +1183,9 @@ private:
     // This is used when we create Transaction, Pipeline and Subscriber.
     // In this case, *_pool* is empty, and is never used.
     ConnectionSPtr _connection;
+
+    // Null, if near cache is NOT enabled.
+    std::unique_ptr<NearCache> _near_cache;
 };
 
 #include "redis.hpp"
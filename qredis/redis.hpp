@@ -17,8 +17,10 @@
 #ifndef SEWENEW_REDISPLUSPLUS_REDIS_HPP
 #define SEWENEW_REDISPLUSPLUS_REDIS_HPP
 
+#include <iterator>
 #include "command.h"
 #include "reply.h"
+#include "reply_stream.h"
 #include "utils.h"
 #include "errors.h"
 
@@ -33,6 +35,9 @@ auto Redis::command(Cmd cmd, Args &&...args)
         }
 
         return _command(*_connection, cmd, std::forward<Args>(args)...);
+    } else if (_pool.multiplexing()) {
+        // Multiplexing Mode, i.e. share connections with other threads.
+        return _pool.multiplex(cmd, std::forward<Args>(args)...);
     } else {
         // Pool Mode, i.e. get connection from pool.
         auto connection = _pool.fetch();
@@ -45,6 +50,71 @@ auto Redis::command(Cmd cmd, Args &&...args)
     }
 }
 
+template <typename Cmd, typename ...Args>
+ReplyViewUPtr Redis::command_view(Cmd cmd, Args &&...args) {
+    if (_connection) {
+        // Single Connection Mode.
+        if (_connection->broken()) {
+            throw Error("Connection is broken");
+        }
+
+        ZeroCopyGuard zero_copy(*_connection);
+
+        cmd(*_connection, std::forward<Args>(args)...);
+
+        return _connection->recv_view();
+    }
+
+    // Pool Mode. Shared connections in multiplexing mode are read by the
+    // event loop, so we always get a dedicated connection from pool.
+    auto connection = _pool.fetch();
+
+    assert(!connection.broken());
+
+    ConnectionPoolGuard guard(_pool, connection);
+
+    ZeroCopyGuard zero_copy(connection);
+
+    cmd(connection, std::forward<Args>(args)...);
+
+    return connection.recv_view();
+}
+
+template <typename Output, typename Cmd, typename ...Args>
+void Redis::command_stream(Output output, Cmd cmd, Args &&...args) {
+    OutputSink<Output> sink(output);
+
+    if (_connection) {
+        // Single Connection Mode.
+        if (_connection->broken()) {
+            throw Error("Connection is broken");
+        }
+
+        ZeroCopyGuard zero_copy(*_connection);
+
+        cmd(*_connection, std::forward<Args>(args)...);
+
+        _connection->recv_stream(sink);
+    } else if (_pool.multiplexing()) {
+        auto reply = _pool.multiplex(cmd, std::forward<Args>(args)...);
+
+        reply::to_array(*reply, output);
+    } else {
+        // Pool Mode.
+        auto connection = _pool.fetch();
+
+        assert(!connection.broken());
+
+        ConnectionPoolGuard guard(_pool, connection);
+
+        ZeroCopyGuard zero_copy(connection);
+
+        cmd(connection, std::forward<Args>(args)...);
+
+        connection.recv_stream(sink);
+    }
+}
+
 template <typename ...Args>
 auto Redis::command(const StringView &cmd_name, Args &&...args)
     -> typename std::enable_if<!IsIter<typename LastType<Args...>::type>::value, ReplyUPtr>::type {
@@ -127,6 +197,12 @@ long long Redis::del(Input first, Input last) {
 
     auto reply = command(cmd::del_range<Input>, first, last);
 
+    if (_near_cache) {
+        for (auto iter = first; iter != last; ++iter) {
+            _near_cache->invalidate(*iter);
+        }
+    }
+
     return reply::parse<long long>(*reply);
 }
 
@@ -153,9 +229,7 @@ inline bool Redis::expireat(const StringView &key,
 
 template <typename Output>
 void Redis::keys(const StringView &pattern, Output output) {
-    auto reply = command(cmd::keys, pattern);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::keys, pattern);
 }
 
 inline bool Redis::pexpire(const StringView &key, const std::chrono::milliseconds &timeout) {
@@ -224,6 +298,12 @@ long long Redis::unlink(Input first, Input last) {
 
     auto reply = command(cmd::unlink_range<Input>, first, last);
 
+    if (_near_cache) {
+        for (auto iter = first; iter != last; ++iter) {
+            _near_cache->invalidate(*iter);
+        }
+    }
+
     return reply::parse<long long>(*reply);
 }
 
@@ -241,6 +321,8 @@ long long Redis::bitop(BitOp op, const StringView &destination, Input first, Inp
 
     auto reply = command(cmd::bitop<Input>, op, destination, first, last);
 
+    _invalidate(destination);
+
     return reply::parse<long long>(*reply);
 }
 
@@ -250,9 +332,7 @@ void Redis::mget(Input first, Input last, Output output) {
         throw Error("MGET: no key specified");
     }
 
-    auto reply = command(cmd::mget<Input>, first, last);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::mget<Input>, first, last);
 }
 
 template <typename Input>
@@ -263,6 +343,12 @@ void Redis::mset(Input first, Input last) {
 
     auto reply = command(cmd::mset<Input>, first, last);
 
+    if (_near_cache) {
+        for (auto iter = first; iter != last; ++iter) {
+            _near_cache->invalidate(std::get<0>(*iter));
+        }
+    }
+
     reply::parse<void>(*reply);
 }
 
@@ -274,6 +360,12 @@ bool Redis::msetnx(Input first, Input last) {
 
     auto reply = command(cmd::msetnx<Input>, first, last);
 
+    if (_near_cache) {
+        for (auto iter = first; iter != last; ++iter) {
+            _near_cache->invalidate(std::get<0>(*iter));
+        }
+    }
+
     return reply::parse<bool>(*reply);
 }
 
@@ -346,9 +438,7 @@ inline long long Redis::lpush(const StringView &key, Input first, Input last) {
 
 template <typename Output>
 inline void Redis::lrange(const StringView &key, long long start, long long stop, Output output) {
-    auto reply = command(cmd::lrange, key, start, stop);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::lrange, key, start, stop);
 }
 
 template <typename Input>
@@ -372,21 +462,19 @@ inline long long Redis::hdel(const StringView &key, Input first, Input last) {
 
     auto reply = command(cmd::hdel_range<Input>, key, first, last);
 
+    _invalidate(key);
+
     return reply::parse<long long>(*reply);
 }
 
 template <typename Output>
 inline void Redis::hgetall(const StringView &key, Output output) {
-    auto reply = command(cmd::hgetall, key);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::hgetall, key);
 }
 
 template <typename Output>
 inline void Redis::hkeys(const StringView &key, Output output) {
-    auto reply = command(cmd::hkeys, key);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::hkeys, key);
 }
 
 template <typename Input, typename Output>
@@ -395,9 +483,9 @@ inline void Redis::hmget(const StringView &key, Input first, Input last, Output
         throw Error("HMGET: no key specified");
     }
 
-    auto reply = command(cmd::hmget<Input>, key, first, last);
-
-    reply::to_array(*reply, output);
+    // Near cache only works with OptionalString values.
+    _hmget(typename std::is_same<typename IterType<Output>::type, OptionalString>::type(),
+            key, first, last, output);
 }
 
 template <typename Input>
@@ -408,6 +496,8 @@ inline void Redis::hmset(const StringView &key, Input first, Input last) {
 
     auto reply = command(cmd::hmset<Input>, key, first, last);
 
+    _invalidate(key);
+
     reply::parse<void>(*reply);
 }
 
@@ -447,9 +537,7 @@ inline long long Redis::hscan(const StringView &key,
 
 template <typename Output>
 inline void Redis::hvals(const StringView &key, Output output) {
-    auto reply = command(cmd::hvals, key);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::hvals, key);
 }
 
 // SET commands.
@@ -471,9 +559,7 @@ void Redis::sdiff(Input first, Input last, Output output) {
         throw Error("SDIFF: no key specified");
     }
 
-    auto reply = command(cmd::sdiff<Input>, first, last);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::sdiff<Input>, first, last);
 }
 
 template <typename Input>
@@ -495,9 +581,7 @@ void Redis::sinter(Input first, Input last, Output output) {
         throw Error("SINTER: no key specified");
     }
 
-    auto reply = command(cmd::sinter<Input>, first, last);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::sinter<Input>, first, last);
 }
 
 template <typename Input>
@@ -515,9 +599,7 @@ long long Redis::sinterstore(const StringView &destination,
 
 template <typename Output>
 void Redis::smembers(const StringView &key, Output output) {
-    auto reply = command(cmd::smembers, key);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::smembers, key);
 }
 
 template <typename Output>
@@ -585,9 +667,7 @@ void Redis::sunion(Input first, Input last, Output output) {
         throw Error("SUNION: no key specified");
     }
 
-    auto reply = command(cmd::sunion<Input>, first, last);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::sunion<Input>, first, last);
 }
 
 template <typename Input>
@@ -708,9 +788,7 @@ void Redis::zpopmin(const StringView &key, long long count, Output output) {
 
 template <typename Output>
 void Redis::zrange(const StringView &key, long long start, long long stop, Output output) {
-    auto reply = _score_command<Output>(cmd::zrange, key, start, stop);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::zrange, key, start, stop, IsKvPairIter<Output>::value);
 }
 
 template <typename Interval, typename Output>
@@ -775,9 +853,7 @@ long long Redis::zremrangebyscore(const StringView &key, const Interval &interva
 
 template <typename Output>
 void Redis::zrevrange(const StringView &key, long long start, long long stop, Output output) {
-    auto reply = _score_command<Output>(cmd::zrevrange, key, start, stop);
-
-    reply::to_array(*reply, output);
+    command_stream(output, cmd::zrevrange, key, start, stop, IsKvPairIter<Output>::value);
 }
 
 template <typename Interval, typename Output>
@@ -1046,6 +1122,9 @@ template <typename Cmd, typename ...Args>
 ReplyUPtr Redis::_command(Connection &connection, Cmd cmd, Args &&...args) {
     assert(!connection.broken());
 
+    // The reply is read, i.e. the command is flushed, before arguments are destroyed.
+    ZeroCopyGuard zero_copy(connection);
+
     cmd(connection, std::forward<Args>(args)...);
 
     auto reply = connection.recv();
@@ -1070,4 +1149,50 @@ inline ReplyUPtr Redis::_score_command(Cmd cmd, Args &&... args) {
                             std::forward<Args>(args)...);
 }
 
+template <typename Input, typename Output>
+void Redis::_hmget(std::true_type,
+                    const StringView &key,
+                    Input first,
+                    Input last,
+                    Output output) {
+    if (!_near_cache) {
+        _hmget(std::false_type(), key, first, last, output);
+        return;
+    }
+
+    std::vector<std::string> fields;
+    for (auto iter = first; iter != last; ++iter) {
+        StringView field(*iter);
+        fields.emplace_back(field.data(), field.size());
+    }
+
+    auto fetch = [this, &key](const std::vector<std::string> &missing) {
+        std::vector<OptionalString> values;
+        values.reserve(missing.size());
+
+        command_stream(std::back_inserter(values),
+                        cmd::hmget<std::vector<std::string>::const_iterator>,
+                        key,
+                        missing.begin(),
+                        missing.end());
+
+        return values;
+    };
+
+    auto values = _near_cache->hmget(key, fields, fetch);
+    for (auto &value : values) {
+        *output = std::move(value);
+        ++output;
+    }
+}
+
+template <typename Input, typename Output>
+inline void Redis::_hmget(std::false_type,
+                            const StringView &key,
+                            Input first,
+                            Input last,
+                            Output output) {
+    command_stream(output, cmd::hmget<Input>, key, first, last);
+}
+
 #endif // end SEWENEW_REDISPLUSPLUS_REDIS_HPP
@@ -29,16 +29,24 @@ Redis RedisCluster::redis(const StringView &hash_tag) {
 
 Pipeline RedisCluster::pipeline(const StringView &hash_tag) {
     auto opts = _pool.connection_options(hash_tag);
-    return Pipeline(std::make_shared<Connection>(opts));
+    return Pipeline(std::make_shared<Connection>(opts), false);
+}
+
+ClusterPipeline RedisCluster::cluster_pipeline() {
+    return ClusterPipeline(_pool);
 }
 
 Transaction RedisCluster::transaction(const StringView &hash_tag, bool piped) {
     auto opts = _pool.connection_options(hash_tag);
-    return Transaction(std::make_shared<Connection>(opts), piped);
+    return Transaction(std::make_shared<Connection>(opts), false, piped);
 }
 
 Subscriber RedisCluster::subscriber() {
     auto opts = _pool.connection_options();
+
+    // Subscriber reads push messages, i.e. pub/sub messages with RESP3, as replies.
+    opts.push_handler = nullptr;
+
     return Subscriber(Connection(opts));
 }
 
@@ -51,13 +59,13 @@ long long RedisCluster::del(const StringView &key) {
 }
 
 OptionalString RedisCluster::dump(const StringView &key) {
-    auto reply = command(cmd::dump, key);
+    auto reply = _read_command(cmd::dump, key);
 
     return reply::parse<OptionalString>(*reply);
 }
 
 long long RedisCluster::exists(const StringView &key) {
-    auto reply = command(cmd::exists, key);
+    auto reply = _read_command(cmd::exists, key);
 
     return reply::parse<long long>(*reply);
 }
@@ -93,7 +101,7 @@ bool RedisCluster::pexpireat(const StringView &key, long long timestamp) {
 }
 
 long long RedisCluster::pttl(const StringView &key) {
-    auto reply = command(cmd::pttl, key);
+    auto reply = _read_command(cmd::pttl, key);
 
     return reply::parse<long long>(*reply);
 }
@@ -126,13 +134,13 @@ long long RedisCluster::touch(const StringView &key) {
 }
 
 long long RedisCluster::ttl(const StringView &key) {
-    auto reply = command(cmd::ttl, key);
+    auto reply = _read_command(cmd::ttl, key);
 
     return reply::parse<long long>(*reply);
 }
 
 std::string RedisCluster::type(const StringView &key) {
-    auto reply = command(cmd::type, key);
+    auto reply = _read_command(cmd::type, key);
 
     return reply::parse<std::string>(*reply);
 }
@@ -152,7 +160,7 @@ long long RedisCluster::append(const StringView &key, const StringView &val) {
 }
 
 long long RedisCluster::bitcount(const StringView &key, long long start, long long end) {
-    auto reply = command(cmd::bitcount, key, start, end);
+    auto reply = _read_command(cmd::bitcount, key, start, end);
 
     return reply::parse<long long>(*reply);
 }
@@ -179,19 +187,19 @@ long long RedisCluster::decrby(const StringView &key, long long decrement) {
 }
 
 OptionalString RedisCluster::get(const StringView &key) {
-    auto reply = command(cmd::get, key);
+    auto reply = _read_command(cmd::get, key);
 
     return reply::parse<OptionalString>(*reply);
 }
 
 long long RedisCluster::getbit(const StringView &key, long long offset) {
-    auto reply = command(cmd::getbit, key, offset);
+    auto reply = _read_command(cmd::getbit, key, offset);
 
     return reply::parse<long long>(*reply);
 }
 
 std::string RedisCluster::getrange(const StringView &key, long long start, long long end) {
-    auto reply = command(cmd::getrange, key, start, end);
+    auto reply = _read_command(cmd::getrange, key, start, end);
 
     return reply::parse<std::string>(*reply);
 }
@@ -266,7 +274,7 @@ long long RedisCluster::setrange(const StringView &key, long long offset, const
 }
 
 long long RedisCluster::strlen(const StringView &key) {
-    auto reply = command(cmd::strlen, key);
+    auto reply = _read_command(cmd::strlen, key);
 
     return reply::parse<long long>(*reply);
 }
@@ -282,7 +290,7 @@ OptionalString RedisCluster::brpoplpush(const StringView &source,
 }
 
 OptionalString RedisCluster::lindex(const StringView &key, long long index) {
-    auto reply = command(cmd::lindex, key, index);
+    auto reply = _read_command(cmd::lindex, key, index);
 
     return reply::parse<OptionalString>(*reply);
 }
@@ -297,7 +305,7 @@ long long RedisCluster::linsert(const StringView &key,
 }
 
 long long RedisCluster::llen(const StringView &key) {
-    auto reply = command(cmd::llen, key);
+    auto reply = _read_command(cmd::llen, key);
 
     return reply::parse<long long>(*reply);
 }
@@ -369,13 +377,13 @@ long long RedisCluster::hdel(const StringView &key, const StringView &field) {
 }
 
 bool RedisCluster::hexists(const StringView &key, const StringView &field) {
-    auto reply = command(cmd::hexists, key, field);
+    auto reply = _read_command(cmd::hexists, key, field);
 
     return reply::parse<bool>(*reply);
 }
 
 OptionalString RedisCluster::hget(const StringView &key, const StringView &field) {
-    auto reply = command(cmd::hget, key, field);
+    auto reply = _read_command(cmd::hget, key, field);
 
     return reply::parse<OptionalString>(*reply);
 }
@@ -393,7 +401,7 @@ double RedisCluster::hincrbyfloat(const StringView &key, const StringView &field
 }
 
 long long RedisCluster::hlen(const StringView &key) {
-    auto reply = command(cmd::hlen, key);
+    auto reply = _read_command(cmd::hlen, key);
 
     return reply::parse<long long>(*reply);
 }
@@ -419,7 +427,7 @@ bool RedisCluster::hsetnx(const StringView &key, const std::pair<StringView, Str
 }
 
 long long RedisCluster::hstrlen(const StringView &key, const StringView &field) {
-    auto reply = command(cmd::hstrlen, key, field);
+    auto reply = _read_command(cmd::hstrlen, key, field);
 
     return reply::parse<long long>(*reply);
 }
@@ -433,13 +441,13 @@ long long RedisCluster::sadd(const StringView &key, const StringView &member) {
 }
 
 long long RedisCluster::scard(const StringView &key) {
-    auto reply = command(cmd::scard, key);
+    auto reply = _read_command(cmd::scard, key);
 
     return reply::parse<long long>(*reply);
 }
 
 bool RedisCluster::sismember(const StringView &key, const StringView &member) {
-    auto reply = command(cmd::sismember, key, member);
+    auto reply = _read_command(cmd::sismember, key, member);
 
     return reply::parse<bool>(*reply);
 }
@@ -459,7 +467,7 @@ OptionalString RedisCluster::spop(const StringView &key) {
 }
 
 OptionalString RedisCluster::srandmember(const StringView &key) {
-    auto reply = command(cmd::srandmember, key);
+    auto reply = _read_command(cmd::srandmember, key);
 
     return reply::parse<OptionalString>(*reply);
 }
@@ -497,7 +505,7 @@ long long RedisCluster::zadd(const StringView &key,
 }
 
 long long RedisCluster::zcard(const StringView &key) {
-    auto reply = command(cmd::zcard, key);
+    auto reply = _read_command(cmd::zcard, key);
 
     return reply::parse<long long>(*reply);
 }
@@ -521,7 +529,7 @@ Optional<std::pair<std::string, double>> RedisCluster::zpopmin(const StringView
 }
 
 OptionalLongLong RedisCluster::zrank(const StringView &key, const StringView &member) {
-    auto reply = command(cmd::zrank, key, member);
+    auto reply = _read_command(cmd::zrank, key, member);
 
     return reply::parse<OptionalLongLong>(*reply);
 }
@@ -539,13 +547,13 @@ long long RedisCluster::zremrangebyrank(const StringView &key, long long start,
 }
 
 OptionalLongLong RedisCluster::zrevrank(const StringView &key, const StringView &member) {
-    auto reply = command(cmd::zrevrank, key, member);
+    auto reply = _read_command(cmd::zrevrank, key, member);
 
     return reply::parse<OptionalLongLong>(*reply);
 }
 
 OptionalDouble RedisCluster::zscore(const StringView &key, const StringView &member) {
-    auto reply = command(cmd::zscore, key, member);
+    auto reply = _read_command(cmd::zscore, key, member);
 
     return reply::parse<OptionalDouble>(*reply);
 }
@@ -559,7 +567,7 @@ bool RedisCluster::pfadd(const StringView &key, const StringView &element) {
 }
 
 long long RedisCluster::pfcount(const StringView &key) {
-    auto reply = command(cmd::pfcount, key);
+    auto reply = _read_command(cmd::pfcount, key);
 
     return reply::parse<long long>(*reply);
 }
@@ -21,6 +21,7 @@
 #include <chrono>
 #include <initializer_list>
 #include <tuple>
+#include <vector>
 #include "shards_pool.h"
 #include "reply.h"
 #include "command_options.h"
@@ -28,6 +29,7 @@
 #include "subscriber.h"
 #include "pipeline.h"
 #include "transaction.h"
+#include "cluster_pipeline.h"
 #include "redis.h"
 
 template <typename Impl>
@@ -39,9 +41,13 @@ using Pipeline = QueuedRedis<PipelineImpl>;
 
 class RedisCluster {
 public:
+    // With *Role::SLAVE*, read-only commands, e.g. GET, HGET, are sent to the replica
+    // with the lowest latency, and fall back to the master if replica is unavailable.
+    // NOTE: replicas might return stale data.
     RedisCluster(const ConnectionOptions &connection_opts,
-                    const ConnectionPoolOptions &pool_opts = {}) :
-                        _pool(pool_opts, connection_opts) {}
+                    const ConnectionPoolOptions &pool_opts = {},
+                    Role role = Role::MASTER) :
+                        _pool(pool_opts, connection_opts, role) {}
 
     // Construct RedisCluster with URI:
     // "tcp://127.0.0.1" or "tcp://127.0.0.1:6379"
@@ -58,6 +64,10 @@ public:
 
     Pipeline pipeline(const StringView &hash_tag);
 
+    // Create a pipeline which accepts commands with arbitrary keys.
+    // See *ClusterPipeline* for details.
+    ClusterPipeline cluster_pipeline();
+
     Transaction transaction(const StringView &hash_tag, bool piped = false);
 
     Subscriber subscriber();
@@ -1023,6 +1033,10 @@ private:
         return command(cmd_name, NthValue<Is>(std::forward<Args>(args)...)...);
     }
 
+    // Send a read-only command with key. Try a replica first, if enabled.
+    template <typename Cmd, typename ...Args>
+    ReplyUPtr _read_command(Cmd cmd, const StringView &key, Args &&...args);
+
     template <typename Cmd, typename Input, typename ...Args>
     ReplyUPtr _range_command(Cmd cmd, std::true_type, Input input, Args &&...args);
 
@@ -1040,6 +1054,39 @@ private:
     template <typename Output, typename Cmd, typename ...Args>
     ReplyUPtr _score_command(Cmd cmd, Args &&... args);
 
+    // Items, i.e. keys or key-value pairs, of a multi-key command that belong to
+    // the same slot. *indexes* are the positions of the items in the original range.
+    template <typename Item>
+    struct SlotGroup {
+        Slot slot;
+        std::vector<Item> items;
+        std::vector<std::size_t> indexes;
+    };
+
+    using KeyValue = std::pair<StringView, StringView>;
+
+    static const StringView& _key(const StringView &key) {
+        return key;
+    }
+
+    static const StringView& _key(const KeyValue &kv) {
+        return kv.first;
+    }
+
+    template <typename Item, typename Input>
+    std::vector<SlotGroup<Item>> _group_by_slot(Input first, Input last);
+
+    // Send one sub-command for each slot group. Sub-commands sent to the same node
+    // are pipelined, and all nodes are flushed before we wait for any reply.
+    // Sub-commands failed with redirection or IO errors are retried one by one.
+    // Return replies in the same order as *groups*.
+    template <typename Cmd, typename Item>
+    std::vector<ReplyUPtr> _scatter_gather(Cmd cmd, const std::vector<SlotGroup<Item>> &groups);
+
+    // Scatter-gather a command whose reply is the number of keys, e.g. DEL, EXISTS.
+    template <typename Cmd, typename Input>
+    long long _count_keys(Cmd cmd, Input first, Input last);
+
     ShardsPool _pool;
 };
 
@@ -18,6 +18,7 @@
 #define SEWENEW_REDISPLUSPLUS_REDIS_CLUSTER_HPP
 
 #include <utility>
+#include <unordered_map>
 #include "command.h"
 #include "reply.h"
 #include "utils.h"
@@ -120,9 +121,7 @@ long long RedisCluster::del(Input first, Input last) {
         throw Error("DEL: no key specified");
     }
 
-    auto reply = command(cmd::del_range<Input>, first, last);
-
-    return reply::parse<long long>(*reply);
+    return _count_keys(cmd::del_range<std::vector<StringView>::const_iterator>, first, last);
 }
 
 template <typename Input>
@@ -131,9 +130,7 @@ long long RedisCluster::exists(Input first, Input last) {
         throw Error("EXISTS: no key specified");
     }
 
-    auto reply = command(cmd::exists_range<Input>, first, last);
-
-    return reply::parse<long long>(*reply);
+    return _count_keys(cmd::exists_range<std::vector<StringView>::const_iterator>, first, last);
 }
 
 inline bool RedisCluster::expire(const StringView &key, const std::chrono::seconds &timeout) {
@@ -169,9 +166,7 @@ long long RedisCluster::touch(Input first, Input last) {
         throw Error("TOUCH: no key specified");
     }
 
-    auto reply = command(cmd::touch_range<Input>, first, last);
-
-    return reply::parse<long long>(*reply);
+    return _count_keys(cmd::touch_range<std::vector<StringView>::const_iterator>, first, last);
 }
 
 template <typename Input>
@@ -180,9 +175,7 @@ long long RedisCluster::unlink(Input first, Input last) {
         throw Error("UNLINK: no key specified");
     }
 
-    auto reply = command(cmd::unlink_range<Input>, first, last);
-
-    return reply::parse<long long>(*reply);
+    return _count_keys(cmd::unlink_range<std::vector<StringView>::const_iterator>, first, last);
 }
 
 // STRING commands.
@@ -204,9 +197,49 @@ void RedisCluster::mget(Input first, Input last, Output output) {
         throw Error("MGET: no key specified");
     }
 
-    auto reply = command(cmd::mget<Input>, first, last);
+    auto groups = _group_by_slot<StringView>(first, last);
+    if (groups.size() == 1) {
+        // All keys belong to the same slot.
+        auto reply = command(cmd::mget<Input>, first, last);
 
-    reply::to_array(*reply, output);
+        reply::to_array(*reply, output);
+
+        return;
+    }
+
+    auto replies = _scatter_gather(cmd::mget<std::vector<StringView>::const_iterator>, groups);
+
+    std::size_t num = 0;
+    for (const auto &group : groups) {
+        num += group.items.size();
+    }
+
+    // Merge sub-replies in the order of keys.
+    std::vector<redisReply*> elements(num, nullptr);
+    for (std::size_t idx = 0; idx != groups.size(); ++idx) {
+        auto &reply = *replies[idx];
+        const auto &indexes = groups[idx].indexes;
+        if (!reply::is_array(reply)
+                || reply.element == nullptr
+                || reply.elements != indexes.size()) {
+            throw ProtoError("Expect ARRAY reply with " + std::to_string(indexes.size())
+                    + " elements");
+        }
+
+        for (std::size_t pos = 0; pos != indexes.size(); ++pos) {
+            elements[indexes[pos]] = reply.element[pos];
+        }
+    }
+
+    for (auto *element : elements) {
+        if (element == nullptr) {
+            throw ProtoError("Null array element reply");
+        }
+
+        *output = reply::parse<typename IterType<Output>::type>(*element);
+
+        ++output;
+    }
 }
 
 template <typename Input>
@@ -215,9 +248,21 @@ void RedisCluster::mset(Input first, Input last) {
         throw Error("MSET: no key specified");
     }
 
-    auto reply = command(cmd::mset<Input>, first, last);
+    auto groups = _group_by_slot<KeyValue>(first, last);
+    if (groups.size() == 1) {
+        // All keys belong to the same slot.
+        auto reply = command(cmd::mset<Input>, first, last);
 
-    reply::parse<void>(*reply);
+        reply::parse<void>(*reply);
+
+        return;
+    }
+
+    // NOTE: Unlike MSET on a single node, it's NOT atomic across slots.
+    auto replies = _scatter_gather(cmd::mset<std::vector<KeyValue>::const_iterator>, groups);
+    for (auto &reply : replies) {
+        reply::parse<void>(*reply);
+    }
 }
 
 template <typename Input>
@@ -300,7 +345,7 @@ inline long long RedisCluster::lpush(const StringView &key, Input first, Input l
 
 template <typename Output>
 inline void RedisCluster::lrange(const StringView &key, long long start, long long stop, Output output) {
-    auto reply = command(cmd::lrange, key, start, stop);
+    auto reply = _read_command(cmd::lrange, key, start, stop);
 
     reply::to_array(*reply, output);
 }
@@ -331,14 +376,14 @@ inline long long RedisCluster::hdel(const StringView &key, Input first, Input la
 
 template <typename Output>
 inline void RedisCluster::hgetall(const StringView &key, Output output) {
-    auto reply = command(cmd::hgetall, key);
+    auto reply = _read_command(cmd::hgetall, key);
 
     reply::to_array(*reply, output);
 }
 
 template <typename Output>
 inline void RedisCluster::hkeys(const StringView &key, Output output) {
-    auto reply = command(cmd::hkeys, key);
+    auto reply = _read_command(cmd::hkeys, key);
 
     reply::to_array(*reply, output);
 }
@@ -349,7 +394,7 @@ inline void RedisCluster::hmget(const StringView &key, Input first, Input last,
         throw Error("HMGET: no key specified");
     }
 
-    auto reply = command(cmd::hmget<Input>, key, first, last);
+    auto reply = _read_command(cmd::hmget<Input>, key, first, last);
 
     reply::to_array(*reply, output);
 }
@@ -371,7 +416,7 @@ long long RedisCluster::hscan(const StringView &key,
                         const StringView &pattern,
                         long long count,
                         Output output) {
-    auto reply = command(cmd::hscan, key, cursor, pattern, count);
+    auto reply = _read_command(cmd::hscan, key, cursor, pattern, count);
 
     return reply::parse_scan_reply(*reply, output);
 }
@@ -401,7 +446,7 @@ inline long long RedisCluster::hscan(const StringView &key,
 
 template <typename Output>
 inline void RedisCluster::hvals(const StringView &key, Output output) {
-    auto reply = command(cmd::hvals, key);
+    auto reply = _read_command(cmd::hvals, key);
 
     reply::to_array(*reply, output);
 }
@@ -469,7 +514,7 @@ long long RedisCluster::sinterstore(const StringView &destination,
 
 template <typename Output>
 void RedisCluster::smembers(const StringView &key, Output output) {
-    auto reply = command(cmd::smembers, key);
+    auto reply = _read_command(cmd::smembers, key);
 
     reply::to_array(*reply, output);
 }
@@ -505,7 +550,7 @@ long long RedisCluster::sscan(const StringView &key,
                         const StringView &pattern,
                         long long count,
                         Output output) {
-    auto reply = command(cmd::sscan, key, cursor, pattern, count);
+    auto reply = _read_command(cmd::sscan, key, cursor, pattern, count);
 
     return reply::parse_scan_reply(*reply, output);
 }
@@ -616,7 +661,7 @@ long long RedisCluster::zadd(const StringView &key,
 
 template <typename Interval>
 long long RedisCluster::zcount(const StringView &key, const Interval &interval) {
-    auto reply = command(cmd::zcount<Interval>, key, interval);
+    auto reply = _read_command(cmd::zcount<Interval>, key, interval);
 
     return reply::parse<long long>(*reply);
 }
@@ -641,7 +686,7 @@ long long RedisCluster::zinterstore(const StringView &destination,
 
 template <typename Interval>
 long long RedisCluster::zlexcount(const StringView &key, const Interval &interval) {
-    auto reply = command(cmd::zlexcount<Interval>, key, interval);
+    auto reply = _read_command(cmd::zlexcount<Interval>, key, interval);
 
     return reply::parse<long long>(*reply);
 }
@@ -772,7 +817,7 @@ long long RedisCluster::zscan(const StringView &key,
                         const StringView &pattern,
                         long long count,
                         Output output) {
-    auto reply = command(cmd::zscan, key, cursor, pattern, count);
+    auto reply = _read_command(cmd::zscan, key, cursor, pattern, count);
 
     return reply::parse_scan_reply(*reply, output);
 }
@@ -1022,6 +1067,33 @@ ReplyUPtr RedisCluster::_command(Cmd cmd, std::false_type, Input &&first, Args &
                             std::forward<Args>(args)...);
 }
 
+template <typename Cmd, typename ...Args>
+ReplyUPtr RedisCluster::_read_command(Cmd cmd, const StringView &key, Args &&...args) {
+    auto replica = _pool.replica(_pool.slot(key));
+    if (replica != nullptr) {
+        try {
+            GuardedConnection guarded_connection(replica->pool());
+
+            auto start = std::chrono::steady_clock::now();
+
+            auto reply = _command(cmd, guarded_connection.connection(), key, args...);
+
+            replica->observe(std::chrono::steady_clock::now() - start);
+
+            return reply;
+        } catch (const IoError &) {
+            replica->mark_down();
+        } catch (const ClosedError &) {
+            replica->mark_down();
+        } catch (const RedirectionError &) {
+            // The replica no longer serves the slot, e.g. it's been promoted or removed.
+            // Fall back to master, which will also refresh the slot mapping.
+        }
+    }
+
+    return _command(cmd, key, key, std::forward<Args>(args)...);
+}
+
 template <typename Cmd, typename Input, typename ...Args>
 ReplyUPtr RedisCluster::_range_command(Cmd cmd, std::true_type, Input input, Args &&...args) {
     return _command(cmd, *input, input, std::forward<Args>(args)...);
@@ -1036,6 +1108,8 @@ template <typename Cmd, typename ...Args>
 ReplyUPtr RedisCluster::_command(Cmd cmd, Connection &connection, Args &&...args) {
     assert(!connection.broken());
 
+    ZeroCopyGuard zero_copy(connection);
+
     cmd(connection, std::forward<Args>(args)...);
 
     return connection.recv();
@@ -1062,8 +1136,9 @@ ReplyUPtr RedisCluster::_command(Cmd cmd, const StringView &key, Args &&...args)
             // 2. If it's NOT exist, update slot mapping, and retry.
             // 3. If it's still exist, that means the node is down, NOT removed, throw exception.
         } catch (const MovedError &err) {
-            // Slot mapping has been changed, update it and try again.
-            _pool.update();
+            // Slot mapping has been changed, redirect the slot and try again.
+            // The whole mapping will be refreshed in the background.
+            _pool.update(err.slot(), err.node());
         } catch (const AskError &err) {
             auto guarded_connection = _pool.fetch(err.node());
             auto &connection = guarded_connection.connection();
@@ -1105,4 +1180,135 @@ inline ReplyUPtr RedisCluster::_score_command(Cmd cmd, Args &&... args) {
                             std::forward<Args>(args)...);
 }
 
+template <typename Item, typename Input>
+auto RedisCluster::_group_by_slot(Input first, Input last) -> std::vector<SlotGroup<Item>> {
+    std::vector<SlotGroup<Item>> groups;
+    std::unordered_map<Slot, std::size_t> group_index;
+
+    std::size_t idx = 0;
+    for (; first != last; ++first, ++idx) {
+        Item item = *first;
+        auto slot = _pool.slot(_key(item));
+
+        auto iter = group_index.find(slot);
+        if (iter == group_index.end()) {
+            iter = group_index.emplace(slot, groups.size()).first;
+            groups.push_back(SlotGroup<Item>{slot, {}, {}});
+        }
+
+        auto &group = groups[iter->second];
+        group.items.push_back(item);
+        group.indexes.push_back(idx);
+    }
+
+    return groups;
+}
+
+template <typename Cmd, typename Item>
+std::vector<ReplyUPtr> RedisCluster::_scatter_gather(Cmd cmd,
+                                                    const std::vector<SlotGroup<Item>> &groups) {
+    std::vector<ReplyUPtr> replies(groups.size());
+
+    try {
+        std::vector<Slot> slots;
+        slots.reserve(groups.size());
+        for (const auto &group : groups) {
+            slots.push_back(group.slot);
+        }
+
+        std::vector<std::size_t> owners;
+        auto connections = _pool.fetch(slots, owners);
+
+        // Scatter: a node whose connection fails keeps failing, and its groups are retried.
+        std::vector<bool> failed(connections.size(), false);
+        for (std::size_t idx = 0; idx != groups.size(); ++idx) {
+            auto owner = owners[idx];
+            if (failed[owner]) {
+                continue;
+            }
+
+            auto &connection = connections[owner].connection();
+            try {
+                const auto &items = groups[idx].items;
+                cmd(connection, items.begin(), items.end());
+            } catch (const Error &) {
+                // Drop sub-commands queued before, since all groups of this node are
+                // retried. Some of them might have been written, so reconnect it anyway.
+                connection.clear_output();
+                connection.invalidate();
+                failed[owner] = true;
+            }
+        }
+
+        for (std::size_t idx = 0; idx != connections.size(); ++idx) {
+            if (failed[idx]) {
+                continue;
+            }
+
+            try {
+                connections[idx].connection().flush();
+            } catch (const Error &) {
+                failed[idx] = true;
+            }
+        }
+
+        // Gather: replies of each connection arrive in the order we sent the sub-commands.
+        std::exception_ptr err;
+        for (std::size_t idx = 0; idx != groups.size(); ++idx) {
+            auto &connection = connections[owners[idx]].connection();
+            if (failed[owners[idx]] || connection.broken()) {
+                continue;
+            }
+
+            try {
+                replies[idx] = connection.recv();
+            } catch (const RedirectionError &) {
+                // Retry it later.
+            } catch (const IoError &) {
+                // Retry it later.
+            } catch (const ClosedError &) {
+                // Retry it later.
+            } catch (const Error &) {
+                // Keep reading the remaining replies, so that connections are still usable.
+                if (!err) {
+                    err = std::current_exception();
+                }
+            }
+        }
+
+        if (err) {
+            std::rethrow_exception(err);
+        }
+    } catch (const IoError &) {
+        // Failed to create connections. Retry all groups.
+    } catch (const ClosedError &) {
+        // Retry all groups.
+    }
+
+    // Retry failed groups with the normal code path,
+    // which handles redirection and updates slot mapping.
+    for (std::size_t idx = 0; idx != groups.size(); ++idx) {
+        if (!replies[idx]) {
+            const auto &items = groups[idx].items;
+            replies[idx] = _command(cmd, _key(items.front()), items.begin(), items.end());
+        }
+    }
+
+    return replies;
+}
+
+template <typename Cmd, typename Input>
+long long RedisCluster::_count_keys(Cmd cmd, Input first, Input last) {
+    auto groups = _group_by_slot<StringView>(first, last);
+
+    auto replies = _scatter_gather(cmd, groups);
+
+    long long num = 0;
+    for (auto &reply : replies) {
+        num += reply::parse<long long>(*reply);
+    }
+
+    return num;
+}
+
 #endif // end SEWENEW_REDISPLUSPLUS_REDIS_CLUSTER_HPP
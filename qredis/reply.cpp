@@ -33,7 +33,11 @@ std::string to_status(redisReply &reply) {
 }
 
 std::string parse(ParseTag<std::string>, redisReply &reply) {
-    if (!reply::is_string(reply) && !reply::is_status(reply)) {
+    // With RESP3, big number, verbatim string and double are also returned as string.
+    if (!reply::is_string(reply) && !reply::is_status(reply)
+            && reply.type != REDIS_REPLY_VERB
+            && reply.type != REDIS_REPLY_BIGNUM
+            && !reply::is_double(reply)) {
         throw ProtoError("Expect STRING reply");
     }
 
@@ -55,10 +59,18 @@ long long parse(ParseTag<long long>, redisReply &reply) {
 }
 
 double parse(ParseTag<double>, redisReply &reply) {
+    if (reply::is_double(reply)) {
+        return reply.dval;
+    }
+
     return std::stod(parse<std::string>(reply));
 }
 
 bool parse(ParseTag<bool>, redisReply &reply) {
+    if (reply::is_bool(reply)) {
+        return reply.integer != 0;
+    }
+
     auto ret = parse<long long>(reply);
 
     if (ret == 1) {
@@ -103,7 +115,10 @@ void rewrite_set_reply(redisReply &reply) {
 
     assert(is_status(reply) && reply.str != nullptr);
 
-    free(reply.str);
+    if (reply.arena == nullptr) {
+        // Otherwise, it's freed with the arena.
+        free(reply.str);
+    }
 
     // Make it a TRUE reply.
     reply.type = REDIS_REPLY_INTEGER;
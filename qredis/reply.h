@@ -93,8 +93,33 @@ inline bool is_integer(redisReply &reply) {
     return reply.type == REDIS_REPLY_INTEGER;
 }
 
+// RESP3 set and push messages are also arrays.
 inline bool is_array(redisReply &reply) {
-    return reply.type == REDIS_REPLY_ARRAY;
+    return reply.type == REDIS_REPLY_ARRAY
+            || reply.type == REDIS_REPLY_SET
+            || reply.type == REDIS_REPLY_PUSH;
+}
+
+// RESP3 map, whose *element* holds keys and values alternately.
+inline bool is_map(redisReply &reply) {
+    return reply.type == REDIS_REPLY_MAP;
+}
+
+inline bool is_double(redisReply &reply) {
+    return reply.type == REDIS_REPLY_DOUBLE;
+}
+
+inline bool is_bool(redisReply &reply) {
+    return reply.type == REDIS_REPLY_BOOL;
+}
+
+// Out-of-band message, e.g. pub/sub message or invalidation message with RESP3.
+inline bool is_push(redisReply &reply) {
+    return reply.type == REDIS_REPLY_PUSH;
+}
+
+inline bool is_attribute(redisReply &reply) {
+    return reply.type == REDIS_REPLY_ATTR;
 }
 
 std::string to_status(redisReply &reply);
@@ -118,7 +143,7 @@ namespace detail {
 
 template <typename Output>
 void to_array(redisReply &reply, Output output) {
-    if (!is_array(reply)) {
+    if (!is_array(reply) && !is_map(reply)) {
         throw ProtoError("Expect ARRAY reply");
     }
 
@@ -171,7 +196,8 @@ void to_flat_array(redisReply &reply, Output output) {
 
 template <typename Output>
 void to_array(std::true_type, redisReply &reply, Output output) {
-    if (is_flat_array(reply)) {
+    // A native map is always flat, and we don't need to check its elements.
+    if (is_map(reply) || is_flat_array(reply)) {
         to_flat_array(reply, output);
     } else {
         to_array(reply, output);
@@ -275,7 +301,7 @@ T parse(ParseTag<T>, redisReply &reply) {
 
 template <typename T, typename std::enable_if<IsAssociativeContainer<T>::value, int>::type>
 T parse(ParseTag<T>, redisReply &reply) {
-    if (!is_array(reply)) {
+    if (!is_array(reply) && !is_map(reply)) {
         throw ProtoError("Expect ARRAY reply");
     }
 
@@ -313,7 +339,7 @@ long long parse_scan_reply(redisReply &reply, Output output) {
 
 template <typename Output>
 void to_array(redisReply &reply, Output output) {
-    if (!is_array(reply)) {
+    if (!is_array(reply) && !is_map(reply)) {
         throw ProtoError("Expect ARRAY reply");
     }
 
@@ -0,0 +1,235 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#include "reply_stream.h"
+#include <cstdio>
+#include <cstdlib>
+
+redisReplyObjectFunctions ReplyStreamReader::_functions = {
+    ReplyStreamReader::_create_string,
+    ReplyStreamReader::_create_array,
+    ReplyStreamReader::_create_integer,
+    ReplyStreamReader::_create_double,
+    ReplyStreamReader::_create_nil,
+    ReplyStreamReader::_create_bool,
+    ReplyStreamReader::_free_object
+};
+
+char ReplyStreamReader::_placeholder = 0;
+
+ReplyStreamReader::ReplyStreamReader(redisContext &context, ReplySink &sink) :
+                                        _context(context), _sink(sink) {
+    auto *reader = _context.reader;
+
+    assert(reader != nullptr);
+
+    if (reader->ridx != -1) {
+        throw Error("Reply is partially read");
+    }
+
+    _fn = reader->fn;
+    _privdata = reader->privdata;
+
+    reader->fn = &_functions;
+    reader->privdata = this;
+}
+
+ReplyStreamReader::~ReplyStreamReader() {
+    auto *reader = _context.reader;
+
+    if (reader->ridx != -1 || reader->reply != nullptr) {
+        // Start over with a new reader, since the rest of the reply cannot be parsed.
+        auto maxbuf = reader->maxbuf;
+        redisReaderFree(reader);
+        _context.reader = reader = redisReaderCreate();
+        if (reader == nullptr) {
+            // Cannot recover from OOM.
+            std::abort();
+        }
+
+        reader->maxbuf = maxbuf;
+
+        _context.err = REDIS_ERR_OTHER;
+        snprintf(_context.errstr, sizeof(_context.errstr), "%s", "Reply is partially read");
+    }
+
+    reader->fn = _fn;
+    reader->privdata = _privdata;
+}
+
+void ReplyStreamReader::recv() {
+    do {
+        _skip = false;
+
+        void *r = nullptr;
+        if (redisGetReply(&_context, &r) != REDIS_OK) {
+            throw_error(_context, "Failed to get reply");
+        }
+
+        assert(r == &_placeholder);
+    } while (_skip);
+
+    if (_is_error) {
+        throw_error(_error);
+    }
+
+    if (_exception) {
+        std::rethrow_exception(_exception);
+    }
+
+    _sink.on_end();
+}
+
+void* ReplyStreamReader::_create_string(const redisReadTask *task, char *str, std::size_t len) {
+    if (task->parent == nullptr) {
+        auto *stream_reader = static_cast<ReplyStreamReader*>(task->privdata);
+        if (task->type == REDIS_REPLY_ERROR) {
+            stream_reader->_is_error = true;
+            stream_reader->_error.assign(str, len);
+        } else {
+            stream_reader->_fail(std::make_exception_ptr(ProtoError("Expect ARRAY reply")));
+        }
+    } else {
+        auto *stream_reader = _element(task);
+        if (stream_reader != nullptr) {
+            if (task->type == REDIS_REPLY_VERB) {
+                // Skip the format prefix, e.g. "txt:".
+                str += 4;
+                len -= 4;
+            }
+
+            stream_reader->_call([stream_reader, str, len]() {
+                                    stream_reader->_sink.on_string(StringView(str, len));
+                                });
+        }
+    }
+
+    return &_placeholder;
+}
+
+void* ReplyStreamReader::_create_array(const redisReadTask *task, int /*elements*/) {
+    auto *stream_reader = static_cast<ReplyStreamReader*>(task->privdata);
+    if (task->parent == nullptr) {
+        if (task->type == REDIS_REPLY_ATTR || task->type == REDIS_REPLY_PUSH) {
+            stream_reader->_skip = true;
+        }
+    } else if (!stream_reader->_skip && task->parent->parent != nullptr) {
+        stream_reader->_fail(std::make_exception_ptr(ProtoError("Expect flat ARRAY reply")));
+    }
+
+    return &_placeholder;
+}
+
+void* ReplyStreamReader::_create_integer(const redisReadTask *task, long long value) {
+    auto *stream_reader = _element(task);
+    if (stream_reader != nullptr) {
+        stream_reader->_call([stream_reader, value]() {
+                                stream_reader->_sink.on_integer(value);
+                            });
+    }
+
+    return &_placeholder;
+}
+
+void* ReplyStreamReader::_create_double(const redisReadTask *task,
+                                        double value,
+                                        char *str,
+                                        std::size_t len) {
+    auto *stream_reader = _element(task);
+    if (stream_reader != nullptr) {
+        stream_reader->_call([stream_reader, value, str, len]() {
+                                stream_reader->_sink.on_double(value, StringView(str, len));
+                            });
+    }
+
+    return &_placeholder;
+}
+
+void* ReplyStreamReader::_create_bool(const redisReadTask *task, int value) {
+    auto *stream_reader = _element(task);
+    if (stream_reader != nullptr) {
+        stream_reader->_call([stream_reader, value]() {
+                                stream_reader->_sink.on_bool(value != 0);
+                            });
+    }
+
+    return &_placeholder;
+}
+
+void* ReplyStreamReader::_create_nil(const redisReadTask *task) {
+    auto *stream_reader = _element(task);
+    if (stream_reader != nullptr) {
+        stream_reader->_call([stream_reader]() {
+                                stream_reader->_sink.on_nil();
+                            });
+    }
+
+    return &_placeholder;
+}
+
+void ReplyStreamReader::_free_object(void * /*obj*/) {
+    // Nothing is allocated.
+}
+
+ReplyStreamReader* ReplyStreamReader::_element(const redisReadTask *task) {
+    auto *stream_reader = static_cast<ReplyStreamReader*>(task->privdata);
+
+    if (task->parent == nullptr) {
+        stream_reader->_fail(std::make_exception_ptr(ProtoError("Expect ARRAY reply")));
+        return nullptr;
+    }
+
+    if (stream_reader->_skip
+            || (task->parent->parent != nullptr && task->parent->parent->parent != nullptr)) {
+        // Element of a discarded reply, or a deeply nested array, which has been reported.
+        return nullptr;
+    }
+
+    return stream_reader;
+}
+
+void ReplyStreamReader::_fail(std::exception_ptr err) {
+    if (!_exception) {
+        _exception = err;
+    }
+}
+
+namespace reply {
+
+namespace detail {
+
+void stream_to(const StringView &str, double &value) {
+    value = std::stod(std::string(str.data(), str.size()));
+}
+
+void stream_to(const StringView &str, long long &value) {
+    value = std::stoll(std::string(str.data(), str.size()));
+}
+
+void stream_to(long long integer, bool &value) {
+    if (integer == 1) {
+        value = true;
+    } else if (integer == 0) {
+        value = false;
+    } else {
+        throw ProtoError("Invalid bool reply: " + std::to_string(integer));
+    }
+}
+
+}
+
+}
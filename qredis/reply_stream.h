@@ -0,0 +1,358 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+
+#ifndef SEWENEW_REDISPLUSPLUS_REPLY_STREAM_H
+#define SEWENEW_REDISPLUSPLUS_REPLY_STREAM_H
+
+#include <cassert>
+#include <exception>
+#include <string>
+#include <utility>
+#include "hiredis.h"
+#include "errors.h"
+#include "utils.h"
+
+// Receive elements of an ARRAY reply, while the reply is being parsed.
+class ReplySink {
+public:
+    virtual ~ReplySink() = default;
+
+    // *str* points into the reader buffer, and is only valid during the call.
+    virtual void on_string(const StringView &str) = 0;
+
+    virtual void on_integer(long long value) = 0;
+
+    virtual void on_nil() = 0;
+
+    // RESP3 double, and its string representation.
+    virtual void on_double(double /*value*/, const StringView &str) {
+        on_string(str);
+    }
+
+    // RESP3 bool.
+    virtual void on_bool(bool value) {
+        on_integer(value ? 1 : 0);
+    }
+
+    // Called after all elements have been received.
+    virtual void on_end() {}
+};
+
+// Read an ARRAY reply from the context, and pass its elements to the sink
+// while bytes are parsed, i.e. NO redisReply tree is built. RESP3 map and set
+// are streamed as arrays, while attributes and push messages are discarded.
+// Arrays nested in the root reply, e.g. [member, score] pairs of ZRANGE with
+// RESP3, are flattened. Deeper nesting is NOT supported. NOT thread-safe.
+class ReplyStreamReader {
+public:
+    ReplyStreamReader(redisContext &context, ReplySink &sink);
+
+    ReplyStreamReader(const ReplyStreamReader &) = delete;
+    ReplyStreamReader& operator=(const ReplyStreamReader &) = delete;
+
+    ReplyStreamReader(ReplyStreamReader &&) = delete;
+    ReplyStreamReader& operator=(ReplyStreamReader &&) = delete;
+
+    // Restore the reader. If a reply is partially read, e.g. on timeout,
+    // the connection is broken, since the rest of it cannot be parsed.
+    ~ReplyStreamReader();
+
+    // Throw if it's an error reply, NOT an ARRAY reply, or the sink fails.
+    // In any case, the whole reply has been consumed, unless it throws IoError.
+    void recv();
+
+private:
+    static void* _create_string(const redisReadTask *task, char *str, std::size_t len);
+
+    static void* _create_array(const redisReadTask *task, int elements);
+
+    static void* _create_integer(const redisReadTask *task, long long value);
+
+    static void* _create_double(const redisReadTask *task,
+                                double value,
+                                char *str,
+                                std::size_t len);
+
+    static void* _create_nil(const redisReadTask *task);
+
+    static void* _create_bool(const redisReadTask *task, int value);
+
+    static void _free_object(void *obj);
+
+    static redisReplyObjectFunctions _functions;
+
+    // Returned to the reader as reply objects, which are never dereferenced.
+    static char _placeholder;
+
+    // Return the reader, if the task is an element of the root ARRAY reply.
+    // Otherwise, record an error, and return nullptr.
+    static ReplyStreamReader* _element(const redisReadTask *task);
+
+    // Call the sink, and record the first exception, since we cannot throw through hiredis.
+    template <typename Func>
+    void _call(Func func);
+
+    void _fail(std::exception_ptr err);
+
+    redisContext &_context;
+
+    ReplySink &_sink;
+
+    redisReplyObjectFunctions *_fn = nullptr;
+
+    void *_privdata = nullptr;
+
+    bool _is_error = false;
+
+    // Whether the current reply is an attribute or a push message, which is discarded.
+    bool _skip = false;
+
+    std::string _error;
+
+    std::exception_ptr _exception;
+};
+
+namespace reply {
+
+namespace detail {
+
+// Convert an element of the streamed reply to the output type.
+
+inline void stream_to(const StringView &str, std::string &value) {
+    value.assign(str.data(), str.size());
+}
+
+void stream_to(const StringView &str, double &value);
+
+void stream_to(const StringView &str, long long &value);
+
+inline void stream_to(long long integer, long long &value) {
+    value = integer;
+}
+
+// RESP3 double, and its string representation.
+struct DoubleElement {
+    double value;
+    StringView str;
+};
+
+inline void stream_to(const DoubleElement &element, double &value) {
+    value = element.value;
+}
+
+void stream_to(long long integer, bool &value);
+
+template <typename T>
+void stream_to(const StringView &str, T &value);
+
+template <typename T>
+void stream_to(long long integer, T &value);
+
+template <typename T>
+void stream_to(std::nullptr_t, T &value);
+
+template <typename T>
+void stream_to(const DoubleElement &element, T &value);
+
+template <typename T>
+void stream_to(const StringView &str, Optional<T> &value);
+
+template <typename T>
+void stream_to(long long integer, Optional<T> &value);
+
+template <typename T>
+void stream_to(std::nullptr_t, Optional<T> &value);
+
+template <typename T>
+void stream_to(const DoubleElement &element, Optional<T> &value);
+
+}
+
+}
+
+// Write elements of the streamed reply into an output iterator. If the output
+// type is a pair, e.g. *std::inserter* of *std::unordered_map*, every two
+// consecutive elements are written as a pair.
+template <typename Output, bool = IsKvPairIter<Output>::value>
+class OutputSink;
+
+template <typename Output>
+class OutputSink<Output, false> : public ReplySink {
+public:
+    explicit OutputSink(Output output) : _output(output) {}
+
+    virtual void on_string(const StringView &str) override {
+        _write(str);
+    }
+
+    virtual void on_integer(long long value) override {
+        _write(value);
+    }
+
+    virtual void on_nil() override {
+        _write(nullptr);
+    }
+
+    virtual void on_double(double value, const StringView &str) override {
+        _write(reply::detail::DoubleElement{value, str});
+    }
+
+private:
+    template <typename Src>
+    void _write(Src &&src) {
+        typename IterType<Output>::type value;
+        reply::detail::stream_to(std::forward<Src>(src), value);
+
+        *_output = std::move(value);
+        ++_output;
+    }
+
+    Output _output;
+};
+
+template <typename Output>
+class OutputSink<Output, true> : public ReplySink {
+public:
+    explicit OutputSink(Output output) : _output(output) {}
+
+    virtual void on_string(const StringView &str) override {
+        _write(str);
+    }
+
+    virtual void on_integer(long long value) override {
+        _write(value);
+    }
+
+    virtual void on_nil() override {
+        _write(nullptr);
+    }
+
+    virtual void on_double(double value, const StringView &str) override {
+        _write(reply::detail::DoubleElement{value, str});
+    }
+
+    virtual void on_end() override {
+        if (_has_first) {
+            throw ProtoError("Not string pair array reply");
+        }
+    }
+
+private:
+    using Pair = typename IterType<Output>::type;
+
+    using FirstType = typename std::decay<typename Pair::first_type>::type;
+
+    using SecondType = typename std::decay<typename Pair::second_type>::type;
+
+    template <typename Src>
+    void _write(Src &&src) {
+        if (!_has_first) {
+            reply::detail::stream_to(std::forward<Src>(src), _first);
+            _has_first = true;
+        } else {
+            SecondType second;
+            reply::detail::stream_to(std::forward<Src>(src), second);
+
+            *_output = std::make_pair(std::move(_first), std::move(second));
+            ++_output;
+
+            _has_first = false;
+        }
+    }
+
+    Output _output;
+
+    FirstType _first;
+
+    bool _has_first = false;
+};
+
+// Inline implementations.
+
+template <typename Func>
+void ReplyStreamReader::_call(Func func) {
+    if (_exception) {
+        // Skip the remaining elements.
+        return;
+    }
+
+    try {
+        func();
+    } catch (...) {
+        _fail(std::current_exception());
+    }
+}
+
+namespace reply {
+
+namespace detail {
+
+template <typename T>
+void stream_to(const StringView &, T &) {
+    throw ProtoError("Unexpected STRING reply");
+}
+
+template <typename T>
+void stream_to(long long, T &) {
+    throw ProtoError("Unexpected INTEGER reply");
+}
+
+template <typename T>
+void stream_to(std::nullptr_t, T &) {
+    throw ProtoError("Unexpected NIL reply");
+}
+
+template <typename T>
+void stream_to(const StringView &str, Optional<T> &value) {
+    T tmp;
+    stream_to(str, tmp);
+
+    value = Optional<T>(std::move(tmp));
+}
+
+template <typename T>
+void stream_to(long long integer, Optional<T> &value) {
+    T tmp;
+    stream_to(integer, tmp);
+
+    value = Optional<T>(std::move(tmp));
+}
+
+template <typename T>
+void stream_to(std::nullptr_t, Optional<T> &value) {
+    value = Optional<T>();
+}
+
+template <typename T>
+void stream_to(const DoubleElement &element, T &value) {
+    // Other types are converted from the string representation.
+    stream_to(element.str, value);
+}
+
+template <typename T>
+void stream_to(const DoubleElement &element, Optional<T> &value) {
+    T tmp;
+    stream_to(element, tmp);
+
+    value = Optional<T>(std::move(tmp));
+}
+
+}
+
+}
+
+#endif // end SEWENEW_REDISPLUSPLUS_REPLY_STREAM_H
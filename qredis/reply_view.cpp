@@ -0,0 +1,256 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#include "reply_view.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+StringView ReplyView::str() const {
+    if (!is_string() && !is_status() && !is_error() && !is_double()
+            && _type != REDIS_REPLY_VERB && _type != REDIS_REPLY_BIGNUM) {
+        throw ProtoError("Expect STRING reply");
+    }
+
+    return _str;
+}
+
+long long ReplyView::integer() const {
+    if (!is_integer() && !is_bool()) {
+        throw ProtoError("Expect INTEGER reply");
+    }
+
+    return _integer;
+}
+
+double ReplyView::dval() const {
+    if (!is_double()) {
+        throw ProtoError("Expect DOUBLE reply");
+    }
+
+    return _double;
+}
+
+const ReplyView& ReplyView::operator[](std::size_t idx) const {
+    if (!is_array() && !is_map()) {
+        throw ProtoError("Expect ARRAY reply");
+    }
+
+    if (idx >= _size) {
+        throw Error("Out of range");
+    }
+
+    return _elements[idx];
+}
+
+redisReplyObjectFunctions ReplyViewReader::_functions = {
+    ReplyViewReader::_create_string,
+    ReplyViewReader::_create_array,
+    ReplyViewReader::_create_integer,
+    ReplyViewReader::_create_double,
+    ReplyViewReader::_create_nil,
+    ReplyViewReader::_create_bool,
+    ReplyViewReader::_free_object
+};
+
+ReplyViewReader::ReplyViewReader(redisContext &context) : _context(context) {
+    auto *reader = _context.reader;
+
+    assert(reader != nullptr);
+
+    if (reader->ridx != -1) {
+        throw Error("Reply is partially read");
+    }
+
+    _fn = reader->fn;
+    _privdata = reader->privdata;
+
+    reader->fn = &_functions;
+    reader->privdata = this;
+}
+
+ReplyViewReader::~ReplyViewReader() {
+    auto *reader = _context.reader;
+
+    if (reader->ridx != -1 || reader->reply != nullptr) {
+        // Free the partial reply with our functions, and start over with a new reader.
+        auto maxbuf = reader->maxbuf;
+        redisReaderFree(reader);
+        _context.reader = reader = redisReaderCreate();
+        if (reader == nullptr) {
+            // Cannot recover from OOM.
+            std::abort();
+        }
+
+        reader->maxbuf = maxbuf;
+
+        _context.err = REDIS_ERR_OTHER;
+        snprintf(_context.errstr, sizeof(_context.errstr), "%s", "Reply is partially read");
+    } else {
+        // On OOM, the reader is set to error state, and the connection is broken.
+        redisReaderUnpinBuffer(reader);
+    }
+
+    reader->fn = _fn;
+    reader->privdata = _privdata;
+}
+
+ReplyViewUPtr ReplyViewReader::recv() {
+    void *r = nullptr;
+    if (redisGetReply(&_context, &r) != REDIS_OK) {
+        throw_error(_context, "Failed to get reply");
+    }
+
+    assert(r != nullptr);
+
+    return ReplyViewUPtr(static_cast<ReplyView*>(r));
+}
+
+void* ReplyViewReader::_create_string(const redisReadTask *task, char *str, std::size_t len) {
+    try {
+        auto *reply = _create(task);
+        if (task->type == REDIS_REPLY_VERB) {
+            // Skip the format prefix, e.g. "txt:", which has been checked by the reader.
+            reply->_str = StringView(str + 4, len - 4);
+        } else {
+            reply->_str = StringView(str, len);
+        }
+
+        _keep_chunk(task, reply);
+
+        return reply;
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void* ReplyViewReader::_create_array(const redisReadTask *task, int elements) {
+    try {
+        auto *reply = _create(task);
+        if (elements > 0) {
+            reply->_elements.reset(new ReplyView[elements]);
+            reply->_size = elements;
+        }
+
+        return reply;
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void* ReplyViewReader::_create_integer(const redisReadTask *task, long long value) {
+    try {
+        auto *reply = _create(task);
+        reply->_integer = value;
+
+        return reply;
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void* ReplyViewReader::_create_double(const redisReadTask *task,
+                                        double value,
+                                        char *str,
+                                        std::size_t len) {
+    try {
+        auto *reply = _create(task);
+        reply->_double = value;
+        reply->_str = StringView(str, len);
+
+        _keep_chunk(task, reply);
+
+        return reply;
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void* ReplyViewReader::_create_bool(const redisReadTask *task, int value) {
+    try {
+        auto *reply = _create(task);
+        reply->_integer = value;
+
+        return reply;
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void* ReplyViewReader::_create_nil(const redisReadTask *task) {
+    try {
+        // Task type is STRING, ARRAY or NIL, i.e. null bulk string, null array or RESP3 null.
+        auto *reply = _create(task);
+        reply->_type = REDIS_REPLY_NIL;
+
+        return reply;
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void ReplyViewReader::_free_object(void *obj) {
+    // Only called with the root reply.
+    delete static_cast<ReplyView*>(obj);
+}
+
+ReplyView* ReplyViewReader::_create(const redisReadTask *task) {
+    ReplyView *reply = nullptr;
+    if (task->parent != nullptr) {
+        // Sub-replies are allocated with the parent.
+        auto *parent = static_cast<ReplyView*>(task->parent->obj);
+
+        assert(parent != nullptr && (parent->is_array() || parent->is_map()
+                    || parent->_type == REDIS_REPLY_ATTR));
+        assert(task->idx >= 0 && static_cast<std::size_t>(task->idx) < parent->_size);
+
+        reply = &parent->_elements[task->idx];
+    } else {
+        reply = new ReplyView;
+    }
+
+    reply->_type = task->type;
+
+    return reply;
+}
+
+void ReplyViewReader::_keep_chunk(const redisReadTask *task, ReplyView *reply) {
+    // Find the root reply, which keeps the chunk alive.
+    auto *root_task = task;
+    while (root_task->parent != nullptr) {
+        root_task = root_task->parent;
+    }
+
+    auto *root = (root_task == task) ? reply : static_cast<ReplyView*>(root_task->obj);
+
+    auto *view_reader = static_cast<ReplyViewReader*>(task->privdata);
+    const auto &chunk = view_reader->_pin();
+    if (root->_chunks.empty() || root->_chunks.back() != chunk) {
+        root->_chunks.push_back(chunk);
+    }
+}
+
+const ReplyView::ChunkSPtr& ReplyViewReader::_pin() {
+    auto *reader = _context.reader;
+    if (!reader->pinned) {
+        // Allocate before pinning, so that we don't throw with a pinned buffer.
+        auto chunk = std::make_shared<ReplyView::Chunk>();
+        chunk->buf = redisReaderPinBuffer(reader);
+        _chunk = std::move(chunk);
+    }
+
+    return _chunk;
+}
@@ -0,0 +1,200 @@
+/**************************************************************************
+   Copyright (c) 2017 sewenew
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ *************************************************************************/
+
+#ifndef SEWENEW_REDISPLUSPLUS_REPLY_VIEW_H
+#define SEWENEW_REDISPLUSPLUS_REPLY_VIEW_H
+
+#include <cassert>
+#include <memory>
+#include <vector>
+#include "hiredis.h"
+#include "errors.h"
+#include "utils.h"
+
+// A reply whose strings point into the reader buffer, i.e. they're NOT copied.
+// Buffer chunks are reference-counted and kept alive by the root reply, so that
+// sub-replies and string views are valid until the root reply is destroyed.
+class ReplyView {
+public:
+    ReplyView() = default;
+
+    ReplyView(const ReplyView &) = delete;
+    ReplyView& operator=(const ReplyView &) = delete;
+
+    ReplyView(ReplyView &&) = default;
+    ReplyView& operator=(ReplyView &&) = default;
+
+    ~ReplyView() = default;
+
+    int type() const {
+        return _type;
+    }
+
+    bool is_error() const {
+        return _type == REDIS_REPLY_ERROR;
+    }
+
+    bool is_nil() const {
+        return _type == REDIS_REPLY_NIL;
+    }
+
+    bool is_string() const {
+        return _type == REDIS_REPLY_STRING;
+    }
+
+    bool is_status() const {
+        return _type == REDIS_REPLY_STATUS;
+    }
+
+    bool is_integer() const {
+        return _type == REDIS_REPLY_INTEGER;
+    }
+
+    // Also true for RESP3 set and push message.
+    bool is_array() const {
+        return _type == REDIS_REPLY_ARRAY
+                || _type == REDIS_REPLY_SET
+                || _type == REDIS_REPLY_PUSH;
+    }
+
+    // RESP3 map, whose elements are keys and values alternately.
+    bool is_map() const {
+        return _type == REDIS_REPLY_MAP;
+    }
+
+    bool is_double() const {
+        return _type == REDIS_REPLY_DOUBLE;
+    }
+
+    bool is_bool() const {
+        return _type == REDIS_REPLY_BOOL;
+    }
+
+    // STRING, STATUS or ERROR reply. With RESP3, also verbatim string (without
+    // the format prefix), big number, and string representation of double.
+    StringView str() const;
+
+    // INTEGER reply, or RESP3 bool reply.
+    long long integer() const;
+
+    // RESP3 double reply.
+    double dval() const;
+
+    // Number of elements of ARRAY or MAP reply.
+    std::size_t size() const {
+        return _size;
+    }
+
+    const ReplyView& operator[](std::size_t idx) const;
+
+private:
+    friend class ReplyViewReader;
+
+    int _type = REDIS_REPLY_NIL;
+
+    StringView _str;
+
+    long long _integer = 0;
+
+    double _double = 0;
+
+    std::unique_ptr<ReplyView[]> _elements;
+
+    std::size_t _size = 0;
+
+    // A pinned reader buffer.
+    struct Chunk {
+        Chunk() = default;
+
+        Chunk(const Chunk &) = delete;
+        Chunk& operator=(const Chunk &) = delete;
+
+        ~Chunk() {
+            if (buf != nullptr) {
+                redisReaderFreeBuffer(buf);
+            }
+        }
+
+        char *buf = nullptr;
+    };
+
+    using ChunkSPtr = std::shared_ptr<Chunk>;
+
+    // Only the root reply holds the buffer chunks.
+    std::vector<ChunkSPtr> _chunks;
+};
+
+using ReplyViewUPtr = std::unique_ptr<ReplyView>;
+
+// Read replies from the context as *ReplyView*, until it's destroyed.
+// It hooks the reader with *redisReplyObjectFunctions*, and pins the reader
+// buffer when a string is created, so that the string can point into it.
+// NOT thread-safe.
+class ReplyViewReader {
+public:
+    explicit ReplyViewReader(redisContext &context);
+
+    ReplyViewReader(const ReplyViewReader &) = delete;
+    ReplyViewReader& operator=(const ReplyViewReader &) = delete;
+
+    ReplyViewReader(ReplyViewReader &&) = delete;
+    ReplyViewReader& operator=(ReplyViewReader &&) = delete;
+
+    // Restore the reader. If a reply is partially read, e.g. on timeout,
+    // the connection is broken, since the rest of it cannot be parsed.
+    ~ReplyViewReader();
+
+    ReplyViewUPtr recv();
+
+private:
+    static void* _create_string(const redisReadTask *task, char *str, std::size_t len);
+
+    static void* _create_array(const redisReadTask *task, int elements);
+
+    static void* _create_integer(const redisReadTask *task, long long value);
+
+    static void* _create_double(const redisReadTask *task,
+                                double value,
+                                char *str,
+                                std::size_t len);
+
+    static void* _create_nil(const redisReadTask *task);
+
+    static void* _create_bool(const redisReadTask *task, int value);
+
+    static void _free_object(void *obj);
+
+    static ReplyView* _create(const redisReadTask *task);
+
+    // Keep the pinned chunk alive with the root reply, since the reply points into it.
+    static void _keep_chunk(const redisReadTask *task, ReplyView *reply);
+
+    static redisReplyObjectFunctions _functions;
+
+    // Pin the reader buffer, and return the chunk.
+    const ReplyView::ChunkSPtr& _pin();
+
+    redisContext &_context;
+
+    redisReplyObjectFunctions *_fn = nullptr;
+
+    void *_privdata = nullptr;
+
+    // The chunk that the reader is using, if it's pinned.
+    ReplyView::ChunkSPtr _chunk;
+};
+
+#endif // end SEWENEW_REDISPLUSPLUS_REPLY_VIEW_H
@@ -15,27 +15,117 @@
  *************************************************************************/
 
 #include "shards_pool.h"
+#include <algorithm>
+#include <functional>
 #include <unordered_set>
 #include "errors.h"
 
 const std::size_t ShardsPool::SHARDS;
 
+namespace {
+
+// Min interval between two background refreshes.
+const std::chrono::milliseconds MIN_REFRESH_INTERVAL(100);
+
+// How long we stop sending commands to a failed replica.
+const std::chrono::milliseconds REPLICA_DOWN_INTERVAL(1000);
+
+// Pick a random replica every N selections.
+const std::size_t REPLICA_EXPLORE_INTERVAL = 32;
+
+}
+
+bool Replica::healthy(std::chrono::steady_clock::time_point now) const {
+    return _down_until.load(std::memory_order_relaxed) <= now.time_since_epoch().count();
+}
+
+void Replica::observe(std::chrono::steady_clock::duration rtt) {
+    auto sample = std::chrono::duration_cast<std::chrono::microseconds>(rtt).count();
+    auto latency = _latency.load(std::memory_order_relaxed);
+
+    // EWMA with alpha = 0.2. Concurrent updates might lose a sample, which is fine.
+    if (latency == 0) {
+        latency = sample;
+    } else {
+        latency += (sample - latency) / 5;
+    }
+
+    _latency.store(std::max(latency, 1LL), std::memory_order_relaxed);
+}
+
+void Replica::mark_down() {
+    auto until = std::chrono::steady_clock::now() + REPLICA_DOWN_INTERVAL;
+
+    _down_until.store(until.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+Replica* ReplicaGroup::select() {
+    auto now = std::chrono::steady_clock::now();
+
+    Replica *best = nullptr;
+    for (const auto &replica : _replicas) {
+        if (replica->healthy(now)
+                && (best == nullptr || replica->latency() < best->latency())) {
+            best = replica.get();
+        }
+    }
+
+    static thread_local std::default_random_engine engine;
+    static thread_local std::size_t selections = 0;
+
+    if (best != nullptr && ++selections % REPLICA_EXPLORE_INTERVAL == 0) {
+        std::uniform_int_distribution<std::size_t> uniform_dist(0, _replicas.size() - 1);
+        auto start = uniform_dist(engine);
+        for (std::size_t idx = 0; idx != _replicas.size(); ++idx) {
+            auto &replica = _replicas[(start + idx) % _replicas.size()];
+            if (replica->healthy(now)) {
+                return replica.get();
+            }
+        }
+    }
+
+    return best;
+}
+
+bool ReplicaGroup::same_nodes(const std::vector<Node> &nodes) const {
+    if (nodes.size() != _replicas.size()) {
+        return false;
+    }
+
+    for (std::size_t idx = 0; idx != nodes.size(); ++idx) {
+        if (!(nodes[idx] == _replicas[idx]->node())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 ShardsPool::ShardsPool(const ConnectionPoolOptions &pool_opts,
-                        const ConnectionOptions &connection_opts) :
+                        const ConnectionOptions &connection_opts,
+                        Role role) :
                             _pool_opts(pool_opts),
-                            _connection_opts(connection_opts) {
+                            _connection_opts(connection_opts),
+                            _role(role) {
     if (_connection_opts.type != ConnectionType::TCP) {
         throw Error("Only support TCP connection for Redis Cluster");
     }
 
+    // Multiplexing mode is NOT supported by Redis Cluster.
+    _pool_opts.multiplexing = false;
+
     Connection connection(_connection_opts);
 
-    _shards = _cluster_slots(connection);
+    Replicas replicas;
+    auto shards = _cluster_slots(connection, replicas);
 
-    _init_pool(_shards);
+    _init_pool(shards, replicas);
 }
 
 ShardsPool::ShardsPool(ShardsPool &&that) {
+    // The refresh thread refers to *that*.
+    that._stop_refresh();
+
     std::lock_guard<std::mutex> lock(that._mutex);
 
     _move(std::move(that));
@@ -43,16 +133,57 @@ ShardsPool::ShardsPool(ShardsPool &&that) {
 
 ShardsPool& ShardsPool::operator=(ShardsPool &&that) {
     if (this != &that) {
+        _stop_refresh();
+        that._stop_refresh();
+
         std::lock(_mutex, that._mutex);
         std::lock_guard<std::mutex> lock_this(_mutex, std::adopt_lock);
         std::lock_guard<std::mutex> lock_that(that._mutex, std::adopt_lock);
 
         _move(std::move(that));
+
+        // Our refresh thread has been stopped, and it can be restarted lazily.
+        _refresh_stopped = false;
     }
 
     return *this;
 }
 
+std::vector<GuardedConnection> ShardsPool::fetch(const std::vector<Slot> &slots,
+                                                    std::vector<std::size_t> &owners) {
+    std::vector<ConnectionPoolSPtr> slot_pools;
+    slot_pools.reserve(slots.size());
+    for (auto slot : slots) {
+        slot_pools.push_back(_get_pool(slot));
+    }
+
+    auto pools = slot_pools;
+    auto less = [](const ConnectionPoolSPtr &lhs, const ConnectionPoolSPtr &rhs) {
+                    return std::less<ConnectionPool*>()(lhs.get(), rhs.get());
+    };
+    std::sort(pools.begin(), pools.end(), less);
+    pools.erase(std::unique(pools.begin(), pools.end()), pools.end());
+
+    owners.clear();
+    owners.reserve(slots.size());
+    for (const auto &pool : slot_pools) {
+        // Normally, there're only a few nodes, so a linear search is good enough.
+        owners.push_back(std::find(pools.begin(), pools.end(), pool) - pools.begin());
+    }
+
+    std::vector<GuardedConnection> connections;
+    connections.reserve(pools.size());
+    for (auto &pool : pools) {
+        connections.emplace_back(std::move(pool));
+    }
+
+    return connections;
+}
+
+ShardsPool::~ShardsPool() {
+    _stop_refresh();
+}
+
 GuardedConnection ShardsPool::fetch(const StringView &key) {
     auto slot = _slot(key);
 
@@ -75,19 +206,76 @@ GuardedConnection ShardsPool::fetch(const Node &node) {
         iter = _add_node(node);
     }
 
-    assert(iter != _pools.end());
+    assert(iter != _pools.end() && iter->second);
 
     return GuardedConnection(iter->second);
 }
 
 void ShardsPool::update() {
+    auto start = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(_update_mutex);
+
+    if (_last_update > start) {
+        // Another thread has just refreshed the mapping.
+        return;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+
+    _update();
+
+    _last_update = std::chrono::steady_clock::now();
+
+    if (_connection_opts.metrics) {
+        _connection_opts.metrics->_record_slot_update(_last_update - begin);
+    }
+}
+
+void ShardsPool::update(Slot slot, const Node &node) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_slots || slot > SHARDS) {
+            throw Error("Slot is out of range: " + std::to_string(slot));
+        }
+
+        auto iter = _pools.find(node);
+        if (iter == _pools.end()) {
+            iter = _add_node(node);
+        }
+
+        if ((*_slots)[slot] != iter->second) {
+            auto slots = std::make_shared<SlotTable>(*_slots);
+            (*slots)[slot] = iter->second;
+
+            std::atomic_store(&_slots, SlotTableSPtr(std::move(slots)));
+        }
+
+        if (_replica_slots) {
+            auto group = _replica_group(node);
+            if ((*_replica_slots)[slot] != group) {
+                auto replica_slots = std::make_shared<ReplicaTable>(*_replica_slots);
+                (*replica_slots)[slot] = std::move(group);
+
+                std::atomic_store(&_replica_slots, ReplicaTableSPtr(std::move(replica_slots)));
+            }
+        }
+    }
+
+    // Other slots of the node might also be migrated.
+    _schedule_refresh();
+}
+
+void ShardsPool::_update() {
     // My might send command to a removed node.
     // Try at most 3 times.
     for (auto idx = 0; idx < 3; ++idx) {
         try {
             // Randomly pick a connection.
             auto guarded_connection = fetch();
-            auto shards = _cluster_slots(guarded_connection.connection());
+            Replicas replicas;
+            auto shards = _cluster_slots(guarded_connection.connection(), replicas);
 
             std::unordered_set<Node, NodeHash> nodes;
             for (const auto &shard : shards) {
@@ -96,28 +284,25 @@ void ShardsPool::update() {
 
             std::lock_guard<std::mutex> lock(_mutex);
 
-            // TODO: If shards is unchanged, no need to update, and return immediately.
+            // Add connection pool for new nodes, and update the routing table.
+            // In fact, connections will be created lazily.
+            _update_slots(shards);
 
-            _shards = std::move(shards);
+            _update_replicas(shards, replicas);
 
-            // Remove non-existent nodes.
+            // Remove non-existent nodes. They're no longer referenced by the routing table.
+            // Readers holding an old table, or connections fetched from their pools,
+            // keep the pools alive until they're done.
             for (auto iter = _pools.begin(); iter != _pools.end(); ) {
                 if (nodes.find(iter->first) == nodes.end()) {
                     // Node has been removed.
+                    iter->second->close_idle();
                     _pools.erase(iter++);
                 } else {
                     ++iter;
                 }
             }
 
-            // Add connection pool for new nodes.
-            // In fact, connections will be created lazily.
-            for (const auto &node : nodes) {
-                if (_pools.find(node) == _pools.end()) {
-                    _add_node(node);
-                }
-            }
-
             // Update successfully.
             return;
         } catch (const Error &) {
@@ -139,25 +324,213 @@ ConnectionOptions ShardsPool::connection_options() {
 
     return _connection_options(slot);
 }
+
+ReplicaSPtr ShardsPool::replica(Slot slot) {
+    auto replica_slots = std::atomic_load(&_replica_slots);
+    if (!replica_slots || slot > SHARDS) {
+        return nullptr;
+    }
+
+    auto group = (*replica_slots)[slot];
+    if (!group) {
+        return nullptr;
+    }
+
+    auto *replica = group->select();
+    if (replica == nullptr) {
+        return nullptr;
+    }
+
+    // Share the ownership of the group.
+    return ReplicaSPtr(group, replica);
+}
+
+void ShardsPool::_schedule_refresh() {
+    {
+        std::lock_guard<std::mutex> lock(_refresh_mutex);
+
+        if (_refresh_stopped) {
+            return;
+        }
+
+        if (!_refresh_thread.joinable()) {
+            _refresh_thread = std::thread([this]() { this->_refresh_loop(); });
+        }
+
+        _refresh_requested = true;
+    }
+
+    _refresh_cv.notify_one();
+}
+
+void ShardsPool::_refresh_loop() {
+    std::unique_lock<std::mutex> lock(_refresh_mutex);
+
+    while (true) {
+        _refresh_cv.wait(lock, [this]() { return _refresh_requested || _refresh_stopped; });
+
+        // Rate limit, and coalesce requests arriving in the meantime.
+        _refresh_cv.wait_for(lock, MIN_REFRESH_INTERVAL, [this]() { return _refresh_stopped; });
+
+        if (_refresh_stopped) {
+            return;
+        }
+
+        _refresh_requested = false;
+
+        lock.unlock();
+
+        try {
+            update();
+        } catch (const Error &) {
+            // Try again on next redirection.
+        }
+
+        lock.lock();
+    }
+}
+
+void ShardsPool::_stop_refresh() {
+    {
+        std::lock_guard<std::mutex> lock(_refresh_mutex);
+
+        _refresh_stopped = true;
+    }
+
+    _refresh_cv.notify_one();
+
+    if (_refresh_thread.joinable()) {
+        _refresh_thread.join();
+    }
+}
+
 void ShardsPool::_move(ShardsPool &&that) {
     _pool_opts = that._pool_opts;
     _connection_opts = that._connection_opts;
-    _shards = std::move(that._shards);
+    _role = that._role;
+    _slots = std::move(that._slots);
+    _replica_slots = std::move(that._replica_slots);
+    _replica_groups = std::move(that._replica_groups);
+    _replica_pools = std::move(that._replica_pools);
     _pools = std::move(that._pools);
 }
 
-void ShardsPool::_init_pool(const Shards &shards) {
+void ShardsPool::_init_pool(const Shards &shards, const Replicas &replicas) {
+    _update_slots(shards);
+
+    _update_replicas(shards, replicas);
+}
+
+void ShardsPool::_update_slots(const Shards &shards) {
+    // Slots NOT covered by any shard are left null.
+    auto table = std::make_shared<SlotTable>(SHARDS + 1);
+
+    for (const auto &shard : shards) {
+        const auto &range = shard.first;
+
+        auto iter = _pools.find(shard.second);
+        if (iter == _pools.end()) {
+            iter = _add_node(shard.second);
+        }
+
+        for (auto slot = range.min; slot <= range.max && slot <= SHARDS; ++slot) {
+            (*table)[slot] = iter->second;
+        }
+    }
+
+    std::atomic_store(&_slots, SlotTableSPtr(std::move(table)));
+}
+
+void ShardsPool::_update_replicas(const Shards &shards, const Replicas &replicas) {
+    if (_role != Role::SLAVE) {
+        return;
+    }
+
+    // Reuse the group if replicas of the master don't change,
+    // so that we keep the observed latencies.
+    std::unordered_map<Node, ReplicaGroupSPtr, NodeHash> groups;
+    for (const auto &replica : replicas) {
+        const auto &master = replica.first;
+        const auto &nodes = replica.second;
+        if (nodes.empty()) {
+            continue;
+        }
+
+        auto iter = _replica_groups.find(master);
+        if (iter != _replica_groups.end() && iter->second->same_nodes(nodes)) {
+            groups.emplace(master, iter->second);
+            continue;
+        }
+
+        std::vector<std::unique_ptr<Replica>> members;
+        for (const auto &node : nodes) {
+            auto pool_iter = _replica_pools.find(node);
+            if (pool_iter == _replica_pools.end()) {
+                auto opts = _connection_opts;
+                opts.host = node.host;
+                opts.port = node.port;
+                opts.readonly = true;
+
+                pool_iter = _replica_pools.emplace(node,
+                        std::make_shared<ConnectionPool>(_pool_opts, opts)).first;
+            }
+
+            members.emplace_back(new Replica(node, pool_iter->second));
+        }
+
+        groups.emplace(master, std::make_shared<ReplicaGroup>(std::move(members)));
+    }
+
+    _replica_groups = std::move(groups);
+
+    std::unordered_set<Node, NodeHash> nodes;
+    for (const auto &group : _replica_groups) {
+        for (const auto &replica : group.second->replicas()) {
+            nodes.insert(replica->node());
+        }
+    }
+
+    // Remove pools of replicas that are no longer in any group. Old groups held by
+    // readers, and connections in use, keep them alive until they're done.
+    for (auto iter = _replica_pools.begin(); iter != _replica_pools.end(); ) {
+        if (nodes.find(iter->first) == nodes.end()) {
+            iter->second->close_idle();
+            _replica_pools.erase(iter++);
+        } else {
+            ++iter;
+        }
+    }
+
+    // Slots NOT covered by any shard are left null.
+    auto table = std::make_shared<ReplicaTable>(SHARDS + 1);
+
     for (const auto &shard : shards) {
-        _add_node(shard.second);
+        const auto &range = shard.first;
+        auto group = _replica_group(shard.second);
+
+        for (auto slot = range.min; slot <= range.max && slot <= SHARDS; ++slot) {
+            (*table)[slot] = group;
+        }
     }
+
+    std::atomic_store(&_replica_slots, ReplicaTableSPtr(std::move(table)));
 }
 
-Shards ShardsPool::_cluster_slots(Connection &connection) const {
+ReplicaGroupSPtr ShardsPool::_replica_group(const Node &master) const {
+    auto iter = _replica_groups.find(master);
+    if (iter == _replica_groups.end()) {
+        return nullptr;
+    }
+
+    return iter->second;
+}
+
+Shards ShardsPool::_cluster_slots(Connection &connection, Replicas &replicas) const {
     auto reply = _cluster_slots_command(connection);
 
     assert(reply);
 
-    return _parse_reply(*reply);
+    return _parse_reply(*reply, replicas);
 }
 
 ReplyUPtr ShardsPool::_cluster_slots_command(Connection &connection) const {
@@ -166,7 +539,7 @@ ReplyUPtr ShardsPool::_cluster_slots_command(Connection &connection) const {
     return connection.recv();
 }
 
-Shards ShardsPool::_parse_reply(redisReply &reply) const {
+Shards ShardsPool::_parse_reply(redisReply &reply, Replicas &replicas) const {
     if (!reply::is_array(reply)) {
         throw ProtoError("Expect ARRAY reply");
     }
@@ -182,13 +555,14 @@ Shards ShardsPool::_parse_reply(redisReply &reply) const {
             throw ProtoError("Null slot info");
         }
 
-        shards.emplace(_parse_slot_info(*sub_reply));
+        shards.emplace(_parse_slot_info(*sub_reply, replicas));
     }
 
     return shards;
 }
 
-std::pair<SlotRange, Node> ShardsPool::_parse_slot_info(redisReply &reply) const {
+std::pair<SlotRange, Node> ShardsPool::_parse_slot_info(redisReply &reply,
+                                                        Replicas &replicas) const {
     if (reply.elements < 3 || reply.element == nullptr) {
         throw ProtoError("Invalid slot info");
     }
@@ -213,19 +587,45 @@ std::pair<SlotRange, Node> ShardsPool::_parse_slot_info(redisReply &reply) const
 
     // Master node info
     auto *node_reply = reply.element[2];
-    if (node_reply == nullptr
-            || !reply::is_array(*node_reply)
-            || node_reply->element == nullptr
-            || node_reply->elements < 2) {
+    if (node_reply == nullptr) {
+        throw ProtoError("Invalid node info");
+    }
+
+    auto master = _parse_node(*node_reply);
+
+    // Replicas' info, which is only needed when reading from replicas.
+    if (_role == Role::SLAVE) {
+        std::vector<Node> nodes;
+        for (std::size_t idx = 3; idx < reply.elements; ++idx) {
+            auto *replica_reply = reply.element[idx];
+            if (replica_reply == nullptr) {
+                throw ProtoError("Invalid replica info");
+            }
+
+            nodes.push_back(_parse_node(*replica_reply));
+        }
+
+        replicas[master] = std::move(nodes);
+    }
+
+    return {SlotRange{min_slot, max_slot}, master};
+}
+
+Node ShardsPool::_parse_node(redisReply &reply) const {
+    if (!reply::is_array(reply)
+            || reply.element == nullptr
+            || reply.elements < 2
+            || reply.element[0] == nullptr
+            || reply.element[1] == nullptr) {
         throw ProtoError("Invalid node info");
     }
 
-    auto master_host = reply::parse<std::string>(*(node_reply->element[0]));
-    int master_port = reply::parse<long long>(*(node_reply->element[1]));
+    auto host = reply::parse<std::string>(*(reply.element[0]));
+    int port = reply::parse<long long>(*(reply.element[1]));
 
-    // By now, we ignore node id and other replicas' info.
+    // By now, we ignore node id.
 
-    return {SlotRange{min_slot, max_slot}, Node{master_host, master_port}};
+    return {host, port};
 }
 
 Slot ShardsPool::_slot(const StringView &key) const {
@@ -266,40 +666,26 @@ Slot ShardsPool::_slot() const {
     return uniform_dist(engine);
 }
 
-ConnectionPoolSPtr& ShardsPool::_get_pool(Slot slot) {
-    auto shards_iter = _shards.lower_bound(SlotRange{slot, slot});
-    if (shards_iter == _shards.end() || slot < shards_iter->first.min) {
+ConnectionPoolSPtr ShardsPool::_get_pool(Slot slot) {
+    auto slots = std::atomic_load(&_slots);
+    if (!slots || slot > SHARDS) {
         throw Error("Slot is out of range: " + std::to_string(slot));
     }
 
-    const auto &node = shards_iter->second;
-
-    auto node_iter = _pools.find(node);
-    if (node_iter == _pools.end()) {
+    auto pool = (*slots)[slot];
+    if (!pool) {
         throw Error("Slot is NOT covered: " + std::to_string(slot));
     }
 
-    return node_iter->second;
+    return pool;
 }
 
 GuardedConnection ShardsPool::_fetch(Slot slot) {
-    std::lock_guard<std::mutex> lock(_mutex);
-
-    auto &pool = _get_pool(slot);
-
-    assert(pool);
-
-    return GuardedConnection(pool);
+    return GuardedConnection(_get_pool(slot));
 }
 
 ConnectionOptions ShardsPool::_connection_options(Slot slot) {
-    std::lock_guard<std::mutex> lock(_mutex);
-
-    auto &pool = _get_pool(slot);
-
-    assert(pool);
-
-    return pool->connection_options();
+    return _get_pool(slot)->connection_options();
 }
 
 auto ShardsPool::_add_node(const Node &node) -> NodeMap::iterator {
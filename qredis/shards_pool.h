@@ -18,7 +18,12 @@
 #define SEWENEW_REDISPLUSPLUS_SHARDS_POOL_H
 
 #include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 #include <string>
 #include <random>
 #include <memory>
@@ -28,21 +33,27 @@
 
 using ConnectionPoolSPtr = std::shared_ptr<ConnectionPool>;
 
+// It keeps the pool alive, so that a pool removed from ShardsPool, e.g. the node
+// has been removed from the cluster, is destroyed after its connections are returned.
 class GuardedConnection {
 public:
-    GuardedConnection(const ConnectionPoolSPtr &pool) : _pool(pool),
-                                                        _connection(_pool->fetch()) {
+    explicit GuardedConnection(ConnectionPoolSPtr pool) : _pool(std::move(pool)),
+                                                            _connection(_pool->fetch()) {
         assert(!_connection.broken());
     }
 
     GuardedConnection(const GuardedConnection &) = delete;
     GuardedConnection& operator=(const GuardedConnection &) = delete;
 
-    GuardedConnection(GuardedConnection &&) = default;
-    GuardedConnection& operator=(GuardedConnection &&) = default;
+    GuardedConnection(GuardedConnection &&that) : _pool(std::move(that._pool)),
+                                                    _connection(std::move(that._connection)) {}
+
+    GuardedConnection& operator=(GuardedConnection &&) = delete;
 
     ~GuardedConnection() {
-        _pool->release(std::move(_connection));
+        if (_pool) {
+            _pool->release(std::move(_connection));
+        }
     }
 
     Connection& connection() {
@@ -54,6 +65,93 @@ private:
     Connection _connection;
 };
 
+// Which nodes to send read-only commands to.
+enum class Role {
+    // Send all commands to masters.
+    MASTER = 0,
+
+    // Send read-only commands to replicas if possible, and other commands to masters.
+    SLAVE
+};
+
+// A replica of a master node, and its observed latency.
+class Replica {
+public:
+    Replica(const Node &node, const ConnectionPoolSPtr &pool) : _node(node), _pool(pool) {}
+
+    Replica(const Replica &) = delete;
+    Replica& operator=(const Replica &) = delete;
+
+    Replica(Replica &&) = delete;
+    Replica& operator=(Replica &&) = delete;
+
+    ~Replica() = default;
+
+    const Node& node() const {
+        return _node;
+    }
+
+    const ConnectionPoolSPtr& pool() const {
+        return _pool;
+    }
+
+    // EWMA of round trip time in microseconds.
+    long long latency() const {
+        return _latency.load(std::memory_order_relaxed);
+    }
+
+    bool healthy(std::chrono::steady_clock::time_point now) const;
+
+    // Update the EWMA with a newly observed round trip time.
+    void observe(std::chrono::steady_clock::duration rtt);
+
+    // Stop sending commands to it for a while, e.g. on connection failures.
+    void mark_down();
+
+private:
+    Node _node;
+
+    ConnectionPoolSPtr _pool;
+
+    std::atomic<long long> _latency{0};
+
+    // Time since epoch of steady clock, until which the replica is NOT healthy.
+    std::atomic<std::chrono::steady_clock::rep> _down_until{0};
+};
+
+using ReplicaSPtr = std::shared_ptr<Replica>;
+
+// Replicas of a master node. The set of replicas is immutable.
+class ReplicaGroup {
+public:
+    ReplicaGroup(std::vector<std::unique_ptr<Replica>> replicas) :
+                    _replicas(std::move(replicas)) {}
+
+    ReplicaGroup(const ReplicaGroup &) = delete;
+    ReplicaGroup& operator=(const ReplicaGroup &) = delete;
+
+    ReplicaGroup(ReplicaGroup &&) = delete;
+    ReplicaGroup& operator=(ReplicaGroup &&) = delete;
+
+    ~ReplicaGroup() = default;
+
+    // Pick the healthy replica with the lowest latency. Occasionally pick a random
+    // healthy replica, so that latencies of other replicas are kept up-to-date.
+    // Return nullptr if there's no healthy replica.
+    Replica* select();
+
+    bool same_nodes(const std::vector<Node> &nodes) const;
+
+    const std::vector<std::unique_ptr<Replica>>& replicas() const {
+        return _replicas;
+    }
+
+private:
+    std::vector<std::unique_ptr<Replica>> _replicas;
+};
+
+using ReplicaGroupSPtr = std::shared_ptr<ReplicaGroup>;
+
 class ShardsPool {
 public:
     ShardsPool() = default;
@@ -64,10 +162,12 @@ public:
     ShardsPool(ShardsPool &&that);
     ShardsPool& operator=(ShardsPool &&that);
 
-    ~ShardsPool() = default;
+    // Stop the background refresh thread.
+    ~ShardsPool();
 
     ShardsPool(const ConnectionPoolOptions &pool_opts,
-                const ConnectionOptions &connection_opts);
+                const ConnectionOptions &connection_opts,
+                Role role = Role::MASTER);
 
     // Fetch a connection by key.
     GuardedConnection fetch(const StringView &key);
@@ -78,24 +178,65 @@ public:
     // Fetch a connection by node.
     GuardedConnection fetch(const Node &node);
 
+    // Fetch connections for a batch of slots, one connection per node.
+    // *slots[i]* is served by *connections[owners[i]]*. Connections are always
+    // fetched in the same order, i.e. by pool address, so that threads holding
+    // several connections at once cannot deadlock each other.
+    std::vector<GuardedConnection> fetch(const std::vector<Slot> &slots,
+                                            std::vector<std::size_t> &owners);
+
+    // Get slot by key.
+    Slot slot(const StringView &key) const {
+        return _slot(key);
+    }
+
+    // Get the pool of the node serving the slot.
+    ConnectionPoolSPtr pool(Slot slot) {
+        return _get_pool(slot);
+    }
+
+    // Refresh the whole slot mapping with CLUSTER SLOTS command.
+    // Concurrent calls are coalesced, i.e. if another thread has finished
+    // a refresh after this call begins, we don't refresh again.
     void update();
 
+    // Redirect a single slot to the given node, e.g. on MOVED error. Then schedule
+    // a full refresh in the background, which is rate-limited and coalesced.
+    void update(Slot slot, const Node &node);
+
     ConnectionOptions connection_options(const StringView &key);
 
     ConnectionOptions connection_options();
 
+    // Pick a replica of the master serving the slot. It doesn't lock *_mutex*.
+    // The replica, and its group, is kept alive by the returned pointer.
+    // Return nullptr if role is *Role::MASTER*, or there's no healthy replica.
+    ReplicaSPtr replica(Slot slot);
+
 private:
     void _move(ShardsPool &&that);
 
-    void _init_pool(const Shards &shards);
+    using Replicas = std::unordered_map<Node, std::vector<Node>, NodeHash>;
+
+    void _init_pool(const Shards &shards, const Replicas &replicas);
+
+    void _update();
+
+    void _schedule_refresh();
+
+    void _refresh_loop();
 
-    Shards _cluster_slots(Connection &connection) const;
+    void _stop_refresh();
+
+    Shards _cluster_slots(Connection &connection, Replicas &replicas) const;
 
     ReplyUPtr _cluster_slots_command(Connection &connection) const;
 
-    Shards _parse_reply(redisReply &reply) const;
+    Shards _parse_reply(redisReply &reply, Replicas &replicas) const;
+
+    std::pair<SlotRange, Node> _parse_slot_info(redisReply &reply, Replicas &replicas) const;
 
-    std::pair<SlotRange, Node> _parse_slot_info(redisReply &reply) const;
+    Node _parse_node(redisReply &reply) const;
 
     // Get slot by key.
     std::size_t _slot(const StringView &key) const;
@@ -103,7 +244,8 @@ private:
     // Randomly pick a slot.
     std::size_t _slot() const;
 
-    ConnectionPoolSPtr& _get_pool(Slot slot);
+    // Thread-safe without locking *_mutex*.
+    ConnectionPoolSPtr _get_pool(Slot slot);
 
     GuardedConnection _fetch(Slot slot);
 
@@ -111,19 +253,72 @@ private:
 
     using NodeMap = std::unordered_map<Node, ConnectionPoolSPtr, NodeHash>;
 
+    // NOT thread-safe.
     NodeMap::iterator _add_node(const Node &node);
 
+    // NOT thread-safe.
+    void _update_slots(const Shards &shards);
+
+    // NOT thread-safe.
+    void _update_replicas(const Shards &shards, const Replicas &replicas);
+
+    // NOT thread-safe.
+    ReplicaGroupSPtr _replica_group(const Node &master) const;
+
+    static const std::size_t SHARDS = 16383;
+
+    // Slot routing table, i.e. slot -> pool of the node serving the slot. A null
+    // entry means the slot is NOT covered. A published table is never modified.
+    // Readers take a reference to the current table with *std::atomic_load* without
+    // locking, while writers, holding *_mutex*, publish a new table with *std::atomic_store*.
+    // So a pool is destroyed once it's removed from *_pools*, and neither a table
+    // nor a connection in use references it.
+    using SlotTable = std::vector<ConnectionPoolSPtr>;
+
+    using SlotTableSPtr = std::shared_ptr<const SlotTable>;
+
     ConnectionPoolOptions _pool_opts;
 
     ConnectionOptions _connection_opts;
 
-    Shards _shards;
+    Role _role = Role::MASTER;
+
+    SlotTableSPtr _slots;
+
+    // Replica routing table, i.e. slot -> replicas of the master serving the slot.
+    // Only used with *Role::SLAVE*. Same as *_slots*, it's replaced as a whole.
+    using ReplicaTable = std::vector<ReplicaGroupSPtr>;
+
+    using ReplicaTableSPtr = std::shared_ptr<const ReplicaTable>;
+
+    ReplicaTableSPtr _replica_slots;
 
+    // Replicas of each master, and replica pools. Protected by *_mutex*.
+    std::unordered_map<Node, ReplicaGroupSPtr, NodeHash> _replica_groups;
+
+    NodeMap _replica_pools;
+
+    // Pools of nodes in the cluster. Protected by *_mutex*.
     NodeMap _pools;
 
     std::mutex _mutex;
 
-    static const std::size_t SHARDS = 16383;
+    // Serialize full refreshes.
+    std::mutex _update_mutex;
+
+    // The time when the last full refresh finished. Protected by *_update_mutex*.
+    std::chrono::steady_clock::time_point _last_update{};
+
+    // Background refresh, started lazily on the first MOVED error.
+    std::thread _refresh_thread;
+
+    std::mutex _refresh_mutex;
+
+    std::condition_variable _refresh_cv;
+
+    bool _refresh_requested = false;
+
+    bool _refresh_stopped = false;
 };
 
 #endif // end SEWENEW_REDISPLUSPLUS_SHARDS_POOL_H
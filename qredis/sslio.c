@@ -194,8 +194,8 @@ int redisSslRead(redisContext *c, char *buf, size_t bufcap) {
 }
 
 int redisSslWrite(redisContext *c) {
-    size_t len = c->ssl->lastLen ? c->ssl->lastLen : sdslen(c->obuf);
-    int rv = SSL_write(c->ssl->ssl, c->obuf, len);
+    size_t len = c->ssl->lastLen ? c->ssl->lastLen : sdslen(c->obuf) - c->opos;
+    int rv = SSL_write(c->ssl->ssl, c->obuf + c->opos, len);
 
     if (rv > 0) {
         c->ssl->lastLen = 0;
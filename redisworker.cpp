@@ -0,0 +1,78 @@
+#include "redisworker.h"
+
+redisWorker::redisWorker(const QString &uri, const QString &password, const QString &key,
+                         int interval, QObject *parent) :
+    QObject(parent), uri(uri), password(password), key(key), interval(interval)
+{
+}
+
+redisWorker::~redisWorker()
+{
+    delete redisClient;
+}
+
+void redisWorker::start()
+{
+    // Created here, so that the timer fires in the worker thread.
+    timer = new QTimer(this);
+    connect(timer, &QTimer::timeout, this, &redisWorker::poll);
+    timer->start(interval);
+
+    poll();
+}
+
+bool redisWorker::connectRedis()
+{
+    if (redisClient != nullptr) {
+        return true;
+    }
+
+    try {
+        // Every pooled connection sends AUTH when it's (re)connected.
+        ConnectionOptions opts(uri.toStdString());
+        opts.password = password.toStdString();
+
+        // Fail a command within the poll interval, instead of blocking this thread,
+        // and messageBoard's destructor waiting for it, if the server stops responding.
+        auto timeout = std::chrono::milliseconds(qMax(interval / 2, 100));
+        opts.connect_timeout = timeout;
+        opts.socket_timeout = timeout;
+
+        redisClient = new Redis(opts);
+    } catch (const Error &e) {
+        delete redisClient;
+        redisClient = nullptr;
+        emit failed(QString("init redis failed: ") + e.what());
+        return false;
+    }
+
+    return true;
+}
+
+void redisWorker::poll()
+{
+    if (!connectRedis()) {
+        return;
+    }
+
+    try {
+        auto value = redisClient->get(key.toStdString());
+        emit valueReady(value ? QString::fromStdString(*value) : QString());
+    } catch (const Error &e) {
+        emit failed(e.what());
+    }
+}
+
+void redisWorker::write(const QString &value)
+{
+    if (!connectRedis()) {
+        return;
+    }
+
+    try {
+        redisClient->set(key.toStdString(), value.toStdString());
+        emit valueReady(value);
+    } catch (const Error &e) {
+        emit failed(e.what());
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef REDISWORKER_H
+#define REDISWORKER_H
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include "redis++.h"
+
+// Owns the Redis client and does all blocking I/O. It lives in a worker thread,
+// and talks to the GUI thread with queued signals only.
+class redisWorker : public QObject
+{
+    Q_OBJECT
+public:
+    redisWorker(const QString &uri, const QString &password, const QString &key,
+                int interval, QObject *parent = nullptr);
+    ~redisWorker();
+
+signals:
+    void valueReady(const QString &value);
+    void failed(const QString &error);
+
+public slots:
+    // Must be called in the worker thread, e.g. with QThread::started.
+    void start();
+    void poll();
+    void write(const QString &value);
+
+private:
+    bool connectRedis();
+
+    QString uri;
+    QString password;
+    QString key;
+    int interval;
+    QTimer *timer = nullptr;
+    Redis *redisClient = nullptr;
+};
+
+#endif // REDISWORKER_H